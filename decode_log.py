@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Decodes the tokenized log lines of the chip (LOGGER_TOKENIZED) back into text.
+
+Usage:
+    python decode_log.py [log_file]                  decodes a captured log (or stdin)
+    python decode_log.py --port /dev/ttyUSB0         decodes the serial output live (needs pyserial)
+
+Every other line is passed through unchanged.
+"""
+
+import re
+import sys
+import json
+import struct
+import base64
+import argparse
+
+TOKEN_PREFIX = "$T"
+
+# Same order as LOG_TYPE in console_logger.h
+LOG_TYPES = [("INFO", "[i] "), ("ERR", "[x] "), ("DATA", "-> "), ("NONE", ""), ("FATAL", "[:/] "), ("WARN", "[!] ")]
+
+spec_pattern = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|L|z|j|t)?([diuoxXcsfFeEgGaAp%])')
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def raw(self, length):
+        if self.pos + length > len(self.data):
+            raise IndexError
+        value = self.data[self.pos:self.pos + length]
+        self.pos += length
+        return value
+
+
+def format_message(format_str, reader):
+    def replace(match):
+        flags, width, precision, _, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        spec = "%" + flags + width + ("." + precision if precision else "")
+        try:
+            if conversion == "s":
+                return (spec + "s") % reader.raw(reader.varint()).decode("utf-8", "replace")
+            if conversion in "fFeEgGaA":
+                return (spec + ("f" if conversion in "aA" else conversion)) % struct.unpack("<f", reader.raw(4))[0]
+            value = reader.zigzag()
+            if conversion == "c":
+                return (spec + "c") % chr(value & 0xFF)
+            if conversion == "p":
+                return "0x{:x}".format(value & 0xFFFFFFFF)
+            if conversion == "u":
+                return (spec + "d") % (value & 0xFFFFFFFFFFFFFFFF)
+            return (spec + ("d" if conversion == "i" else conversion)) % value
+        except IndexError:
+            return "<truncated>"
+
+    return spec_pattern.sub(replace, format_str)
+
+
+def decode_line(line, tokens):
+    try:
+        reader = Reader(base64.b64decode(line[len(TOKEN_PREFIX):].strip()))
+        log_type = reader.byte()
+        core_task = reader.byte()
+        timestamp = reader.varint()
+        token = "{:08x}".format(struct.unpack("<I", reader.raw(4))[0])
+    except (ValueError, IndexError, struct.error):
+        return "<malformed token line: {}>".format(line.strip())
+
+    _, prefix = LOG_TYPES[log_type] if log_type < len(LOG_TYPES) else ("?", "[?] ")
+    if token not in tokens:
+        message = "<unknown token {}>".format(token)
+    else:
+        message = format_message(tokens[token]["format"], reader)
+    return "{} | {}[{} ms, task {}] {}".format(core_task >> 4, prefix, timestamp, core_task & 0x0F, message)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes tokenized log lines")
+    parser.add_argument("log_file", nargs="?", help="captured log to decode, stdin if omitted")
+    parser.add_argument("--tokens", default="log_tokens.json", help="token table created by generate_log_tokens.py")
+    parser.add_argument("--port", help="serial port to read from")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    with open(args.tokens) as token_file:
+        tokens = json.load(token_file)["tokens"]
+
+    if args.port:
+        import serial
+        source = (x.decode("utf-8", "replace") for x in serial.Serial(args.port, args.baud))
+    elif args.log_file:
+        source = open(args.log_file, encoding="utf-8", errors="replace")
+    else:
+        source = sys.stdin
+
+    for line in source:
+        if line.startswith(TOKEN_PREFIX):
+            print(decode_line(line, tokens))
+        else:
+            sys.stdout.write(line)
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,58 @@
+import os
+import re
+import json
+
+src_dir = "src"
+file_name = "log_tokens.json"
+
+print("Generating '{}' file to map log tokens to format strings...".format(file_name))
+
+# Matches the log type and the (possibly concatenated) format literal of every LOG_TOKEN() call
+call_pattern = re.compile(r'LOG_TOKEN\s*\(\s*[^,]+,\s*((?:"(?:\\.|[^"\\])*"\s*)+)')
+literal_pattern = re.compile(r'"((?:\\.|[^"\\])*)"')
+
+escapes = {"n": "\n", "t": "\t", "r": "\r", "\\": "\\", "\"": "\"", "'": "'", "0": "\0"}
+
+
+def unescape(literal):
+    return re.sub(r'\\(.)', lambda m: escapes.get(m.group(1), m.group(1)), literal)
+
+
+def get_token(format_str):
+    # 32 bit FNV-1a, has to match getLogToken() in console_logger.h
+    token = 2166136261
+    for byte in format_str.encode("utf-8"):
+        token = ((token ^ byte) * 16777619) & 0xFFFFFFFF
+    return token
+
+
+tokens = {}
+collisions = 0
+
+for root, _, files in os.walk(src_dir):
+    for source_name in sorted(files):
+        if not source_name.endswith((".h", ".cpp", ".ino")):
+            continue
+        path = os.path.join(root, source_name)
+        with open(path, encoding="utf-8") as source_file:
+            content = source_file.read()
+        for match in call_pattern.finditer(content):
+            format_str = "".join(unescape(x) for x in literal_pattern.findall(match.group(1)))
+            token = "{:08x}".format(get_token(format_str))
+            line = content.count("\n", 0, match.start()) + 1
+            if token in tokens and tokens[token]["format"] != format_str:
+                print("   Collision: '{}' and '{}'".format(tokens[token]["format"], format_str))
+                collisions += 1
+                continue
+            tokens[token] = {"format": format_str, "file": path, "line": line}
+
+print("Found {} format strings".format(len(tokens)))
+if collisions:
+    print("WARNING: {} token collisions, change one of the format strings".format(collisions))
+
+print("Saving...")
+
+with open(file_name, "w") as out_file:
+    json.dump({"tokens": tokens}, out_file, indent=2, sort_keys=True)
+
+print("Done.")
@@ -6,18 +6,18 @@ IR_Gadget::IR_Gadget(int ir_recv_pin, int ir_send_pin) :
     if (ir_recv_pin != 0) {
       receiver_ = new IRrecv(ir_recv_pin);
       receiver_->enableIRIn();
-      logger.printfln(LOG_TYPE::DATA, "Receiver-Pin: %d", ir_recv_pin);
+      LOG_TOKEN(LOG_TYPE::DATA, "Receiver-Pin: %d", ir_recv_pin);
     } else {
       everything_ok = false;
-      logger.println(LOG_TYPE::ERR, "'recv_pin' nicht spezifiziert.");
+      LOG_TOKEN(LOG_TYPE::ERR, "'recv_pin' nicht spezifiziert.");
     }
     if (ir_send_pin != 0) {
       blaster_ = new IRsend(ir_send_pin);
       blaster_->begin();
-      logger.printfln(LOG_TYPE::DATA, "Blaster-Pin: %d", ir_send_pin);
+      LOG_TOKEN(LOG_TYPE::DATA, "Blaster-Pin: %d", ir_send_pin);
     } else {
       everything_ok = false;
-      logger.println(LOG_TYPE::ERR, "'send_pin' nicht spezifiziert.");
+      LOG_TOKEN(LOG_TYPE::ERR, "'send_pin' nicht spezifiziert.");
     }
     code_gadget_is_ready_ = everything_ok;
   };
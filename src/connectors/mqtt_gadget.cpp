@@ -1,6 +1,7 @@
 #include "mqtt_gadget.h"
 #include <sstream>
 #include <utility>
+#include <algorithm>
 
 bool MQTTGadget::connect_mqtt() {
   mqttClient_->setServer(mqttServer_, mqtt_port_);
@@ -11,55 +12,46 @@ bool MQTTGadget::connect_mqtt() {
   mqttClient_->setCallback(std::bind(&MQTTGadget::callback, this, _1, _2, _3));
 
   logger.print(LOG_TYPE::DATA, "Connecting to Broker ");
-  uint8_t conn_count = 0;
-  while (!mqttClient_->connected()) {
-    bool connected;
-    if (has_credentials_) {
-      connected = mqttClient_->connect(client_name_.c_str(), username_.c_str(), password_.c_str());
-    } else {
-      connected = mqttClient_->connect(client_name_.c_str());
-    }
-
-    if (connected) {
-      logger.println("OK");
+  bool connected;
+  if (has_credentials_) {
+    connected = mqttClient_->connect(client_name_.c_str(), username_.c_str(), password_.c_str());
+  } else {
+    connected = mqttClient_->connect(client_name_.c_str());
+  }
 
-      logger.println(LOG_TYPE::DATA, "Subscribing to topics:");
-      logger.incIndent();
-      for (const auto& list_path: broadcast_request_paths) {
-        subscribe_to_topic(list_path);
-      }
+  if (!connected) {
+    logger.println("Failed.");
+    LOG_TOKEN(LOG_TYPE::ERR, "No Connection to Broker could be established, retrying in %lu ms", reconnect_delay_);
+    return false;
+  }
 
-      for (const auto& list_path: system_request_paths) {
-        subscribe_to_topic(list_path);
-      }
+  logger.println("OK");
 
-      for (const auto& list_path: additional_request_paths) {
-        subscribe_to_topic(list_path);
-      }
+  LOG_TOKEN(LOG_TYPE::DATA, "Subscribing to topics:");
+  logger.incIndent();
+  for (const auto& list_path: broadcast_request_paths) {
+    subscribe_to_topic(list_path);
+  }
 
-      logger.decIndent();
+  for (const auto& list_path: system_request_paths) {
+    subscribe_to_topic(list_path);
+  }
 
-      mqttClient_->publish("smarthome/debug/out", "Controller Launched");
-      return true;
-    } else {
-      if (conn_count > 5) {
-        logger.println("Failed.");
-        logger.println(LOG_TYPE::ERR, "No Connection to Broker could be established.");
-        break;
-      }
-      logger.print(".");
-      delay(1000);
-      conn_count++;
-    }
+  for (const auto& list_path: additional_request_paths) {
+    subscribe_to_topic(list_path);
   }
-  return false;
+
+  logger.decIndent();
+
+  mqttClient_->publish("smarthome/debug/out", "Controller Launched");
+  return true;
 }
 
 void MQTTGadget::callback(char *topic, const byte *payload, const unsigned int length) {
   std::stringstream local_topic;
   local_topic << topic;
 
-  logger.println("Callback called");
+  LOG_TOKEN(LOG_TYPE::INFO, "Callback called");
 
   std::stringstream local_message;
   for (unsigned int i = 0; i < length; i++) {
@@ -93,10 +85,15 @@ void MQTTGadget::callback(char *topic, const byte *payload, const unsigned int l
   addIncomingRequest(req);
 }
 
-void MQTTGadget::executeRequestSending(std::shared_ptr<Request> req) {
+bool MQTTGadget::executeRequestSending(std::shared_ptr<Request> req) {
   std::string topic = req->getPath();
   std::string body = req->getBody();
-  logger.printfln("System / MQTT", "publishing on '%s': ", topic.c_str());
+
+  // Shipped log lines must not create new log lines
+  bool is_log = topic == PATH_LOG;
+  if (!is_log) {
+    LOG_TOKEN(LOG_TYPE::DATA, "[MQTT] publishing on '%s'", topic.c_str());
+  }
   bool status;
   uint16_t msg_len = body.size();
   status = mqttClient_->publish(topic.c_str(), body.c_str());
@@ -110,10 +107,13 @@ void MQTTGadget::executeRequestSending(std::shared_ptr<Request> req) {
 //    status = status && mqttClient_->write(body[k]);
 //  }
 //  status = status && mqttClient_->endPublish();
+  if (is_log)
+    return status;
   if (status)
-    logger.println("OK");
+    LOG_TOKEN(LOG_TYPE::DATA, "OK");
   else
-    logger.println("ERR");
+    LOG_TOKEN(LOG_TYPE::ERR, "Publishing on '%s' failed", topic.c_str());
+  return status;
 }
 
 MQTTGadget::MQTTGadget(const std::string& client_name,
@@ -128,9 +128,11 @@ MQTTGadget::MQTTGadget(const std::string& client_name,
     mqttServer_(mqtt_ip),
     mqtt_port_(mqtt_port),
     has_credentials_(true),
-    client_name_(client_name) {
+    client_name_(client_name),
+    reconnect_timer_(TIMER_HANDLE_INVALID),
+    reconnect_delay_(MQTT_RECONNECT_MIN_DELAY_MS) {
   if (wifiIsInitialized()) {
-    logger.println("Creating MQTT Gadget");
+    LOG_TOKEN(LOG_TYPE::INFO, "Creating MQTT Gadget");
     logger.incIndent();
     mqttClient_ = new PubSubClient(network_client_);
     bool everything_ok = true;
@@ -138,9 +140,9 @@ MQTTGadget::MQTTGadget(const std::string& client_name,
     // Check IP
     if (mqtt_ip == IPAddress(0, 0, 0, 0)) {
       everything_ok = false;
-      logger.println(LOG_TYPE::ERR, "'ip' is null");
+      LOG_TOKEN(LOG_TYPE::ERR, "'ip' is null");
     } else {
-      logger.printfln("IP: %s", mqtt_ip.toString().c_str());
+      LOG_TOKEN(LOG_TYPE::INFO, "IP: %s", mqtt_ip.toString().c_str());
     }
 
     // Check port
@@ -178,14 +180,23 @@ MQTTGadget::MQTTGadget(const std::string& client_name,
     logger.decIndent();
     request_gadget_is_ready_ = everything_ok;
   } else {
-    logger.println(LOG_TYPE::ERR, "Cannot initialize MQTT: WiFi not working.");
+    LOG_TOKEN(LOG_TYPE::ERR, "Cannot initialize MQTT: WiFi not working.");
     request_gadget_is_ready_ = false;
   }
 }
 
 void MQTTGadget::refresh_network() {
   if (!mqttClient_->connected()) {
-    connect_mqtt();
+    // Wait for the backoff to pass before trying again
+    if (timer_wheel.isActive(reconnect_timer_)) {
+      return;
+    }
+    if (!connect_mqtt()) {
+      reconnect_timer_ = timer_wheel.schedule(reconnect_delay_, nullptr);
+      reconnect_delay_ = std::min(reconnect_delay_ * 2, (unsigned long) MQTT_RECONNECT_MAX_DELAY_MS);
+      return;
+    }
+    reconnect_delay_ = MQTT_RECONNECT_MIN_DELAY_MS;
   }
   mqttClient_->loop();
   sendQueuedItems();
@@ -194,9 +205,9 @@ void MQTTGadget::refresh_network() {
 bool MQTTGadget::subscribe_to_topic(const std::string& topic) {
   bool status = mqttClient_->subscribe(topic.c_str());
   if (status) {
-    logger.printfln("Subscribed to %s", topic.c_str());
+    LOG_TOKEN(LOG_TYPE::INFO, "Subscribed to %s", topic.c_str());
   } else {
-    logger.printfln(LOG_TYPE::ERR, "Failed to subscribe to %s", topic.c_str());
+    LOG_TOKEN(LOG_TYPE::ERR, "Failed to subscribe to %s", topic.c_str());
   }
   return status;
 }
@@ -6,6 +6,7 @@
 #include "smarthome_remote_helper.h"
 #include "wifi_gadget.h"
 #include "../protocol_paths.h"
+#include "../timer_wheel.h"
 
 // Gadget to communicate with MQTT Endpoint
 class MQTTGadget : public WiFiGadget, public RequestGadget {
@@ -23,13 +24,24 @@ protected:
 
   bool has_credentials_;
 
-  const std::string& client_name_;
+  // Copied at creation, a new client id is used for the connection after rebooting
+  const std::string client_name_;
 
+  // Runs until the next connection attempt is allowed
+  TimerHandle reconnect_timer_;
+
+  // Time to wait after the next failed connection attempt, doubled after every failure
+  unsigned long reconnect_delay_;
+
+  /**
+   * Tries to connect to the broker once and subscribes to all topics on success
+   * @return Whether the connection was established
+   */
   bool connect_mqtt();
 
   void callback(char *, const byte *, unsigned int);
 
-  void executeRequestSending(std::shared_ptr<Request> request) override;
+  bool executeRequestSending(std::shared_ptr<Request> request) override;
 
   bool subscribe_to_topic(const std::string& topic);
 
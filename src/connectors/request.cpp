@@ -1,5 +1,6 @@
 #include "request.h"
 
+#include <Arduino.h>
 #include <utility>
 
 Request::Request(std::string req_path, int session_id, std::string sender, std::string receiver, DynamicJsonDocument payload, bool await_answer):
@@ -11,7 +12,8 @@ Request::Request(std::string req_path, int session_id, std::string sender, std::
   needs_response_(false),
   can_respond_(false),
   await_response_(await_answer),
-  response_(nullptr) {}
+  response_(nullptr),
+  created_at_(esp_timer_get_time()) {}
 
 Request::Request(std::string req_path, int session_id, std::string sender, std::string receiver, DynamicJsonDocument payload, std::function<void(std::shared_ptr<Request> request)> answer_method) :
   path_(std::move(req_path)),
@@ -23,7 +25,8 @@ Request::Request(std::string req_path, int session_id, std::string sender, std::
   can_respond_(true),
   send_answer_(std::move(answer_method)),
   await_response_(false),
-  response_(nullptr) {}
+  response_(nullptr),
+  created_at_(esp_timer_get_time()) {}
 
 Request::~Request() {}
 
@@ -39,6 +42,10 @@ std::string Request::getSender() const {
   return sender_;
 }
 
+int64_t Request::getCreationTime() const {
+  return created_at_;
+}
+
 std::string Request::getReceiver() const {
   return receiver_;
 }
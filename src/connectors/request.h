@@ -25,6 +25,9 @@ private:
   bool await_response_;
   std::shared_ptr<Request> response_;
 
+  // Timestamp the request was created at (local time in us), used to measure the handling latency
+  int64_t created_at_;
+
 public:
   /**
    * Constructor for the Request if there should ba an option to send an answer.
@@ -83,6 +86,11 @@ public:
    */
   std::string getSender() const;
 
+  /**
+   * @return The local time in us the request was created (received) at
+   */
+  int64_t getCreationTime() const;
+
   /**
    * Method to check if the request has an receiver
    * @return whether the request has an receiver
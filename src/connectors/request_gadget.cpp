@@ -1,14 +1,30 @@
 #include "request_gadget.h"
 
 #include <utility>
+#include <new>
 
 QueueHandle_t createRequestQueue() {
   return xQueueCreate(REQUEST_QUEUE_LEN, sizeof(std::shared_ptr<Request>));
 }
 
+bool queueRequest(QueueHandle_t queue, std::shared_ptr<Request> request, TickType_t wait_ticks) {
+  if (xQueueSend(queue, &request, wait_ticks) != pdTRUE) {
+    return false;
+  }
+  new(&request) std::shared_ptr<Request>();
+  return true;
+}
+
 // RequestGadget
 void RequestGadget::addIncomingRequest(std::shared_ptr<Request>request) {
-  xQueueSend(buffer_in_request_queue_, &request, portMAX_DELAY);
+  queueRequest(buffer_in_request_queue_, std::move(request), portMAX_DELAY);
+}
+
+void RequestGadget::publishRequest(std::shared_ptr<Request> request) {
+  queueRequest(in_request_queue_, std::move(request), portMAX_DELAY);
+  if (request_notify_task_ != nullptr) {
+    xTaskNotifyGive(request_notify_task_);
+  }
 }
 
 void RequestGadget::sendQueuedItems() {
@@ -16,20 +32,19 @@ void RequestGadget::sendQueuedItems() {
     return;
   }
   if (uxQueueMessagesWaiting(out_request_queue_) > 0) {
-    Serial.println("b");
     std::shared_ptr<Request>buf_req;
-    Serial.println("c");
     xQueueReceive(out_request_queue_, &buf_req, portMAX_DELAY);
-    Serial.println("d");
-    executeRequestSending(buf_req);
-    Serial.println("e");
+    if (!executeRequestSending(buf_req) && send_failed_callback_) {
+      send_failed_callback_(buf_req);
+    }
   }
 }
 
 RequestGadget::RequestGadget() :
     split_req_buffer_(nullptr),
     type_(RequestGadgetType::NONE_G),
-    request_gadget_is_ready_(false) {
+    request_gadget_is_ready_(false),
+    request_notify_task_(nullptr) {
   buffer_in_request_queue_ = createRequestQueue();
   in_request_queue_ = createRequestQueue();
   out_request_queue_ = createRequestQueue();
@@ -38,7 +53,8 @@ RequestGadget::RequestGadget() :
 RequestGadget::RequestGadget(RequestGadgetType t) :
     split_req_buffer_(nullptr),
     type_(t),
-    request_gadget_is_ready_(false) {
+    request_gadget_is_ready_(false),
+    request_notify_task_(nullptr) {
   buffer_in_request_queue_ = createRequestQueue();
   in_request_queue_ = createRequestQueue();
   out_request_queue_ = createRequestQueue();
@@ -53,6 +69,14 @@ RequestGadgetType RequestGadget::getGadgetType() {
   return type_;
 }
 
+void RequestGadget::setRequestNotifyTask(TaskHandle_t task) {
+  request_notify_task_ = task;
+}
+
+void RequestGadget::setSendFailedCallback(std::function<void(std::shared_ptr<Request>)> callback) {
+  send_failed_callback_ = std::move(callback);
+}
+
 bool RequestGadget::hasRequest() {
   return uxQueueMessagesWaiting(in_request_queue_) > 0;
 }
@@ -64,7 +88,20 @@ std::shared_ptr<Request>RequestGadget::getRequest() {
 }
 
 void RequestGadget::sendRequest(std::shared_ptr<Request>request) {
-  xQueueSend(out_request_queue_, &request, portMAX_DELAY);
+  queueRequest(out_request_queue_, std::move(request), portMAX_DELAY);
+}
+
+bool RequestGadget::trySendRequest(std::shared_ptr<Request>request) {
+  return queueRequest(out_request_queue_, std::move(request), 0);
+}
+
+std::vector<std::shared_ptr<Request>> RequestGadget::takeQueuedRequests() {
+  std::vector<std::shared_ptr<Request>> requests;
+  std::shared_ptr<Request> buf_req;
+  while (xQueueReceive(out_request_queue_, &buf_req, 0) == pdTRUE) {
+    requests.push_back(std::move(buf_req));
+  }
+  return requests;
 }
 
 std::shared_ptr<Request>RequestGadget::waitForResponse(int id, unsigned long wait_time) {
@@ -88,7 +125,7 @@ std::shared_ptr<Request>RequestGadget::waitForResponse(int id, unsigned long wai
       }
     }
     for (auto buf_req: buffered_requests) {
-      xQueueSend(in_request_queue_, &buf_req, portMAX_DELAY);
+      publishRequest(buf_req);
     }
     return out_req;
   }
@@ -104,7 +141,7 @@ void RequestGadget::refresh() {
     return;
   }
   refresh_network();
-  if (uxQueueMessagesWaiting(buffer_in_request_queue_) > 0) {
+  while (uxQueueMessagesWaiting(buffer_in_request_queue_) > 0) {
     std::shared_ptr<Request>buf_req;
     xQueueReceive(buffer_in_request_queue_, &buf_req, portMAX_DELAY);
     auto req_payload = buf_req->getPayload();
@@ -135,14 +172,14 @@ void RequestGadget::refresh() {
         split_req_buffer_->addData(p_index, split_payload);
         auto out_req = split_req_buffer_->getRequest();
         if (out_req != nullptr) {
-          xQueueSend(in_request_queue_, &out_req, portMAX_DELAY);
+          publishRequest(out_req);
           split_req_buffer_ = nullptr;
         }
       }
     } else {
 
       // Request is a normal one, put it in queue to be accessible to the outside
-      xQueueSend(in_request_queue_, &buf_req, portMAX_DELAY);
+      publishRequest(buf_req);
     }
   }
 }
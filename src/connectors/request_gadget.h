@@ -13,6 +13,17 @@
 #include "request.h"
 #include "split_request_buffer.h"
 
+/**
+ * Adds a request to a queue of std::shared_ptr<Request>.
+ * The queue only copies the bytes of the pointer, so the reference is handed over to it without being released here.
+ * The receiving side releases it by destroying the pointer it received.
+ * @param queue The queue to add the request to
+ * @param request The request to add
+ * @param wait_ticks Ticks to wait for space in the queue
+ * @return Whether the request was added
+ */
+bool queueRequest(QueueHandle_t queue, std::shared_ptr<Request> request, TickType_t wait_ticks);
+
 enum class RequestGadgetType {
   MQTT_G, SERIAL_G, NONE_G
 };
@@ -38,6 +49,18 @@ protected:
   // Queue for requests that need to be send
   QueueHandle_t out_request_queue_;
 
+  // Task notified every time a new request is accessible, nullptr if nobody waits for requests
+  TaskHandle_t request_notify_task_;
+
+  // Called with every request that could not be sent
+  std::function<void(std::shared_ptr<Request>)> send_failed_callback_;
+
+  /**
+   * Makes a request accessible to the outside and wakes up the task waiting for it
+   * @param request The request
+   */
+  void publishRequest(std::shared_ptr<Request> request);
+
   /**
    * Adds a request to the 'incoming'-queue
    * @param request Request to be added
@@ -47,8 +70,9 @@ protected:
   /**
    * Sends a request to the network
    * @param request Request to be sent
+   * @return Whether the request was sent
    */
-  virtual void executeRequestSending(std::shared_ptr<Request> request) = 0;
+  virtual bool executeRequestSending(std::shared_ptr<Request> request) = 0;
 
   /**
    * Sends requests queued in the out-queue
@@ -82,6 +106,19 @@ public:
    */
   RequestGadgetType getGadgetType();
 
+  /**
+   * Sets the task to notify (xTaskNotifyGive) every time a new request is accessible using getRequest()
+   * @param task The task to notify or nullptr to disable notifying
+   */
+  void setRequestNotifyTask(TaskHandle_t task);
+
+  /**
+   * Sets a callback for requests that could not be sent. It is called by the network task and must not block.
+   * Has to be set before the network task starts.
+   * @param callback The callback
+   */
+  void setSendFailedCallback(std::function<void(std::shared_ptr<Request>)> callback);
+
   /**
    * @return Whether the gadget has received a new request
    */
@@ -100,6 +137,19 @@ public:
    */
   void sendRequest(std::shared_ptr<Request> request);
 
+  /**
+   * Stores a request to be sent without waiting for space in the queue
+   * @param request The request to be sent
+   * @return Whether the request was queued
+   */
+  bool trySendRequest(std::shared_ptr<Request> request);
+
+  /**
+   * Removes all requests waiting to be sent from the out-queue
+   * @return The removed requests, oldest first
+   */
+  std::vector<std::shared_ptr<Request>> takeQueuedRequests();
+
   /**
    * Sends a request and waits for a response to arrive.
    * @param request Request to be sent
@@ -1,15 +1,24 @@
 #include "serial_gadget.h"
+#include "../serial_tx_buffer.h"
+#include "../protocol_paths.h"
 #include <sstream>
 
-void SerialGadget::executeRequestSending(std::shared_ptr<Request> req) {
-  Serial.printf("!r_p[%s]_b[%s]_\n", req->getPath().c_str(), req->getBody().c_str());
+bool SerialGadget::executeRequestSending(std::shared_ptr<Request> req) {
+  std::string out_str = "!r_p[" + req->getPath() + "]_b[" + req->getBody() + "]_\n";
+  if (serial_tx.write(out_str)) {
+    return true;
+  }
+  if (req->getPath() != PATH_LOG) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Dropped request to '%s': serial buffer full", req->getPath().c_str());
+  }
+  return false;
 }
 
 SerialGadget::SerialGadget() :
     RequestGadget(RequestGadgetType::SERIAL_G) {
-  logger.println("Creating Serial Gadget");
+  LOG_TOKEN(LOG_TYPE::INFO, "Creating Serial Gadget");
   logger.incIndent();
-  logger.println(LOG_TYPE::DATA, "Using default Serial Connection");
+  LOG_TOKEN(LOG_TYPE::DATA, "Using default Serial Connection");
   logger.decIndent();
 }
 
@@ -30,8 +39,8 @@ void SerialGadget::receiveSerialRequest() {
     delayMicroseconds(80);
   }
   if (new_msg) {
-    logger.println("Received:");
-    logger.println(sstr.str());
+    LOG_TOKEN(LOG_TYPE::INFO, "Received:");
+    LOG_PRINTLN(LOG_TYPE::INFO, sstr.str());
 
     std::string req_str = sstr.str();
 
@@ -91,19 +100,19 @@ void SerialGadget::receiveSerialRequest() {
         DynamicJsonDocument doc(2056);
         deserializeJson(doc, req_body);
         if (!doc.containsKey("session_id")) {
-          logger.println(LOG_TYPE::WARN, "Received request without session id");
+          LOG_TOKEN(LOG_TYPE::WARN, "Received request without session id");
           return;
         }
         if (!doc.containsKey("sender")) {
-          logger.println(LOG_TYPE::WARN, "Received request without sender");
+          LOG_TOKEN(LOG_TYPE::WARN, "Received request without sender");
           return;
         }
         if (!doc.containsKey("receiver")) {
-          logger.println(LOG_TYPE::WARN, "Received request without receiver");
+          LOG_TOKEN(LOG_TYPE::WARN, "Received request without receiver");
           return;
         }
         if (!doc.containsKey("payload")) {
-          logger.println(LOG_TYPE::WARN, "Received request without payload");
+          LOG_TOKEN(LOG_TYPE::WARN, "Received request without payload");
           return;
         }
         using std::placeholders::_1;
@@ -115,7 +124,7 @@ void SerialGadget::receiveSerialRequest() {
                                              std::bind(&RequestGadget::sendRequest, this, _1));
         addIncomingRequest(req);
       } else {
-        logger.println(LOG_TYPE::WARN, "Received faulty request");
+        LOG_TOKEN(LOG_TYPE::WARN, "Received faulty request");
       }
     }
   }
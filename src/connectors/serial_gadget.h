@@ -8,7 +8,7 @@
 class SerialGadget : public RequestGadget {
 protected:
 
-  void executeRequestSending(std::shared_ptr<Request> req) override;
+  bool executeRequestSending(std::shared_ptr<Request> req) override;
 
   void receiveSerialRequest();
 
@@ -4,7 +4,7 @@
 
 std::string replaceParts(std::string in_str, const std::string &part_to_replace, const std::string &replacement) {
   if (part_to_replace.find(replacement) != std::string::npos) {
-    logger.println(LOG_TYPE::FATAL, "Illegal replacement string");
+    LOG_TOKEN(LOG_TYPE::FATAL, "Illegal replacement string");
     return "";
   }
   while (true) {
@@ -33,7 +33,7 @@ void SplitRequestBuffer::addData(int index, std::string payload) {
     data_buffer_[index] = std::move(payload);
     added_packages_++;
   } else {
-    logger.printfln("Data at index %d is not empty: '%s'", index, data_buffer_[index].c_str());
+    LOG_TOKEN(LOG_TYPE::INFO, "Data at index %d is not empty: '%s'", index, data_buffer_[index].c_str());
   }
 }
 
@@ -52,7 +52,7 @@ std::shared_ptr<Request>SplitRequestBuffer::getRequest() const {
 
     // Check if deserialization was successful
     if (serialization_ok != DeserializationError::Ok) {
-      logger.println("Error in split request deserialization process");
+      LOG_TOKEN(LOG_TYPE::INFO, "Error in split request deserialization process");
       return nullptr;
     }
 
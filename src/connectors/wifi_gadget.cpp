@@ -7,12 +7,12 @@ WiFiGadget::WiFiGadget() = default;
 WiFiGadget::WiFiGadget(std::string ssid, std::string pw):
 wifi_ssid_(std::move(ssid)),
 wifi_password_(std::move(pw)) {
-  logger.println("Connecting to WiFi:");
+  LOG_TOKEN(LOG_TYPE::INFO, "Connecting to WiFi:");
   logger.incIndent();
   network_client_ = WiFiClient();
 
   if (wifi_ssid_ == "null" || wifi_password_ == "null") {
-    logger.println(LOG_TYPE::ERR, "Missing Username or Password.");
+    LOG_TOKEN(LOG_TYPE::ERR, "Missing Username or Password.");
     logger.decIndent();
     wifi_initialized_ = false;
     return;
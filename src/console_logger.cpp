@@ -1,70 +1,98 @@
 #include "console_logger.h"
+#include "serial_tx_buffer.h"
+#include "heap_tracer.h"
 
 #include <utility>
+#include <cstring>
 
-void Console_Logger::printOut(string str) {
-  Serial.print(str.c_str());
-}
-
-void Console_Logger::printOut(char c) {
-  stringstream ss;
-  ss << c;
-  printOut(ss.str());
-}
-
-void Console_Logger::printIndent() {
-  stringstream sstr;
-  sstr << xPortGetCoreID();
-  if (xPortGetCoreID() == 0 || xPortGetCoreID() == 1) {
-    printOut(sstr.str());
-    printOut(" | ");
+void Console_Logger::fillRecord(LogRecord &record, const LogTaskState &state, byte task_id) {
+  record.log_type = state.log_type;
+  record.core = xPortGetCoreID();
+  record.task_id = task_id;
+  record.indent = state.indent;
+  record.tokenized = state.tokenized;
+  record.timestamp = millis();
+  if (state.has_name) {
+    strncpy(record.name, state.name, LOGGER_MAX_NAME_LEN);
   } else {
-    printOut("? | ");
+    record.name[0] = 0;
   }
-
-  byte local_indent;
-  if (xPortGetCoreID() == 0) {
-    local_indent = core_0_indent_;
-  } else {
-    local_indent = core_1_indent_;
-  }
-
-  for (byte k = 0; k < local_indent; k++) {
-    for (byte j = 0; j < indent_len_; j++) {
-      printOut(indent_char_);
-    }
-  }
-}
-
-void Console_Logger::printName(string name) {
-  stringstream buf_str;
-  buf_str << "[" << name << "] ";
-  printOut(buf_str.str());
+  memcpy(record.message, state.buffer, state.buffer_len);
+  record.message_len = state.buffer_len;
 }
 
-void Console_Logger::printBeginning(const LOG_TYPE type, const bool complete = true) {
+/**
+ * Returns the prefix marking the type of a line
+ * @param type The type of the line
+ * @return The prefix
+ */
+static const char *getLogTypePrefix(LOG_TYPE type) {
   switch (type) {
     case LOG_TYPE::INFO:
-      if (complete)
-        printOut("[i] ");
-      break;
+      return "[i] ";
     case LOG_TYPE::ERR:
-      printOut("[x] ");
-      break;
+      return "[x] ";
     case LOG_TYPE::DATA:
-      printOut("-> ");
-      break;
-    case LOG_TYPE::NONE:
-      break;
+      return "-> ";
     case LOG_TYPE::FATAL:
-      printOut("[:/] ");
+      return "[:/] ";
     case LOG_TYPE::WARN:
-      printOut("[!] ");
-      break;
+      return "[!] ";
+    case LOG_TYPE::NONE:
     default:
-      break;
+      return "";
   }
-  print(" ");
+}
+
+/**
+ * Appends data to a string as base64
+ * @param out The string to append to
+ * @param data The data to encode
+ * @param len Length of the data
+ */
+static void appendBase64(std::string &out, const uint8_t *data, size_t len) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t chunk = (uint32_t) data[i] << 16;
+    if (i + 1 < len) chunk |= (uint32_t) data[i + 1] << 8;
+    if (i + 2 < len) chunk |= data[i + 2];
+    out += alphabet[(chunk >> 18) & 0x3F];
+    out += alphabet[(chunk >> 12) & 0x3F];
+    out += i + 1 < len ? alphabet[(chunk >> 6) & 0x3F] : '=';
+    out += i + 2 < len ? alphabet[chunk & 0x3F] : '=';
+  }
+}
+
+void Console_Logger::printOut(const string& str) {
+  serial_tx.write(str);
+}
+
+void Console_Logger::printOut(char c) {
+  serial_tx.write(c);
+}
+
+byte Console_Logger::getTaskID() {
+  TaskHandle_t current_task = xTaskGetCurrentTaskHandle();
+  for (byte i = 0; i < LOGGER_MAX_TASKS; i++) {
+    TaskHandle_t owner = task_handles_[i].load();
+    if (owner == current_task) {
+      return i;
+    }
+    // Slots are never released, so the task cannot own any slot behind the first free one
+    if (owner == nullptr) {
+      if (task_handles_[i].compare_exchange_strong(owner, current_task)) {
+        return i;
+      }
+      if (owner == current_task) {
+        return i;
+      }
+    }
+  }
+  return LOGGER_MAX_TASKS;
+}
+
+Console_Logger::LogTaskState &Console_Logger::getTaskState() {
+  return task_states_[getTaskID()];
 }
 
 void Console_Logger::printnl() {
@@ -73,15 +101,44 @@ void Console_Logger::printnl() {
 
 
 Console_Logger::Console_Logger() :
-    core_0_log_type_(LOG_TYPE::INFO),
-    core_0_indent_(0),
-    core_1_log_type_(LOG_TYPE::INFO),
-    core_1_indent_(0),
+    enqueue_pos_(0),
+    dequeue_pos_(0),
+    dropped_records_(0),
+    drain_task_(nullptr),
     indent_char_(' '),
     indent_len_(INDENT_LEN),
     logging_active_(LOGGING_ACTIVE) {
+  for (auto &handle: task_handles_) {
+    handle.store(nullptr);
+  }
+  for (auto &state: task_states_) {
+    state.buffer_len = 0;
+    state.has_name = false;
+    state.log_type = LOG_TYPE::INFO;
+    state.indent = 0;
+    state.tokenized = false;
+  }
+  for (uint32_t i = 0; i < LOGGER_RING_SIZE; i++) {
+    records_[i].sequence.store(i);
+  }
 };
 
+bool Console_Logger::begin() {
+  auto status = xTaskCreatePinnedToCore(
+      drainTask,                        /* Task function. */
+      "Smarthome_Logger",       /* String with name of task. */
+      LOGGER_TASK_STACK,        /* Stack size in words. */
+      this,                 /* Parameter passed as input of the task */
+      LOGGER_TASK_PRIORITY,    /* Priority of the task. */
+      &drain_task_,                     /* Task handle. */
+      LOGGER_TASK_CORE);        /* Core to run on */
+  return status == pdPASS;
+}
+
+unsigned long Console_Logger::getDroppedRecords() const {
+  return dropped_records_;
+}
+
 void Console_Logger::activateLogging() {
   logging_active_ = true;
   println("Activating Logger");
@@ -93,39 +150,24 @@ void Console_Logger::deactivateLogging() {
 }
 
 void Console_Logger::incIndent() {
-  if (xPortGetCoreID() == 0) {
-    core_0_indent_++;
-  } else {
-    core_1_indent_++;
-  }
+  getTaskState().indent++;
 };
 
 void Console_Logger::decIndent() {
-  if (xPortGetCoreID() == 0) {
-    if (core_0_indent_ > 0)
-      core_0_indent_--;
-  } else {
-    if (core_1_indent_ > 0)
-      core_1_indent_--;
-  }
+  auto &state = getTaskState();
+  if (state.indent > 0)
+    state.indent--;
 };
 
 void Console_Logger::setName(const string& name) {
-  if (xPortGetCoreID() == 0) {
-    core_0_name_ = name;
-    core_0_has_name_ = true;
-  } else {
-    core_1_name_ = name;
-    core_1_has_name_ = true;
-  }
+  auto &state = getTaskState();
+  strncpy(state.name, name.c_str(), LOGGER_MAX_NAME_LEN - 1);
+  state.name[LOGGER_MAX_NAME_LEN - 1] = 0;
+  state.has_name = true;
 }
 
 void Console_Logger::setLogType(const LOG_TYPE type) {
-  if (xPortGetCoreID() == 0) {
-    core_0_log_type_ = type;
-  } else {
-    core_1_log_type_ = type;
-  }
+  getTaskState().log_type = type;
 }
 
 void Console_Logger::setCallback(std::function<void(LOG_TYPE ,string ,string ,int )> new_callback){
@@ -137,53 +179,238 @@ void Console_Logger::setCallbackStatus(LOG_TYPE type, bool status) {
 }
 
 void Console_Logger::callCallback(LOG_TYPE type, string message, string name, int task_id){
-  if (callback_status_[(int) type]) {
+  if (callback_status_[(int) type] && callback_) {
     callback_(type, move(message), move(name), task_id);
   }
 }
 
-
-void Console_Logger::addToBuffer(string s) {
-  if (xPortGetCoreID() == 0) {
-    for(char c:s) {
-      if (c != '\n')
-        core_0_buffer_ << c;
+void Console_Logger::addToBuffer(const char *str, size_t len) {
+  auto &state = getTaskState();
+  for (size_t i = 0; i < len && state.buffer_len < LOGGER_MAX_MESSAGE_LEN - 1; i++) {
+    if (str[i] != '\n') {
+      state.buffer[state.buffer_len++] = str[i];
     }
-  } else {
-    for(char c:s) {
-      if (c != '\n')
-        core_1_buffer_ << c;
+  }
+}
+
+void Console_Logger::addToBuffer(const string& s) {
+  addToBuffer(s.c_str(), s.size());
+}
+
+void Console_Logger::addRawToBuffer(const uint8_t *data, size_t len) {
+  auto &state = getTaskState();
+  size_t space = LOGGER_MAX_MESSAGE_LEN - state.buffer_len;
+  if (len > space) {
+    len = space;
+  }
+  memcpy(&state.buffer[state.buffer_len], data, len);
+  state.buffer_len += len;
+}
+
+void Console_Logger::addVarintToBuffer(uint64_t value) {
+  uint8_t buf[10];
+  size_t len = 0;
+  do {
+    buf[len] = value & 0x7F;
+    value >>= 7;
+    if (value != 0) {
+      buf[len] |= 0x80;
     }
+    len++;
+  } while (value != 0);
+  addRawToBuffer(buf, len);
+}
+
+void Console_Logger::beginToken(LOG_TYPE type, uint32_t token) {
+  // Finish any text line that is still being assembled
+  flushBuffer();
+  auto &state = getTaskState();
+  state.log_type = type;
+  state.tokenized = true;
+  uint8_t token_bytes[4] = {(uint8_t) token, (uint8_t) (token >> 8), (uint8_t) (token >> 16), (uint8_t) (token >> 24)};
+  addRawToBuffer(token_bytes, sizeof(token_bytes));
+}
+
+void Console_Logger::encodeTokenArg(const char *str) {
+  size_t len = strlen(str);
+  if (len > LOG_TOKEN_MAX_STR_LEN) {
+    len = LOG_TOKEN_MAX_STR_LEN;
   }
+  addVarintToBuffer(len);
+  addRawToBuffer((const uint8_t *) str, len);
+}
+
+void Console_Logger::encodeTokenArg(const string &str) {
+  encodeTokenArg(str.c_str());
+}
+
+bool Console_Logger::lineIsEnabled() {
+  return levelIsEnabled(getTaskState().log_type);
+}
+
+void Console_Logger::addValue(const char *str) {
+  addToBuffer(str, strlen(str));
+}
+
+void Console_Logger::addValue(const string& str) {
+  addToBuffer(str.c_str(), str.size());
+}
+
+void Console_Logger::addValue(char c) {
+  addToBuffer(&c, 1);
+}
+
+void Console_Logger::addValue(int value) {
+  char buf[12];
+  addToBuffer(buf, snprintf(buf, sizeof(buf), "%d", value));
+}
+
+void Console_Logger::addValue(unsigned int value) {
+  char buf[12];
+  addToBuffer(buf, snprintf(buf, sizeof(buf), "%u", value));
+}
+
+void Console_Logger::addValue(long value) {
+  char buf[22];
+  addToBuffer(buf, snprintf(buf, sizeof(buf), "%ld", value));
+}
+
+void Console_Logger::addValue(unsigned long value) {
+  char buf[22];
+  addToBuffer(buf, snprintf(buf, sizeof(buf), "%lu", value));
 }
 
 void Console_Logger::flushBuffer(){
-  if (xPortGetCoreID() == 0) {
-    if(core_0_buffer_.str().size() == 0) return;
-    printIndent();
-    printBeginning(core_0_log_type_);
-    if (core_0_has_name_) {
-      printName(core_0_name_);
-      core_0_has_name_ = false;
+  byte task_id = getTaskID();
+  auto &state = task_states_[task_id];
+  if (state.buffer_len == 0) return;
+
+  if (logging_active_ && levelIsEnabled(state.log_type)) {
+    if (drain_task_ != nullptr) {
+      if (enqueueRecord(state, task_id)) {
+        xTaskNotifyGive(drain_task_);
+      } else {
+        dropped_records_++;
+      }
+    } else {
+      LogRecord record;
+      fillRecord(record, state, task_id);
+      emitRecord(record);
+    }
+  }
+
+  state.buffer_len = 0;
+  state.has_name = false;
+  state.log_type = LOG_TYPE::INFO;
+  state.tokenized = false;
+}
+
+bool Console_Logger::enqueueRecord(const LogTaskState &state, byte task_id) {
+  // Bounded multi-producer queue: every cell carries the position it may be written at next.
+  // Producers claim a position by advancing enqueue_pos_, then publish the cell by bumping its sequence.
+  uint32_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  LogRecord *record;
+  while (true) {
+    record = &records_[pos % LOGGER_RING_SIZE];
+    uint32_t seq = record->sequence.load(std::memory_order_acquire);
+    auto diff = (int32_t) (seq - pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Ring is full
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
     }
-    printOut(core_0_buffer_.str());
-    printOut('\n');
-    callCallback(core_0_log_type_, core_0_buffer_.str(), core_0_name_, 0);
-    core_0_buffer_.str(string());
-    setLogType(LOG_TYPE::INFO);
+  }
+  fillRecord(*record, state, task_id);
+  record->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void Console_Logger::emitRecord(const LogRecord &record) {
+  if (record.tokenized) {
+    // Record layout: log type, core and task, timestamp (varint), token and arguments
+    uint8_t header[12];
+    size_t header_len = 0;
+    header[header_len++] = (uint8_t) record.log_type;
+    header[header_len++] = (uint8_t) ((record.core << 4) | (record.task_id & 0x0F));
+    unsigned long timestamp = record.timestamp;
+    do {
+      header[header_len] = timestamp & 0x7F;
+      timestamp >>= 7;
+      if (timestamp != 0) {
+        header[header_len] |= 0x80;
+      }
+      header_len++;
+    } while (timestamp != 0);
+
+    uint8_t payload[sizeof(header) + LOGGER_MAX_MESSAGE_LEN];
+    memcpy(payload, header, header_len);
+    memcpy(&payload[header_len], record.message, record.message_len);
+
+    std::string line = LOG_TOKEN_PREFIX;
+    line.reserve(sizeof(LOG_TOKEN_PREFIX) + ((header_len + record.message_len + 2) / 3) * 4 + 1);
+    appendBase64(line, payload, header_len + record.message_len);
+    callCallback(record.log_type, line, string(record.name), record.task_id);
+    line += '\n';
+    printOut(line);
+    return;
+  }
+
+  std::string line;
+  line.reserve(record.message_len + LOGGER_MAX_NAME_LEN + (record.indent * indent_len_) + 12);
+
+  if (record.core == 0) {
+    line += "0 | ";
+  } else if (record.core == 1) {
+    line += "1 | ";
   } else {
-    if(core_1_buffer_.str().size() == 0) return;
-    printIndent();
-    printBeginning(core_1_log_type_);
-    if (core_1_has_name_) {
-      printName(core_1_name_);
-      core_1_has_name_ = false;
+    line += "? | ";
+  }
+  line.append(record.indent * indent_len_, indent_char_);
+  line += getLogTypePrefix(record.log_type);
+  if (record.name[0] != 0) {
+    line += '[';
+    line += record.name;
+    line += "] ";
+  }
+  line.append(record.message, record.message_len);
+  line += '\n';
+  printOut(line);
+
+  callCallback(record.log_type, string(record.message, record.message_len), string(record.name), record.task_id);
+}
+
+void Console_Logger::drainRecords() {
+  while (true) {
+    auto &record = records_[dequeue_pos_ % LOGGER_RING_SIZE];
+    if (record.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+      return;
+    }
+    emitRecord(record);
+    record.sequence.store(dequeue_pos_ + LOGGER_RING_SIZE, std::memory_order_release);
+    dequeue_pos_++;
+  }
+}
+
+[[noreturn]] void Console_Logger::drainTask(void *args) {
+  auto drained_logger = (Console_Logger *) args;
+  HeapTracer::setTaskTag(HeapTag::Logger);
+  unsigned long reported_drops = 0;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, LOGGER_DRAIN_INTERVAL_MS / portTICK_PERIOD_MS);
+    drained_logger->drainRecords();
+
+    auto drops = drained_logger->getDroppedRecords();
+    if (drops != reported_drops) {
+      std::stringstream sstr;
+      sstr << "[logger] dropped " << drops << " records\n";
+      printOut(sstr.str());
+      reported_drops = drops;
     }
-    printOut(core_1_buffer_.str());
-    printOut('\n');
-    callCallback(core_1_log_type_, core_1_buffer_.str(), core_1_name_, 1);
-    core_1_buffer_.str(string());
-    setLogType(LOG_TYPE::INFO);
   }
 }
 
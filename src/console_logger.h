@@ -6,6 +6,8 @@
 #include <sstream>
 #include <vector>
 #include <functional>
+#include <atomic>
+#include <type_traits>
 #include "user_settings.h"
 #include <cstdio>
 #include "Arduino.h"
@@ -13,58 +15,210 @@
 
 #define INDENT_LEN 3
 
+// Severity levels used for LOGGER_MIN_LEVEL
+#define LOG_LEVEL_DATA 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERR 3
+#define LOG_LEVEL_FATAL 4
+
+// Logging macros that only evaluate their arguments if the level is compiled in.
+// For disabled levels the whole call is removed by the compiler.
+#define LOG_PRINT(type, ...) do { if (Console_Logger::levelIsEnabled(type)) { logger.print(type, __VA_ARGS__); } } while (0)
+#define LOG_PRINTLN(type, ...) do { if (Console_Logger::levelIsEnabled(type)) { logger.println(type, __VA_ARGS__); } } while (0)
+#define LOG_PRINTF(type, ...) do { if (Console_Logger::levelIsEnabled(type)) { logger.printf(type, __VA_ARGS__); } } while (0)
+#define LOG_PRINTFLN(type, ...) do { if (Console_Logger::levelIsEnabled(type)) { logger.printfln(type, __VA_ARGS__); } } while (0)
+
+// Logs a line whose format string is replaced by its token at compile time if LOGGER_TOKENIZED is set.
+// The format has to be a string literal, generate_log_tokens.py collects them into the table used by decode_log.py.
+#if LOGGER_TOKENIZED
+#define LOG_TOKEN(type, format, ...) do { if (Console_Logger::levelIsEnabled(type)) { logger.printToken(type, std::integral_constant<uint32_t, getLogToken(format)>::value, ##__VA_ARGS__); } } while (0)
+#else
+#define LOG_TOKEN(type, format, ...) LOG_PRINTFLN(type, format, ##__VA_ARGS__)
+#endif
+
+// Marks a tokenized line in the serial output, followed by the base64 encoded record
+#define LOG_TOKEN_PREFIX "$T"
+
+// Strings longer than this are cut off when they are passed as argument of a tokenized line
+#define LOG_TOKEN_MAX_STR_LEN 64
+
 using namespace std;
 
 enum class LOG_TYPE {
   INFO, ERR, DATA, NONE, FATAL, WARN
 };
 
+/**
+ * Calculates the token of a format string (32 bit FNV-1a). Has to match the hash used by generate_log_tokens.py.
+ * @param str The format string
+ * @param hash The hash of the chars before str
+ * @return The token
+ */
+constexpr uint32_t getLogToken(const char *str, uint32_t hash = 2166136261u) {
+  return *str == 0 ? hash : getLogToken(str + 1, (hash ^ (uint8_t) *str) * 16777619u);
+}
+
 class Console_Logger {
 protected:
 
-//  char core_0_buffer_[LOGGER_MAX_BUFFER_LEN]{};
-//  char core_0_name_[LOGGER_MAX_NAME]{};
-//  unsigned int core_0_buffer_ptr_{};
-//  LOG_TYPE core_0_log_type_;
-//  byte core_0_indent_{};
-
-  string core_0_name_;
-  bool core_0_has_name_;
-  stringstream core_0_buffer_;
-  LOG_TYPE core_0_log_type_;
-  byte core_0_indent_{};
-  bool callback_status_[8]{false};
-
-//  char core_1_buffer_[LOGGER_MAX_BUFFER_LEN]{};
-//  char core_1_name_[LOGGER_MAX_NAME]{};
-//  unsigned int core_1_buffer_ptr_{};
-//  LOG_TYPE core_1_log_type_;
-//  byte core_1_indent_{};
-
-  string core_1_name_;
-  bool core_1_has_name_;
-  stringstream core_1_buffer_;
-  LOG_TYPE core_1_log_type_;
-  byte core_1_indent_{};
+  /**
+   * The line a single task is currently assembling
+   */
+  struct LogTaskState {
+    char buffer[LOGGER_MAX_MESSAGE_LEN];
+    uint16_t buffer_len;
+    char name[LOGGER_MAX_NAME_LEN];
+    bool has_name;
+    LOG_TYPE log_type;
+    byte indent;
+    // Whether buffer contains a token and encoded arguments instead of text
+    bool tokenized;
+  };
+
+  /**
+   * A complete log line waiting in the ring to be printed by the drain task
+   */
+  struct LogRecord {
+    // Position in the ring this record is valid for (see enqueueRecord())
+    std::atomic<uint32_t> sequence;
+    LOG_TYPE log_type;
+    byte core;
+    byte task_id;
+    byte indent;
+    bool tokenized;
+    unsigned long timestamp;
+    char name[LOGGER_MAX_NAME_LEN];
+    char message[LOGGER_MAX_MESSAGE_LEN];
+    uint16_t message_len;
+  };
+
+  // Tasks owning the line states, nullptr marks a free slot
+  std::atomic<TaskHandle_t> task_handles_[LOGGER_MAX_TASKS];
+
+  // Line states for every task that has logged something. Last one is shared by tasks not fitting in.
+  LogTaskState task_states_[LOGGER_MAX_TASKS + 1];
+
+  // Ring buffer containing the finished lines
+  LogRecord records_[LOGGER_RING_SIZE];
+
+  // Next position to write to, shared by all producers
+  std::atomic<uint32_t> enqueue_pos_;
+
+  // Next position to read from, only used by the drain task
+  uint32_t dequeue_pos_;
+
+  // Count of records dropped because the ring was full
+  std::atomic<unsigned long> dropped_records_;
+
+  // Task printing the records, nullptr if records are printed directly
+  TaskHandle_t drain_task_;
 
+  bool callback_status_[8]{false};
 
   char indent_char_;
   byte indent_len_{};
   bool logging_active_;
   std::function<void(LOG_TYPE ,string ,string ,int )> callback_;
 
+  static void printOut(const string&);
+
+  static void printOut(char );
+
+  /**
+   * Gets the line state of the calling task
+   * @return The line state
+   */
+  LogTaskState &getTaskState();
+
+  /**
+   * Gets the id of the calling task (index of its line state)
+   * @return The task id
+   */
+  byte getTaskID();
+
+  void addToBuffer(const char *, size_t);
+
+  void addToBuffer(const string&);
+
+  /**
+   * Adds bytes to the buffer of the calling task without any filtering
+   * @param data The bytes to add
+   * @param len Count of bytes
+   */
+  void addRawToBuffer(const uint8_t *data, size_t len);
+
+  /**
+   * Adds an unsigned integer as LEB128 varint
+   * @param value The value to add
+   */
+  void addVarintToBuffer(uint64_t value);
 
-  static void printOut(string);
+  /**
+   * Starts a tokenized line for the calling task
+   * @param type Log type of the line
+   * @param token Token of the format string
+   */
+  void beginToken(LOG_TYPE type, uint32_t token);
 
-  void printOut(char );
+  template<class T>
+  typename std::enable_if<std::is_integral<T>::value>::type encodeTokenArg(T value) {
+    // Zigzag encoding keeps small negative numbers small
+    auto signed_value = (int64_t) value;
+    addVarintToBuffer(((uint64_t) signed_value << 1) ^ (uint64_t) (signed_value >> 63));
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type encodeTokenArg(T value) {
+    auto float_value = (float) value;
+    addRawToBuffer((const uint8_t *) &float_value, sizeof(float_value));
+  }
+
+  template<class T>
+  typename std::enable_if<std::is_enum<T>::value>::type encodeTokenArg(T value) {
+    encodeTokenArg((typename std::underlying_type<T>::type) value);
+  }
+
+  // Pointers (%p) are sent as their address
+  template<class T>
+  void encodeTokenArg(const T *pointer) {
+    encodeTokenArg((uintptr_t) pointer);
+  }
 
-  void printIndent();
+  void encodeTokenArg(const char *str);
+
+  void encodeTokenArg(const string &str);
+
+  void encodeTokenArgs() {}
+
+  template<class T, class ... Args>
+  void encodeTokenArgs(T first, Args... rest) {
+    encodeTokenArg(first);
+    encodeTokenArgs(rest...);
+  }
+
+  /**
+   * Checks whether the line the calling task is currently assembling will be printed
+   * @return Whether the level of the line is enabled
+   */
+  bool lineIsEnabled();
+
+  template<class T>
+  void addValue(T);
 
-  void printName(string);
+  void addValue(const char *);
 
-  void printBeginning(LOG_TYPE, bool);
+  void addValue(const string&);
 
-  void addToBuffer(string);
+  void addValue(char);
+
+  void addValue(int);
+
+  void addValue(unsigned int);
+
+  void addValue(long);
+
+  void addValue(unsigned long);
 
   void flushBuffer();
 
@@ -74,10 +228,75 @@ protected:
 
   void callCallback(LOG_TYPE ,string ,string ,int );
 
+  /**
+   * Stores a finished record in the ring. Does not block, drops the record if the ring is full.
+   * @param state The line state to create the record from
+   * @param task_id Id of the task the line belongs to
+   * @return Whether there was space for the record
+   */
+  bool enqueueRecord(const LogTaskState &state, byte task_id);
+
+  /**
+   * Copies a finished line into a record
+   * @param record The record to fill
+   * @param state The line to copy
+   * @param task_id Id of the task the line belongs to
+   */
+  static void fillRecord(LogRecord &record, const LogTaskState &state, byte task_id);
+
+  /**
+   * Formats and prints a record, then passes it to the callback
+   * @param record The record to print
+   */
+  void emitRecord(const LogRecord &record);
+
+  /**
+   * Prints all records currently stored in the ring
+   */
+  void drainRecords();
+
+  /**
+   * Function for the drain task
+   * @param args Pointer to the logger to drain
+   */
+  [[noreturn]] static void drainTask(void *args);
 
 public:
   Console_Logger();
 
+  /**
+   * Maps a log type to its severity level (LOG_LEVEL_*)
+   * @param type The log type
+   * @return The severity level
+   */
+  static constexpr int getSeverity(LOG_TYPE type) {
+    return type == LOG_TYPE::DATA ? LOG_LEVEL_DATA :
+           type == LOG_TYPE::WARN ? LOG_LEVEL_WARN :
+           type == LOG_TYPE::ERR ? LOG_LEVEL_ERR :
+           type == LOG_TYPE::FATAL ? LOG_LEVEL_FATAL :
+           LOG_LEVEL_INFO;
+  }
+
+  /**
+   * Checks whether a log type is compiled in (LOGGER_MIN_LEVEL)
+   * @param type The log type
+   * @return Whether lines of that type are printed
+   */
+  static constexpr bool levelIsEnabled(LOG_TYPE type) {
+    return getSeverity(type) >= LOGGER_MIN_LEVEL;
+  }
+
+  /**
+   * Starts the drain task. Until then every line is printed directly by the task that logged it.
+   * @return Whether the task could be started
+   */
+  bool begin();
+
+  /**
+   * @return The count of records dropped since launch because the ring was full
+   */
+  unsigned long getDroppedRecords() const;
+
   void setCallback(std::function<void(LOG_TYPE ,string ,string ,int )>);
 
   void setCallbackStatus(LOG_TYPE, bool );
@@ -108,8 +327,8 @@ public:
   template<class T, class ... Args>
   void printf(T, ...);
 
-  template<class T, class ... Args>
-  void printf(LOG_TYPE, T, ...);
+  template<class ... Args>
+  void printf(LOG_TYPE, const char *, Args...);
 
   void printnl();
 
@@ -128,19 +347,46 @@ public:
   template<class T, class ... Args>
   void printfln(T, ...);
 
-  template<class T, class ...Args>
-  void printfln(LOG_TYPE, T, ...);
+  template<class ... Args>
+  void printfln(LOG_TYPE, const char *, Args...);
+
+  /**
+   * Logs a tokenized line. Use LOG_TOKEN() instead of calling this directly.
+   * @param type Log type of the line
+   * @param token Token of the format string
+   * @param args Arguments for the format string
+   */
+  template<class ... Args>
+  void printToken(LOG_TYPE type, uint32_t token, Args... args) {
+    beginToken(type, token);
+    encodeTokenArgs(args...);
+    flushBuffer();
+  }
 };
 
 template<class T>
-void Console_Logger::print(T message){
+void Console_Logger::addValue(T value){
   stringstream ss;
-  ss << message;
+  ss << value;
   addToBuffer(ss.str());
 }
 
+template<class T>
+void Console_Logger::print(T message){
+  if (!lineIsEnabled()) {
+    return;
+  }
+  addValue(message);
+}
+
+// The typed calls return before touching the line state if their level is not compiled in, so the compiler can
+// drop them completely. A line has to be finished by a call of the same type it was started with.
+
 template<class T>
 void Console_Logger::print(LOG_TYPE type , T message){
+  if (!levelIsEnabled(type)) {
+    return;
+  }
   setLogType(type);
   print(message);
 }
@@ -153,6 +399,9 @@ void Console_Logger::print(const string& name, T message){
 
 template<class T>
 void Console_Logger::print(LOG_TYPE type, const string& name, T message){
+  if (!levelIsEnabled(type)) {
+    return;
+  }
   setLogType(type);
   setName(name);
   print(message);
@@ -160,14 +409,27 @@ void Console_Logger::print(LOG_TYPE type, const string& name, T message){
 
 template<class T, class ... Args>
 void Console_Logger::vprintf(T message, va_list ap){
-  va_list args;
-  stringstream msg;
-  char format_string[500];
-  va_copy(args, ap);
-  vsprintf(&format_string[0], message, ap);
-  va_end(ap);
-  msg << format_string;
-  addToBuffer(msg.str());
+  auto &state = getTaskState();
+  if (!levelIsEnabled(state.log_type)) {
+    return;
+  }
+  size_t space = LOGGER_MAX_MESSAGE_LEN - 1 - state.buffer_len;
+  if (space == 0) {
+    return;
+  }
+  int len = vsnprintf(&state.buffer[state.buffer_len], space + 1, message, ap);
+  if (len < 0) {
+    return;
+  }
+  size_t written = (size_t) len < space ? (size_t) len : space;
+
+  // Newlines are not allowed inside of a line
+  for (size_t i = state.buffer_len; i < state.buffer_len + written; i++) {
+    if (state.buffer[i] == '\n') {
+      state.buffer[i] = ' ';
+    }
+  }
+  state.buffer_len += written;
 }
 
 template<class T, class ... Args>
@@ -178,25 +440,26 @@ void Console_Logger::printf(T message, ...){
   va_end(ap);
 }
 
-template<class T, class ... Args>
-void Console_Logger::printf(LOG_TYPE type , T message, ...){
+template<class ... Args>
+void Console_Logger::printf(LOG_TYPE type, const char *message, Args... args){
+  if (!levelIsEnabled(type)) {
+    return;
+  }
   setLogType(type);
-  va_list ap;
-  va_start(ap, message);
-  vprintf(message, ap);
-  va_end(ap);
+  printf(message, args...);
 }
 
 template<class T>
 void Console_Logger::println(T message) {
-  stringstream ss;
-  ss << message;
-  addToBuffer(ss.str());
+  print(message);
   flushBuffer();
 }
 
 template<class T>
 void Console_Logger::println(LOG_TYPE type, T message){
+  if (!levelIsEnabled(type)) {
+    return;
+  }
   setLogType(type);
   println(message);
 }
@@ -210,6 +473,9 @@ void Console_Logger::println(const string& name, T message){
 
 template<class T>
 void Console_Logger::println(LOG_TYPE type, const string& name, T message){
+  if (!levelIsEnabled(type)) {
+    return;
+  }
   setLogType(type);
   setName(name);
   println(message);
@@ -224,14 +490,13 @@ void Console_Logger::printfln(T message, ...){
   flushBuffer();
 }
 
-template<class T, class ... Args>
-void Console_Logger::printfln(LOG_TYPE type, T message, ...){
+template<class ... Args>
+void Console_Logger::printfln(LOG_TYPE type, const char *message, Args... args){
+  if (!levelIsEnabled(type)) {
+    return;
+  }
   setLogType(type);
-  va_list ap;
-  va_start(ap, message);
-  vprintf(message, ap);
-  va_end(ap);
-  flushBuffer();
+  printfln(message, args...);
 }
 
 extern Console_Logger logger;
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "system_settings.h"
+#include <vector>
 
 using bitfield_set = std::array<bool, 8>;
 using pin_set = std::array<uint8_t, GADGET_PIN_BLOCK_LEN>;
-// Tuple to store a gadget config: type, bitfield, pins, name, gadget_config, code_config
+// Tuple to store a gadget config: type, bitfield, pins, name, gadget_config, code_config (MessagePack when read from storage)
 using gadget_tuple = std::tuple<uint8_t, bitfield_set, pin_set, std::string, std::string, std::string>;
+// Code mapping of a gadget: method, code
+using code_mapping = std::vector<std::pair<uint8_t, unsigned long>>;
+// Tuple to store a gadget resolved during boot: type, bitfield, pins (not ports), name, gadget_config (MessagePack), code mapping
+using boot_gadget_tuple = std::tuple<uint8_t, bitfield_set, pin_set, std::string, std::string, code_mapping>;
 using status_tuple = std::tuple<bool, std::string>;
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "flash_region.h"
+#include "console_logger.h"
+
+PartitionFlashRegion::PartitionFlashRegion(const char *label) :
+    label_(label),
+    partition_(nullptr),
+    mapping_(nullptr),
+    mmap_handle_(0) {}
+
+bool PartitionFlashRegion::begin() {
+  partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        (esp_partition_subtype_t) RECORD_LOG_PARTITION_SUBTYPE,
+                                        label_);
+  if (partition_ == nullptr) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Partition '%s' not found", label_);
+    return false;
+  }
+  // The flash driver flushes the cache of mapped ranges it writes or erases, so the mapping never gets stale
+  const void *mapping = nullptr;
+  if (mapping_ == nullptr &&
+      esp_partition_mmap(partition_, 0, getSize(), ESP_PARTITION_MMAP_DATA, &mapping, &mmap_handle_) == ESP_OK) {
+    mapping_ = (const uint8_t *) mapping;
+  } else if (mapping_ == nullptr) {
+    LOG_TOKEN(LOG_TYPE::WARN, "Could not map partition '%s', reading it by copy", label_);
+  }
+  return true;
+}
+
+size_t PartitionFlashRegion::getSize() const {
+  if (partition_ == nullptr) {
+    return 0;
+  }
+  return partition_->size - (partition_->size % FLASH_SECTOR_SIZE);
+}
+
+bool PartitionFlashRegion::read(size_t offset, void *data, size_t len) {
+  return partition_ != nullptr && esp_partition_read(partition_, offset, data, len) == ESP_OK;
+}
+
+bool PartitionFlashRegion::write(size_t offset, const void *data, size_t len) {
+  return partition_ != nullptr && esp_partition_write(partition_, offset, data, len) == ESP_OK;
+}
+
+bool PartitionFlashRegion::eraseSector(size_t sector) {
+  return partition_ != nullptr &&
+         esp_partition_erase_range(partition_, sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE) == ESP_OK;
+}
+
+const uint8_t *PartitionFlashRegion::getMapping() const {
+  return mapping_;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Arduino.h"
+#include <cstddef>
+#include <cstdint>
+#include "esp_partition.h"
+#include "system_settings.h"
+
+/**
+ * A region of NOR flash made of FLASH_SECTOR_SIZE sectors.
+ * Erased bytes read as 0xFF, writing can only clear bits, so a byte can only be written again after erasing its
+ * whole sector.
+ */
+class FlashRegion {
+public:
+  virtual ~FlashRegion() = default;
+
+  /**
+   * Prepares the region for use
+   * @return Whether the region is available
+   */
+  virtual bool begin() = 0;
+
+  /**
+   * @return Size of the region in bytes, a multiple of FLASH_SECTOR_SIZE
+   */
+  virtual size_t getSize() const = 0;
+
+  /**
+   * Reads bytes from the region
+   * @param offset Offset to read from
+   * @param data Buffer to read to
+   * @param len Number of bytes to read
+   * @return Whether reading was successful
+   */
+  virtual bool read(size_t offset, void *data, size_t len) = 0;
+
+  /**
+   * Writes bytes to the erased part of the region
+   * @param offset Offset to write to
+   * @param data Bytes to write
+   * @param len Number of bytes to write
+   * @return Whether writing was successful
+   */
+  virtual bool write(size_t offset, const void *data, size_t len) = 0;
+
+  /**
+   * Erases a sector, setting all of its bytes to 0xFF
+   * @param sector Index of the sector
+   * @return Whether erasing was successful
+   */
+  virtual bool eraseSector(size_t sector) = 0;
+
+  /**
+   * Maps the region into the address space, so it can be read without copying it
+   * @return Read-only view of the whole region reflecting all writes and erases, nullptr if it cannot be mapped
+   */
+  virtual const uint8_t *getMapping() const {
+    return nullptr;
+  }
+};
+
+/**
+ * Flash region backed by a data partition of the partition table
+ */
+class PartitionFlashRegion : public FlashRegion {
+private:
+  // Label of the partition in the partition table
+  const char *label_;
+
+  const esp_partition_t *partition_;
+
+  // Partition mapped to the data cache, nullptr if mapping failed
+  const uint8_t *mapping_;
+
+  spi_flash_mmap_handle_t mmap_handle_;
+
+public:
+  /**
+   * @param label Label of the partition in the partition table
+   */
+  explicit PartitionFlashRegion(const char *label);
+
+  bool begin() override;
+
+  size_t getSize() const override;
+
+  bool read(size_t offset, void *data, size_t len) override;
+
+  bool write(size_t offset, const void *data, size_t len) override;
+
+  bool eraseSector(size_t sector) override;
+
+  const uint8_t *getMapping() const override;
+};
@@ -0,0 +1,224 @@
+#include "gadget_executor.h"
+#include "console_logger.h"
+#include "task_profiler.h"
+#include "heap_tracer.h"
+
+#include <algorithm>
+
+GadgetExecutor::GadgetExecutor() {
+  for (uint8_t i = 0; i < GADGET_EXECUTOR_SHARDS; i++) {
+    auto &shard = shards_[i];
+    shard.executor = this;
+    shard.index = i;
+    snprintf(shard.name, sizeof(shard.name), "Gadget_Worker%d", i);
+    shard.load = 0;
+    shard.task = nullptr;
+    shard.stolen_jobs = 0;
+    shard.dropped_jobs = 0;
+  }
+}
+
+void GadgetExecutor::addGadget(const std::shared_ptr<SH_Gadget> &gadget) {
+  if (gadget == nullptr) {
+    return;
+  }
+  unsigned long load = gadget->getRefreshCost() * 1000 / std::max(gadget->getRefreshInterval(), 1UL);
+
+  uint8_t target = GADGET_EXECUTOR_SHARED_IO_SHARD;
+  if (!gadget->hasIR() && !gadget->hasRadio()) {
+    target = 0;
+    for (uint8_t i = 1; i < GADGET_EXECUTOR_SHARDS; i++) {
+      if (shards_[i].load < shards_[target].load) {
+        target = i;
+      }
+    }
+  }
+
+  auto &shard = shards_[target];
+  shard.gadgets.push_back(gadget);
+  shard.scheduler.addGadget(gadget);
+  shard.load += load;
+}
+
+bool GadgetExecutor::begin() {
+  bool all_started = true;
+  for (uint8_t i = 0; i < GADGET_EXECUTOR_SHARDS; i++) {
+    auto &shard = shards_[i];
+    BaseType_t status = xTaskCreatePinnedToCore(
+        workerTask,
+        shard.name,
+        GADGET_WORKER_STACK,
+        &shard,
+        GADGET_WORKER_PRIORITY,
+        &shard.task,
+        i % 2);
+    if (status != pdPASS) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Could not start gadget worker %d", i);
+      shard.task = nullptr;
+      all_started = false;
+      continue;
+    }
+    for (auto &gadget: shard.gadgets) {
+      gadget->setOwnerTask(shard.task);
+    }
+    task_profiler.registerTask(shard.task);
+  }
+  return all_started;
+}
+
+void GadgetExecutor::workerTask(void *args) {
+  auto shard = (Shard *) args;
+  shard->executor->runWorker(shard->index);
+}
+
+void GadgetExecutor::runWorker(uint8_t index) {
+  auto &shard = shards_[index];
+  int profiled_loop = task_profiler.registerLoop(shard.name);
+  HeapTracer::setTaskTag(HeapTag::Gadgets);
+  while (true) {
+    int64_t loop_start = esp_timer_get_time();
+    shard.scheduler.refresh();
+    runJobs(index);
+    task_profiler.recordLoop(profiled_loop, (uint32_t) (esp_timer_get_time() - loop_start));
+
+    unsigned long wait_time = std::min((unsigned long) GADGET_WORKER_MAX_WAIT_MS,
+                                       shard.scheduler.getTimeUntilNextRefresh());
+    ulTaskNotifyTake(pdTRUE, wait_time / portTICK_PERIOD_MS);
+  }
+}
+
+int GadgetExecutor::getCurrentShard() const {
+  TaskHandle_t current = xTaskGetCurrentTaskHandle();
+  for (uint8_t i = 0; i < GADGET_EXECUTOR_SHARDS; i++) {
+    if (shards_[i].task == current) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool GadgetExecutor::takeJob(Shard &shard, bool blocking, Job &job) {
+  std::unique_lock<std::mutex> lock(shard.jobs_mutex, std::defer_lock);
+  if (blocking) {
+    lock.lock();
+  } else if (!lock.try_lock()) {
+    return false;
+  }
+  // Skipping all jobs of a running gadget keeps the jobs of every gadget in order
+  for (auto it = shard.jobs.begin(); it != shard.jobs.end(); it++) {
+    if (std::find(shard.running_keys.begin(), shard.running_keys.end(), it->key) == shard.running_keys.end()) {
+      job = std::move(*it);
+      shard.jobs.erase(it);
+      shard.running_keys.push_back(job.key);
+      return true;
+    }
+  }
+  return false;
+}
+
+void GadgetExecutor::runJob(Shard &shard, Job &job) {
+  job.run();
+  bool jobs_left;
+  {
+    std::lock_guard<std::mutex> guard(shard.jobs_mutex);
+    auto it = std::find(shard.running_keys.begin(), shard.running_keys.end(), job.key);
+    if (it != shard.running_keys.end()) {
+      shard.running_keys.erase(it);
+    }
+    jobs_left = !shard.jobs.empty();
+  }
+  // Jobs of the same gadget may have been skipped by the owner while this one was running
+  if (jobs_left && shard.task != nullptr && shard.task != xTaskGetCurrentTaskHandle()) {
+    xTaskNotifyGive(shard.task);
+  }
+}
+
+void GadgetExecutor::runJobs(uint8_t index) {
+  auto &own_shard = shards_[index];
+  int64_t start = esp_timer_get_time();
+  bool has_run = false;
+  Job job;
+  while (!has_run || esp_timer_get_time() - start < GADGET_EXECUTOR_JOB_BUDGET_US) {
+    Shard *source = nullptr;
+    if (takeJob(own_shard, true, job)) {
+      source = &own_shard;
+    } else {
+      for (uint8_t i = 1; i < GADGET_EXECUTOR_SHARDS && source == nullptr; i++) {
+        auto &victim = shards_[(index + i) % GADGET_EXECUTOR_SHARDS];
+        if (takeJob(victim, false, job)) {
+          victim.stolen_jobs++;
+          source = &victim;
+        }
+      }
+    }
+    if (source == nullptr) {
+      return;
+    }
+    runJob(*source, job);
+    has_run = true;
+  }
+
+  // Budget used up, continue right after the next refresh
+  bool jobs_left;
+  {
+    std::lock_guard<std::mutex> guard(own_shard.jobs_mutex);
+    jobs_left = !own_shard.jobs.empty();
+  }
+  if (jobs_left) {
+    xTaskNotifyGive(own_shard.task);
+  }
+}
+
+bool GadgetExecutor::submit(const std::string &key, std::function<void()> job) {
+  int index = getCurrentShard();
+  if (index < 0) {
+    job();
+    return true;
+  }
+  auto &shard = shards_[index];
+  size_t queued = 0;
+  {
+    std::lock_guard<std::mutex> guard(shard.jobs_mutex);
+    if (shard.jobs.size() < GADGET_EXECUTOR_MAX_JOBS) {
+      shard.jobs.push_back({key, std::move(job)});
+      queued = shard.jobs.size();
+    }
+  }
+  if (queued == 0) {
+    // The worker submitting the job is the one emptying the queue, so waiting for space would never end
+    shard.dropped_jobs++;
+    LOG_TOKEN(LOG_TYPE::ERR, "Job queue of %s full, dropped job of '%s'", shard.name, key.c_str());
+    return false;
+  }
+  // The owner runs the jobs after refreshing its gadgets, a backlog is left to the idle workers
+  if (queued >= GADGET_EXECUTOR_STEAL_THRESHOLD) {
+    for (uint8_t i = 0; i < GADGET_EXECUTOR_SHARDS; i++) {
+      if (i != index && shards_[i].task != nullptr) {
+        xTaskNotifyGive(shards_[i].task);
+      }
+    }
+  }
+  return true;
+}
+
+void GadgetExecutor::printReport() {
+  LOG_TOKEN(LOG_TYPE::INFO, "Gadget Executor:");
+  logger.incIndent();
+  for (auto &shard: shards_) {
+    size_t queued;
+    {
+      std::lock_guard<std::mutex> guard(shard.jobs_mutex);
+      queued = shard.jobs.size();
+    }
+    logger.printfln("%s: %u gadgets, load: %lu us/s, jobs queued: %u, stolen: %u, dropped: %u",
+                    shard.name,
+                    (unsigned) shard.gadgets.size(),
+                    shard.load,
+                    (unsigned) queued,
+                    (unsigned) shard.stolen_jobs.load(),
+                    (unsigned) shard.dropped_jobs.load());
+  }
+  logger.decIndent();
+}
+
+GadgetExecutor gadget_executor;
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Arduino.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "refresh_scheduler.h"
+#include "gadgets/sh_gadget.h"
+#include "system_settings.h"
+
+/**
+ * Refreshes the gadgets on GADGET_EXECUTOR_SHARDS worker tasks, one per core.
+ * Every gadget is owned by a single shard, so its hardware is only touched by one task. Gadgets sharing the IR or
+ * radio connector are all owned by the same shard, the others are balanced by their declared load.
+ * Work not touching hardware (like serializing updates for the bridge) is queued as a job on the shard of the
+ * submitting gadget. Idle workers steal jobs from the other shards, while jobs of the same gadget never run
+ * concurrently and keep their order.
+ */
+class GadgetExecutor {
+private:
+
+  /**
+   * Work not touching hardware, belonging to a gadget
+   */
+  struct Job {
+    // Name of the gadget, jobs of the same gadget are run in order
+    std::string key;
+    std::function<void()> run;
+  };
+
+  /**
+   * Gadgets refreshed by one worker and its queued jobs
+   */
+  struct Shard {
+    GadgetExecutor *executor;
+    uint8_t index;
+    // Name of the worker task and its profiled loop
+    char name[16];
+
+    RefreshScheduler scheduler;
+    std::vector<std::shared_ptr<SH_Gadget>> gadgets;
+
+    // Sum of the declared cost per interval of the gadgets in us per s
+    unsigned long load;
+
+    TaskHandle_t task;
+
+    // Guards jobs and running_keys
+    std::mutex jobs_mutex;
+    std::deque<Job> jobs;
+    // Keys of the jobs of this shard currently run by any worker
+    std::vector<std::string> running_keys;
+
+    // Jobs of this shard run by the other workers
+    std::atomic<uint32_t> stolen_jobs;
+
+    // Jobs dropped because the queue was full
+    std::atomic<uint32_t> dropped_jobs;
+  };
+
+  Shard shards_[GADGET_EXECUTOR_SHARDS];
+
+  /**
+   * Function for the worker tasks
+   * @param args Pointer to the shard of the worker
+   */
+  [[noreturn]] static void workerTask(void *args);
+
+  /**
+   * Refreshes the gadgets of a shard and runs jobs forever
+   * @param index Index of the shard
+   */
+  [[noreturn]] void runWorker(uint8_t index);
+
+  /**
+   * @return Index of the shard running on the current task or -1 if it is no worker
+   */
+  int getCurrentShard() const;
+
+  /**
+   * Takes the oldest job of a shard whose gadget has no job running and marks it as running
+   * @param shard Shard to take the job from
+   * @param blocking Whether to wait for the lock of the shard, stealing workers do not
+   * @param job [out] The job
+   * @return Whether there was a job
+   */
+  bool takeJob(Shard &shard, bool blocking, Job &job);
+
+  /**
+   * Runs a taken job and marks it as done
+   * @param shard Shard the job was taken from
+   * @param job The job
+   */
+  void runJob(Shard &shard, Job &job);
+
+  /**
+   * Runs the jobs of a shard, then steals from the others until the job budget is used
+   * @param index Index of the shard
+   */
+  void runJobs(uint8_t index);
+
+public:
+  GadgetExecutor();
+
+  /**
+   * Assigns a gadget to a shard, has to be called before begin()
+   * @param gadget The gadget
+   */
+  void addGadget(const std::shared_ptr<SH_Gadget> &gadget);
+
+  /**
+   * Starts one worker per shard and hands the gadgets over to them
+   * @return Whether all workers could be started
+   */
+  bool begin();
+
+  /**
+   * Queues a job for the shard of the current worker. Runs the job right away if not called from a worker.
+   * Drops the job if the queue of the shard is full, running it out of order would break the order of its gadget.
+   * @param key Name of the gadget the job belongs to
+   * @param job The job
+   * @return Whether the job was queued or run
+   */
+  bool submit(const std::string &key, std::function<void()> job);
+
+  /**
+   * Prints the gadgets and job statistics of every shard
+   */
+  void printReport();
+};
+
+extern GadgetExecutor gadget_executor;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstring>
+#include <string>
+#include "../system_settings.h"
+#include "gadget_enums.h"
+#include "../connectors/event.h"
+
+enum class GadgetCommandType {
+  CharacteristicUpdate, CodeUpdate, Event
+};
+
+/**
+ * A change to apply to a gadget. Posted to the command queue of the gadget and applied by the task owning it.
+ * Only holds plain data, so it can be copied into a FreeRTOS queue.
+ */
+struct GadgetCommand {
+  GadgetCommandType type;
+
+  // Whether the command came from the bridge, updates of its characteristic are not sent back
+  bool from_bridge;
+
+  // Characteristic update
+  CharacteristicIdentifier characteristic;
+  int value;
+
+  // Code update
+  unsigned long code;
+
+  // Event
+  EventType event_type;
+  char sender[GADGET_NAME_LEN_MAX + 1];
+
+  /**
+   * Creates a command updating a characteristic
+   * @param characteristic The characteristic to update
+   * @param value The new value
+   * @param from_bridge Whether the update came from the bridge
+   * @return The command
+   */
+  static GadgetCommand characteristicUpdate(CharacteristicIdentifier characteristic, int value, bool from_bridge) {
+    GadgetCommand command = {};
+    command.type = GadgetCommandType::CharacteristicUpdate;
+    command.from_bridge = from_bridge;
+    command.characteristic = characteristic;
+    command.value = value;
+    return command;
+  }
+
+  /**
+   * Creates a command applying the method mapped to a code
+   * @param code The received code
+   * @return The command
+   */
+  static GadgetCommand codeUpdate(unsigned long code) {
+    GadgetCommand command = {};
+    command.type = GadgetCommandType::CodeUpdate;
+    command.code = code;
+    return command;
+  }
+
+  /**
+   * Creates a command handling an event
+   * @param sender Name of the gadget that sent the event, cut to GADGET_NAME_LEN_MAX
+   * @param event_type The type of the event
+   * @return The command
+   */
+  static GadgetCommand event(const std::string &sender, EventType event_type) {
+    GadgetCommand command = {};
+    command.type = GadgetCommandType::Event;
+    command.event_type = event_type;
+    strncpy(command.sender, sender.c_str(), GADGET_NAME_LEN_MAX);
+    return command;
+  }
+};
@@ -10,18 +10,32 @@
  */
 SH_Doorbell_Basic::SH_Doorbell_Basic(std::string name, uint8_t pin, bool default_state) :
   SH_Doorbell(std::move(name)),
-  switch_pin_(pin),
-  default_state_(default_state),
-  last_event_(0) {
-  pinMode(switch_pin_, INPUT);
-};
+  input_(pin, HW_BOUNCE_DELAY),
+  default_state_(default_state) {};
 
 void SH_Doorbell_Basic::refresh() {
-  if (digitalRead(switch_pin_) != default_state_) {
-    unsigned long now = millis();
-    if (now > last_event_ + HW_BOUNCE_DELAY) {
+  GpioEdge edge;
+  while (input_.pollEdge(edge)) {
+    if (edge.level != default_state_) {
       doorbellTriggered();
     }
-    last_event_ = now;
   }
-}
\ No newline at end of file
+}
+
+unsigned long SH_Doorbell_Basic::getRefreshInterval() const {
+  // Check the level again as soon as the switch stopped bouncing
+  return input_.isSettling() ? HW_BOUNCE_DELAY : DOORBELL_REFRESH_INTERVAL;
+}
+
+unsigned long SH_Doorbell_Basic::getRefreshCost() const {
+  return DOORBELL_REFRESH_COST;
+}
+
+bool SH_Doorbell_Basic::hasPendingInput() {
+  return input_.hasPendingEdges();
+}
+
+void SH_Doorbell_Basic::setOwnerTask(TaskHandle_t task) {
+  SH_Gadget::setOwnerTask(task);
+  input_.setNotifyTask(task);
+}
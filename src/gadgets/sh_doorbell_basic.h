@@ -1,22 +1,32 @@
 #pragma once
 
 #include "sh_doorbell.h"
+#include "../gpio_input.h"
 #define HW_BOUNCE_DELAY 50
+// Edges are handled as pending input, the interval is only used when the switch is not bouncing
+#define DOORBELL_REFRESH_INTERVAL 1000
+#define DOORBELL_REFRESH_COST 50
 
 class SH_Doorbell_Basic : public SH_Doorbell {
 protected:
 
-  byte switch_pin_;
+  GpioInput input_;
 
   bool default_state_;
 
-  unsigned long last_event_;
-
 public:
 
   explicit SH_Doorbell_Basic(std::string name, uint8_t pin, bool default_state);
 
   void refresh() override;
+
+  unsigned long getRefreshInterval() const override;
+
+  unsigned long getRefreshCost() const override;
+
+  bool hasPendingInput() override;
+
+  void setOwnerTask(TaskHandle_t task) override;
 };
 
 static std::shared_ptr<SH_Doorbell_Basic> createSHDoorbellBasic(std::string name, pin_set pins, const JsonObject& gadget_data) {
@@ -26,7 +36,7 @@ static std::shared_ptr<SH_Doorbell_Basic> createSHDoorbellBasic(std::string name
   if (pins[0] != 0) {
     pin = pins[0];
   } else {
-    logger.println(LOG_TYPE::ERR, "No pin set");
+    LOG_TOKEN(LOG_TYPE::ERR, "No pin set");
     return nullptr;
   }
 
@@ -34,8 +44,8 @@ static std::shared_ptr<SH_Doorbell_Basic> createSHDoorbellBasic(std::string name
     default_state = gadget_data["default_state"].as<bool>();
   }
 
-  logger.printfln("Pin: %d", pin);
-  logger.printfln("Default State: %d", default_state);
+  LOG_TOKEN(LOG_TYPE::INFO, "Pin: %d", pin);
+  LOG_TOKEN(LOG_TYPE::INFO, "Default State: %d", default_state);
 
   return std::make_shared<SH_Doorbell_Basic>(name, pin, default_state);
 }
\ No newline at end of file
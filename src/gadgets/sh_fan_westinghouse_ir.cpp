@@ -1,26 +1,49 @@
 #include "sh_fan_westinghouse_ir.h"
 
+#include <algorithm>
 #include <utility>
 
 SH_Fan_Westinghouse_IR::SH_Fan_Westinghouse_IR(std::string name) :
   SH_Fan(std::move(name), 3) {};
 
+void SH_Fan_Westinghouse_IR::sendLevelCode(byte level) {
+  if (level == 0) {
+    sendRawIR(level_0, 95);
+  } else if (level == 1) {
+    sendRawIR(level_1, 119);
+  } else if (level == 2) {
+    // TODO: level_2 code needed
+    // sendRawIR(level_0, 95);
+  } else if (level == 3) {
+    sendRawIR(level_3, 95);
+  }
+}
+
 void SH_Fan_Westinghouse_IR::refresh() {
   if (gadgetHasChanged()) {
     byte level = getLevel();
     logger.print(getName(), "has changed: Level ");
     logger.println(level);
-    logger.incIndent();
-    if (level == 0) {
-      sendRawIR(level_0, 95);
-    } else if (level == 1) {
-      sendRawIR(level_1, 119);
-    } else if (level == 2) {
-      // TODO: level_2 code needed
-      // sendRawIR(level_0, 95);
-    } else if (level == 3) {
-      sendRawIR(level_3, 95);
+
+    // A new level replaces the repeats of the old one
+    send_sequence_.cancel();
+    for (int i = 0; i < FAN_WESTINGHOUSE_IR_SEND_COUNT; i++) {
+      if (i > 0) {
+        send_sequence_.delay(FAN_WESTINGHOUSE_IR_REPEAT_DELAY);
+      }
+      send_sequence_.then([this, level]() { sendLevelCode(level); });
     }
-    logger.decIndent();
+    send_sequence_.start(millis());
+    return;
   }
-}
\ No newline at end of file
+  send_sequence_.advance(millis());
+}
+
+unsigned long SH_Fan_Westinghouse_IR::getRefreshInterval() const {
+  return std::min((unsigned long) FAN_WESTINGHOUSE_IR_REFRESH_INTERVAL,
+                  std::max(send_sequence_.getTimeUntilNextStep(millis()), 1UL));
+}
+
+unsigned long SH_Fan_Westinghouse_IR::getRefreshCost() const {
+  return FAN_WESTINGHOUSE_IR_REFRESH_COST;
+}
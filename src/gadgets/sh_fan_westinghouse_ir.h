@@ -1,6 +1,14 @@
 #pragma once
 
 #include "sh_fan.h"
+#include "../step_sequence.h"
+
+// Changes are applied through refresh requests, sending a code blocks for up to 150 ms
+#define FAN_WESTINGHOUSE_IR_REFRESH_INTERVAL 1000
+#define FAN_WESTINGHOUSE_IR_REFRESH_COST 150000
+// Every code is sent this many times, FAN_WESTINGHOUSE_IR_REPEAT_DELAY ms apart
+#define FAN_WESTINGHOUSE_IR_SEND_COUNT 2
+#define FAN_WESTINGHOUSE_IR_REPEAT_DELAY 300
 
 // UNKNOWN 19496A87
 static const uint16_t level_0[95] = {1252, 432, 1250, 432, 420, 1260, 422, 1262, 420, 1258, 422, 1260, 420, 1258, 1254,
@@ -34,11 +42,24 @@ static const uint16_t level_3[95] = {1264, 418, 1210, 470, 398, 1284, 396, 1266,
 class SH_Fan_Westinghouse_IR : public SH_Fan {
 protected:
 
+  // Sends the code for the current level, advanced on every refresh
+  StepSequence send_sequence_;
+
+  /**
+   * Sends the code for a level once
+   * @param level The level
+   */
+  void sendLevelCode(byte level);
+
 public:
 
   explicit SH_Fan_Westinghouse_IR(std::string name);
 
   void refresh() override;
+
+  unsigned long getRefreshInterval() const override;
+
+  unsigned long getRefreshCost() const override;
 };
 
 static std::shared_ptr<SH_Fan_Westinghouse_IR> createSHFanWestinghouseIR(std::string name, pin_set pins, const JsonObject& gadget_data) {
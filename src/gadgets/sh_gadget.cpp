@@ -30,7 +30,7 @@ bool SH_Gadget::setMethodForCode(GadgetMethod method, unsigned long code) {
 }
 
 void SH_Gadget::printMapping() {
-  logger.printfln("Accessible Methods: %d", code_mapping.size());
+  LOG_TOKEN(LOG_TYPE::INFO, "Accessible Methods: %d", code_mapping.size());
   logger.incIndent();
   for (auto buf_mapping_pair: code_mapping) {
     auto method = std::get<0>(buf_mapping_pair);
@@ -46,7 +46,19 @@ void SH_Gadget::printMapping() {
 }
 
 void SH_Gadget::updateCharacteristic(CharacteristicIdentifier characteristic, int value) {
-  gadget_remote_callback(getName(), characteristic, value);
+  if (state_callback_) {
+    state_callback_(getName(), characteristic, value);
+  }
+  // Do not echo an update back to the bridge it came from
+  if (active_command_ != nullptr &&
+      active_command_->from_bridge &&
+      active_command_->type == GadgetCommandType::CharacteristicUpdate &&
+      active_command_->characteristic == characteristic) {
+    return;
+  }
+  if (gadget_remote_ready) {
+    gadget_remote_callback(getName(), characteristic, value);
+  }
 }
 
 
@@ -55,21 +67,29 @@ SH_Gadget::SH_Gadget::SH_Gadget(std::string  name, const GadgetType type) :
   gadget_remote_ready(false),
   name(std::move(name)),
   has_changed(true),
+  refresh_requested_(false),
   main_controller_(nullptr),
+  owner_task_(nullptr),
+  command_queue_(xQueueCreate(GADGET_COMMAND_QUEUE_LEN, sizeof(GadgetCommand))),
+  active_command_(nullptr),
   type(type) {}
 
 void SH_Gadget::setGadgetRemoteCallback(std::function<void(std::string, CharacteristicIdentifier, int)> update_method) {
   gadget_remote_callback = std::move(update_method);
-  logger.println("Initialized Gadget Remote Callback");
+  LOG_TOKEN(LOG_TYPE::INFO, "Initialized Gadget Remote Callback");
   gadget_remote_ready = true;
 }
 
 void SH_Gadget::setEventRemoteCallback(std::function<void(std::string, EventType)> send_event) {
   event_remote_callback = std::move(send_event);
-  logger.println("Initialized Event Callback");
+  LOG_TOKEN(LOG_TYPE::INFO, "Initialized Event Callback");
   event_remote_ready = true;
 }
 
+void SH_Gadget::setStateCallback(std::function<void(const std::string &, CharacteristicIdentifier, int)> state_callback) {
+  state_callback_ = std::move(state_callback);
+}
+
 void SH_Gadget::setMainController(std::shared_ptr<MainSystemController> controller) {
   main_controller_ = controller;
 }
@@ -85,8 +105,7 @@ std::string SH_Gadget::getName() const {
 void SH_Gadget::handleCodeUpdate(unsigned long code) {
   GadgetMethod method = getMethodForCode(code);
   if (method != GadgetMethod::err_type) {
-    logger.print(name, "Applying Method: ");
-    logger.printfln("'%d'", (uint8_t) method);
+    LOG_TOKEN(LOG_TYPE::INFO, "[%s] Applying Method: '%d'", name.c_str(), (uint8_t) method);
     logger.incIndent();
     handleMethodUpdate(method);
     logger.decIndent();
@@ -109,6 +128,64 @@ bool SH_Gadget::gadgetHasChanged() {
 
 void SH_Gadget::setGadgetHasChanged() {
   has_changed = true;
+  refresh_requested_ = true;
+}
+
+unsigned long SH_Gadget::getRefreshInterval() const {
+  return GADGET_REFRESH_DEFAULT_INTERVAL_MS;
+}
+
+unsigned long SH_Gadget::getRefreshCost() const {
+  return GADGET_REFRESH_DEFAULT_COST_US;
+}
+
+bool SH_Gadget::hasPendingInput() {
+  return false;
+}
+
+void SH_Gadget::setOwnerTask(TaskHandle_t task) {
+  owner_task_ = task;
+}
+
+bool SH_Gadget::postCommand(const GadgetCommand &command) {
+  if (xQueueSend(command_queue_, &command, 0) != pdTRUE) {
+    return false;
+  }
+  if (owner_task_ != nullptr) {
+    xTaskNotifyGive(owner_task_);
+  } else if (main_controller_ != nullptr) {
+    main_controller_->wakeMainTask();
+  }
+  return true;
+}
+
+bool SH_Gadget::hasPendingCommands() const {
+  return uxQueueMessagesWaiting(command_queue_) > 0;
+}
+
+void SH_Gadget::applyCommands() {
+  GadgetCommand command;
+  while (xQueueReceive(command_queue_, &command, 0) == pdTRUE) {
+    active_command_ = &command;
+    switch (command.type) {
+      case GadgetCommandType::CharacteristicUpdate:
+        handleCharacteristicUpdate(command.characteristic, command.value);
+        break;
+      case GadgetCommandType::CodeUpdate:
+        handleCodeUpdate(command.code);
+        break;
+      case GadgetCommandType::Event:
+        handleEvent(command.sender, command.event_type);
+        break;
+    }
+    active_command_ = nullptr;
+  }
+}
+
+bool SH_Gadget::takeRefreshRequest() {
+  bool buf = refresh_requested_;
+  refresh_requested_ = false;
+  return buf;
 }
 
 //IR Connector
@@ -146,13 +223,12 @@ bool SH_Gadget::hasRadio() const {
 }
 
 void SH_Gadget::handleCharacteristicUpdate(CharacteristicIdentifier characteristic, int value) {
-  logger.println(getName(), "Updating Characteristic: ");
-  logger.printfln("%d", int(characteristic));
+  LOG_TOKEN(LOG_TYPE::INFO, "[%s] Updating Characteristic: %d", name.c_str(), int(characteristic));
   executeCharacteristicUpdate(characteristic, value);
 }
 
 void SH_Gadget::handleEvent(std::string sender, EventType event_type) {
-  logger.println("not yet implemenmted");
+  LOG_TOKEN(LOG_TYPE::INFO, "not yet implemenmted");
 }
 
 void SH_Gadget::pauseAllTasks() {
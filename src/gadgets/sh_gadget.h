@@ -13,6 +13,7 @@
 #include "../connectors/ir_gadget.h"
 #include "../connectors/radio_gadget.h"
 #include "gadget_characteristic_settings.h"
+#include "gadget_command.h"
 #include "connectors/event.h"
 #include "../main_system_controller.h"
 
@@ -44,6 +45,8 @@ private:
   // Callback to update a characteristic on the gadget remote
   std::function<void(std::string, CharacteristicIdentifier, int)> gadget_remote_callback;
   std::function<void(std::string, EventType)> event_remote_callback;
+  // Callback to record every changed characteristic, no matter where the change came from
+  std::function<void(const std::string &, CharacteristicIdentifier, int)> state_callback_;
   // Flag to determine if the gadget remote is correctly initialized
   bool gadget_remote_ready;
   bool event_remote_ready;
@@ -57,6 +60,9 @@ private:
   // Whether the status of the gadget has changed since the last refresh
   bool has_changed;
 
+  // Whether the gadget should be refreshed right away instead of waiting for its refresh interval
+  bool refresh_requested_;
+
   // The IR gadget to be used
   std::shared_ptr<IR_Gadget> ir_gadget_;
 
@@ -66,6 +72,15 @@ private:
   // Controller for the main system. Behaves like a bundle of callbacks of a "delegate lite"
   std::shared_ptr<MainSystemController> main_controller_;
 
+  // Task refreshing the gadget, nullptr if the main task owns it
+  TaskHandle_t owner_task_;
+
+  // Commands waiting to be applied by the task owning the gadget
+  QueueHandle_t command_queue_;
+
+  // Command currently being applied, nullptr if none
+  const GadgetCommand *active_command_;
+
 protected:
 
   /**
@@ -163,6 +178,12 @@ public:
    */
   void setEventRemoteCallback(function<void(string, EventType)> send_event);
 
+  /**
+   * Sets the callback receiving every changed characteristic, including changes made by the bridge
+   * @param state_callback Method used to record the changes
+   */
+  void setStateCallback(std::function<void(const std::string &, CharacteristicIdentifier, int)> state_callback);
+
   /**
    * Returns the type of the gadget
    * @return the type of the gadget
@@ -214,6 +235,52 @@ public:
    */
   virtual void refresh() = 0;
 
+  /**
+   * @return The time in ms between two refreshes the gadget needs to work properly, checked again after every refresh
+   */
+  virtual unsigned long getRefreshInterval() const;
+
+  /**
+   * @return The worst-case time in us a single refresh takes
+   */
+  virtual unsigned long getRefreshCost() const;
+
+  /**
+   * @return Whether the gadget has received input (like edges on an input pin) that should be handled right away
+   */
+  virtual bool hasPendingInput();
+
+  /**
+   * Sets the task refreshing the gadget and applying its commands.
+   * Gadgets waking up their task on input (like interrupts on input pins) have to forward it.
+   * @param task The owning task
+   */
+  virtual void setOwnerTask(TaskHandle_t task);
+
+  /**
+   * Queues a command to be applied by the task owning the gadget and wakes that task up. Never blocks.
+   * @param command The command
+   * @return Whether the command could be queued
+   */
+  bool postCommand(const GadgetCommand &command);
+
+  /**
+   * @return Whether there are commands waiting to be applied
+   */
+  bool hasPendingCommands() const;
+
+  /**
+   * Applies all queued commands. Must only be called by the task owning the gadget.
+   */
+  void applyCommands();
+
+  /**
+   * Checks whether a change was protocolled that should be applied by refreshing the gadget right away.
+   * Resets the request.
+   * @return Whether the gadget has requested a refresh
+   */
+  bool takeRefreshRequest();
+
   /**
    * Adds a code to a message. This message will be used to update the gadget when the code is received
    * @param method The method to call
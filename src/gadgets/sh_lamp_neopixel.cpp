@@ -3,7 +3,7 @@
 #include <utility>
 
 bool SH_Lamp_NeoPixel::setLEDColor(uint8_t r, uint8_t g, uint8_t b) {
-  logger.printfln("[%s] Setting Color: (%d, %d, %d)", getName().c_str(), r, g, b);
+  LOG_TOKEN(LOG_TYPE::INFO, "[%s] Setting Color: (%d, %d, %d)", getName().c_str(), r, g, b);
   pauseAllTasks();
   for (uint16_t k = 0; k < len_; k++) {
     led_stripe_.setPixelColor(k, Adafruit_NeoPixel::Color(r, g, b));
@@ -13,4 +13,12 @@ void SH_Lamp_Westinghouse_IR::refresh() {
     else
       sendRawIR(lamp_off, 119);
   }
-}
\ No newline at end of file
+}
+
+unsigned long SH_Lamp_Westinghouse_IR::getRefreshInterval() const {
+  return LAMP_WESTINGHOUSE_IR_REFRESH_INTERVAL;
+}
+
+unsigned long SH_Lamp_Westinghouse_IR::getRefreshCost() const {
+  return LAMP_WESTINGHOUSE_IR_REFRESH_COST;
+}
@@ -2,6 +2,10 @@
 
 #include "sh_lamp.h"
 
+// Changes are applied through refresh requests, sending a code blocks for up to 150 ms
+#define LAMP_WESTINGHOUSE_IR_REFRESH_INTERVAL 1000
+#define LAMP_WESTINGHOUSE_IR_REFRESH_COST 150000
+
 // UNKNOWN 19496A87
 static const uint16_t lamp_on[143] = {1246, 434, 1248, 432, 408, 1300, 382, 1300, 380, 1298, 384, 1296, 382,
                                       1298, 382, 1298, 1220,
@@ -47,6 +51,10 @@ public:
   explicit SH_Lamp_Westinghouse_IR(std::string name);
 
   void refresh() override;
+
+  unsigned long getRefreshInterval() const override;
+
+  unsigned long getRefreshCost() const override;
 };
 
 static std::shared_ptr<SH_Lamp_Westinghouse_IR> createSHLampWestinghouseIR(std::string name, pin_set pins, const JsonObject& gadget_data) {
@@ -13,11 +13,11 @@ void SH_Sensor_Motion::setStatus(bool status) {
   }
   if (status) {
     if (!sensor_status_){
-      logger.println("movement detected!");
+      LOG_TOKEN(LOG_TYPE::INFO, "movement detected!");
     }
   } else {
     if (sensor_status_) {
-      logger.println("no further movement detected");
+      LOG_TOKEN(LOG_TYPE::INFO, "no further movement detected");
     }
   }
 }
@@ -4,11 +4,27 @@
 
 SH_Sensor_Motion_HR501::SH_Sensor_Motion_HR501(std::string name, uint8_t pin) :
   SH_Sensor_Motion(std::move(name)),
-  input_pin_(pin) {
-  pinMode(input_pin_, INPUT);
-}
+  input_(pin, HR501_DEBOUNCE_DELAY) {}
 
 void SH_Sensor_Motion_HR501::refresh() {
-  int val = digitalRead(input_pin_);
-  setStatus(val);
-}
\ No newline at end of file
+  GpioEdge edge;
+  while (input_.pollEdge(edge)) {}
+  setStatus(input_.getLevel());
+}
+
+unsigned long SH_Sensor_Motion_HR501::getRefreshInterval() const {
+  return input_.isSettling() ? HR501_DEBOUNCE_DELAY : HR501_REFRESH_INTERVAL;
+}
+
+unsigned long SH_Sensor_Motion_HR501::getRefreshCost() const {
+  return HR501_REFRESH_COST;
+}
+
+bool SH_Sensor_Motion_HR501::hasPendingInput() {
+  return input_.hasPendingEdges();
+}
+
+void SH_Sensor_Motion_HR501::setOwnerTask(TaskHandle_t task) {
+  SH_Gadget::setOwnerTask(task);
+  input_.setNotifyTask(task);
+}
@@ -1,10 +1,16 @@
 #pragma once
 
 #include "sh_sensor_motion.h"
+#include "../gpio_input.h"
+
+#define HR501_DEBOUNCE_DELAY 10
+// Edges are handled as pending input, the interval is only used when the output is stable
+#define HR501_REFRESH_INTERVAL 1000
+#define HR501_REFRESH_COST 50
 
 class SH_Sensor_Motion_HR501 : public SH_Sensor_Motion {
 private:
-  int input_pin_;
+  GpioInput input_;
 
 public:
   /**
@@ -15,6 +21,14 @@ public:
 
   void refresh() override;
 
+  unsigned long getRefreshInterval() const override;
+
+  unsigned long getRefreshCost() const override;
+
+  bool hasPendingInput() override;
+
+  void setOwnerTask(TaskHandle_t task) override;
+
 };
 
 static std::shared_ptr<SH_Sensor_Motion_HR501> createSHSensorMotionHR501(std::string name, pin_set pins, const JsonObject& gadget_data) {
@@ -23,11 +37,11 @@ static std::shared_ptr<SH_Sensor_Motion_HR501> createSHSensorMotionHR501(std::st
   if (pins[0] != 0) {
     pin = pins[0];
   } else {
-    logger.println(LOG_TYPE::ERR, "No pin set");
+    LOG_TOKEN(LOG_TYPE::ERR, "No pin set");
     return nullptr;
   }
 
-  logger.printfln("Pin: %d", pin);
+  LOG_TOKEN(LOG_TYPE::INFO, "Pin: %d", pin);
 
   return std::make_shared<SH_Sensor_Motion_HR501>(name, pin);
 }
\ No newline at end of file
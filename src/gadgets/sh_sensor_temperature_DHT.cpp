@@ -19,4 +19,12 @@ void SH_Sensor_Temperature_DHT::refresh() {
     setHumidity((int) sensor_->readHumidity());
     setTemperature((int) sensor_->readTemperature());
   }
-}
\ No newline at end of file
+}
+
+unsigned long SH_Sensor_Temperature_DHT::getRefreshInterval() const {
+  return DHT_REFRESH_INTERVAL;
+}
+
+unsigned long SH_Sensor_Temperature_DHT::getRefreshCost() const {
+  return DHT_REFRESH_COST;
+}
@@ -3,6 +3,10 @@
 #include "sh_sensor_temperature.h"
 #include <DHT.h>
 
+// The DHT22 delivers a new measurement every two seconds, reading it blocks for a few ms
+#define DHT_REFRESH_INTERVAL 2000
+#define DHT_REFRESH_COST 10000
+
 class SH_Sensor_Temperature_DHT : public SH_Sensor_Temperature {
 private:
   uint8_t pin_;
@@ -17,6 +21,10 @@ public:
   explicit SH_Sensor_Temperature_DHT(std::string name, uint8_t pin);
 
   void refresh() override;
+
+  unsigned long getRefreshInterval() const override;
+
+  unsigned long getRefreshCost() const override;
 };
 
 static std::shared_ptr<SH_Sensor_Temperature_DHT> createSHSensorTemperatureDHT(std::string name, pin_set pins, const JsonObject& gadget_data) {
@@ -25,11 +33,11 @@ static std::shared_ptr<SH_Sensor_Temperature_DHT> createSHSensorTemperatureDHT(s
   if (pins[0] != 0) {
     pin = pins[0];
   } else {
-    logger.println(LOG_TYPE::ERR, "No pin set");
+    LOG_TOKEN(LOG_TYPE::ERR, "No pin set");
     return nullptr;
   }
 
-  logger.printfln("Pin: %d", pin);
+  LOG_TOKEN(LOG_TYPE::INFO, "Pin: %d", pin);
 
   return std::make_shared<SH_Sensor_Temperature_DHT>(name, pin);
 }
\ No newline at end of file
@@ -1,19 +1,33 @@
 #include "sh_wallswitch_basic.h"
 
 void SH_Wallswitch_Basic::refresh() {
-  if (digitalRead(pin_) != default_state_) {
-    unsigned long now = millis();
-    if (last_action_ + 50 < now || last_action_ > now) {
+  GpioEdge edge;
+  while (input_.pollEdge(edge)) {
+    if (edge.level != default_state_) {
       switchTriggered();
     }
-    last_action_ = now;
   }
 }
 
+unsigned long SH_Wallswitch_Basic::getRefreshInterval() const {
+  // Check the level again as soon as the switch stopped bouncing
+  return input_.isSettling() ? WALLSWITCH_BOUNCE_DELAY : WALLSWITCH_REFRESH_INTERVAL;
+}
+
+unsigned long SH_Wallswitch_Basic::getRefreshCost() const {
+  return WALLSWITCH_REFRESH_COST;
+}
+
+bool SH_Wallswitch_Basic::hasPendingInput() {
+  return input_.hasPendingEdges();
+}
+
+void SH_Wallswitch_Basic::setOwnerTask(TaskHandle_t task) {
+  SH_Gadget::setOwnerTask(task);
+  input_.setNotifyTask(task);
+}
+
 SH_Wallswitch_Basic::SH_Wallswitch_Basic(std::string name, uint8_t pin, bool default_state) :
   SH_Wallswitch(std::move(name)),
-  pin_(pin),
-  last_action_(0),
-  default_state_(default_state) {
-  pinMode(pin_, INPUT);
-}
+  input_(pin, WALLSWITCH_BOUNCE_DELAY),
+  default_state_(default_state) {}
@@ -1,12 +1,17 @@
 #pragma once
 
 #include "sh_wallswitch.h"
+#include "../gpio_input.h"
+
+#define WALLSWITCH_BOUNCE_DELAY 50
+// Edges are handled as pending input, the interval is only used when the switch is not bouncing
+#define WALLSWITCH_REFRESH_INTERVAL 1000
+#define WALLSWITCH_REFRESH_COST 50
 
 class SH_Wallswitch_Basic : public SH_Wallswitch {
 private:
 
-  uint8_t pin_;
-  unsigned long last_action_;
+  GpioInput input_;
   bool default_state_;
 
 public:
@@ -14,6 +19,14 @@ public:
   SH_Wallswitch_Basic(std::string name, uint8_t pin, bool default_state);
 
   void refresh() override;
+
+  unsigned long getRefreshInterval() const override;
+
+  unsigned long getRefreshCost() const override;
+
+  bool hasPendingInput() override;
+
+  void setOwnerTask(TaskHandle_t task) override;
 };
 
 static std::shared_ptr<SH_Wallswitch_Basic>
@@ -24,7 +37,7 @@ createSHWallswitchBasic(std::string name, pin_set pins, const JsonObject &gadget
   if (pins[0] != 0) {
     pin = pins[0];
   } else {
-    logger.println(LOG_TYPE::ERR, "No pin set");
+    LOG_TOKEN(LOG_TYPE::ERR, "No pin set");
     return nullptr;
   }
 
@@ -32,8 +45,8 @@ createSHWallswitchBasic(std::string name, pin_set pins, const JsonObject &gadget
     default_state = gadget_data["default_state"].as<bool>();
   }
 
-  logger.printfln("Pin: %d", pin);
-  logger.printfln("Default State: %d", default_state);
+  LOG_TOKEN(LOG_TYPE::INFO, "Pin: %d", pin);
+  LOG_TOKEN(LOG_TYPE::INFO, "Default State: %d", default_state);
 
   return std::make_shared<SH_Wallswitch_Basic>(name, pin, default_state);
 }
\ No newline at end of file
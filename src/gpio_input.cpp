@@ -0,0 +1,94 @@
+#include "gpio_input.h"
+
+GpioInput::GpioInput(uint8_t pin, unsigned long debounce_ms) :
+    pin_(pin),
+    debounce_time_((int64_t) debounce_ms * 1000),
+    head_(0),
+    tail_(0),
+    dropped_edges_(0),
+    stable_level_(false),
+    last_edge_(0),
+    settle_pending_(false),
+    notify_task_(nullptr) {
+  pinMode(pin_, INPUT);
+  stable_level_ = digitalRead(pin_);
+  attachInterruptArg(pin_, handleInterrupt, this, CHANGE);
+}
+
+GpioInput::~GpioInput() {
+  detachInterrupt(pin_);
+}
+
+void IRAM_ATTR GpioInput::handleInterrupt(void *args) {
+  auto input = (GpioInput *) args;
+  int64_t now = esp_timer_get_time();
+  uint32_t head = input->head_.load(std::memory_order_relaxed);
+  if (head - input->tail_.load(std::memory_order_acquire) >= GPIO_INPUT_QUEUE_LEN) {
+    input->dropped_edges_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    input->edges_[head % GPIO_INPUT_QUEUE_LEN] = {now, (bool) digitalRead(input->pin_)};
+    input->head_.store(head + 1, std::memory_order_release);
+  }
+
+  TaskHandle_t notify_task = input->notify_task_;
+  if (notify_task != nullptr) {
+    BaseType_t task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(notify_task, &task_woken);
+    if (task_woken) {
+      portYIELD_FROM_ISR();
+    }
+  }
+}
+
+void GpioInput::setNotifyTask(TaskHandle_t task) {
+  notify_task_ = task;
+}
+
+bool GpioInput::pollEdge(GpioEdge &edge) {
+  uint32_t tail = tail_.load(std::memory_order_relaxed);
+  while (tail != head_.load(std::memory_order_acquire)) {
+    GpioEdge raw = edges_[tail % GPIO_INPUT_QUEUE_LEN];
+    tail++;
+    tail_.store(tail, std::memory_order_release);
+
+    bool quiet = !settle_pending_ || raw.time - last_edge_ >= debounce_time_;
+    last_edge_ = raw.time;
+    settle_pending_ = true;
+    if (quiet && raw.level != stable_level_) {
+      stable_level_ = raw.level;
+      edge = raw;
+      return true;
+    }
+  }
+
+  // Edges read while bouncing may have been missed or read wrong, the settled level is the truth
+  if (settle_pending_ && esp_timer_get_time() - last_edge_ >= debounce_time_) {
+    settle_pending_ = false;
+    bool level = digitalRead(pin_);
+    if (level != stable_level_) {
+      stable_level_ = level;
+      edge = {esp_timer_get_time(), level};
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GpioInput::hasPendingEdges() const {
+  if (tail_.load(std::memory_order_relaxed) != head_.load(std::memory_order_acquire)) {
+    return true;
+  }
+  return settle_pending_ && esp_timer_get_time() - last_edge_ >= debounce_time_;
+}
+
+bool GpioInput::isSettling() const {
+  return settle_pending_;
+}
+
+bool GpioInput::getLevel() const {
+  return stable_level_;
+}
+
+uint32_t GpioInput::getDroppedEdges() const {
+  return dropped_edges_.load(std::memory_order_relaxed);
+}
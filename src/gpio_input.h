@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Arduino.h"
+#include <atomic>
+#include "system_settings.h"
+
+/**
+ * An edge detected on an input pin
+ */
+struct GpioEdge {
+  // Local time in us the edge was detected at
+  int64_t time;
+  // Level of the pin after the edge
+  bool level;
+};
+
+/**
+ * Input pin detecting its edges using an interrupt.
+ * The interrupt only timestamps the edge, queues it and wakes up the task polling the input.
+ * Debouncing happens in task context when the edges are read using pollEdge().
+ */
+class GpioInput {
+private:
+
+  uint8_t pin_;
+
+  // Time in us after an accepted edge during which further edges are treated as bouncing
+  int64_t debounce_time_;
+
+  // Edges queued by the interrupt (single producer) and read by the owning task (single consumer)
+  GpioEdge edges_[GPIO_INPUT_QUEUE_LEN];
+  std::atomic<uint32_t> head_;
+  std::atomic<uint32_t> tail_;
+
+  // Edges dropped because the queue was full
+  std::atomic<uint32_t> dropped_edges_;
+
+  // Debounced level of the pin
+  bool stable_level_;
+
+  // Time of the last edge read from the queue and whether the level has to be checked once it settled
+  int64_t last_edge_;
+  bool settle_pending_;
+
+  // Task woken up by every edge, nullptr if none
+  TaskHandle_t notify_task_;
+
+  /**
+   * Interrupt handler for the pin
+   * @param args Pointer to the GpioInput
+   */
+  static void IRAM_ATTR handleInterrupt(void *args);
+
+public:
+
+  /**
+   * Configures the pin as input and attaches the interrupt
+   * @param pin The pin
+   * @param debounce_ms Time after an edge during which further edges are treated as bouncing
+   */
+  GpioInput(uint8_t pin, unsigned long debounce_ms);
+
+  ~GpioInput();
+
+  GpioInput(const GpioInput &) = delete;
+
+  GpioInput &operator=(const GpioInput &) = delete;
+
+  /**
+   * Sets the task to wake up (vTaskNotifyGiveFromISR) on every edge, this should be the task polling the input
+   * @param task The task or nullptr to disable notifying
+   */
+  void setNotifyTask(TaskHandle_t task);
+
+  /**
+   * Gets the next debounced edge.
+   * The first edge after a quiet period is accepted right away, the level is checked again once the pin settled.
+   * @param edge [out] The edge
+   * @return Whether there was an edge
+   */
+  bool pollEdge(GpioEdge &edge);
+
+  /**
+   * @return Whether there are edges to poll or the level has to be checked after bouncing
+   */
+  bool hasPendingEdges() const;
+
+  /**
+   * @return Whether an edge was read recently and the level still has to be checked once the pin settled
+   */
+  bool isSettling() const;
+
+  /**
+   * @return The debounced level of the pin
+   */
+  bool getLevel() const;
+
+  /**
+   * @return The number of edges dropped because they were not polled fast enough
+   */
+  uint32_t getDroppedEdges() const;
+};
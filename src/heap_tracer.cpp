@@ -0,0 +1,181 @@
+#include "heap_tracer.h"
+#include "console_logger.h"
+#include "timer_wheel.h"
+
+#include <cstdlib>
+#include <new>
+
+// Tag of the allocations of the running task
+static thread_local HeapTag task_tag_ = HeapTag::Other;
+
+/**
+ * Stored in front of every traced block, keeps the alignment of the block returned by malloc
+ */
+struct AllocationHeader {
+  uint32_t size;
+  uint32_t tag;
+};
+
+const char *HeapTracer::getTagName(HeapTag tag) {
+  switch (tag) {
+    case HeapTag::Requests:
+      return "requests";
+    case HeapTag::Logger:
+      return "logger";
+    case HeapTag::Gadgets:
+      return "gadgets";
+    case HeapTag::Storage:
+      return "storage";
+    default:
+      return "other";
+  }
+}
+
+HeapTag HeapTracer::setTaskTag(HeapTag tag) {
+  HeapTag previous = task_tag_;
+  task_tag_ = tag;
+  return previous;
+}
+
+void *HeapTracer::allocate(size_t size) {
+  auto header = (AllocationHeader *) malloc(sizeof(AllocationHeader) + size);
+  if (header == nullptr) {
+    return nullptr;
+  }
+  header->size = size;
+  header->tag = (uint32_t) task_tag_;
+
+  auto &stats = stats_[header->tag];
+  stats.allocations.fetch_add(1, std::memory_order_relaxed);
+  uint32_t live = stats.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+  uint32_t peak = stats.peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !stats.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+  return header + 1;
+}
+
+void HeapTracer::release(void *block) {
+  if (block == nullptr) {
+    return;
+  }
+  auto header = (AllocationHeader *) block - 1;
+  auto &stats = stats_[header->tag];
+  stats.frees.fetch_add(1, std::memory_order_relaxed);
+  stats.live_bytes.fetch_sub(header->size, std::memory_order_relaxed);
+  free(header);
+}
+
+void HeapTracer::recordLargestBlock(HeapTag tag) {
+  auto largest = (uint32_t) heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  auto &stats = stats_[(uint8_t) tag];
+  uint32_t current = stats.min_largest_block.load(std::memory_order_relaxed);
+  while ((current == 0 || largest < current) &&
+         !stats.min_largest_block.compare_exchange_weak(current, largest, std::memory_order_relaxed)) {}
+}
+
+void HeapTracer::begin() {
+  timer_wheel.schedulePeriodic(HEAP_REPORT_INTERVAL_MS, std::bind(&HeapTracer::printReport, this));
+}
+
+void HeapTracer::printReport() {
+  logger.printfln("Heap: %u free, %u min free, %u largest block",
+                  (unsigned) ESP.getFreeHeap(),
+                  (unsigned) ESP.getMinFreeHeap(),
+                  (unsigned) heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#if HEAP_TRACER_ACTIVE
+  logger.incIndent();
+  for (uint8_t i = 0; i < HEAP_TAG_COUNT; i++) {
+    auto &stats = stats_[i];
+    logger.printfln("%-8s live: %6u, peak: %6u, allocs: %6u, frees: %6u, min largest block: %6u",
+                    getTagName(HeapTag(i)),
+                    (unsigned) stats.live_bytes.load(),
+                    (unsigned) stats.peak_bytes.load(),
+                    (unsigned) stats.allocations.load(),
+                    (unsigned) stats.frees.load(),
+                    (unsigned) stats.min_largest_block.load());
+  }
+  logger.decIndent();
+#endif
+}
+
+void HeapTracer::serialize(DynamicJsonDocument &doc) {
+  doc["free"] = ESP.getFreeHeap();
+  doc["min_free"] = ESP.getMinFreeHeap();
+  doc["largest_block"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#if HEAP_TRACER_ACTIVE
+  JsonObject tags = doc.createNestedObject("tags");
+  for (uint8_t i = 0; i < HEAP_TAG_COUNT; i++) {
+    auto &stats = stats_[i];
+    JsonArray tag = tags.createNestedArray(getTagName(HeapTag(i)));
+    tag.add(stats.live_bytes.load());
+    tag.add(stats.peak_bytes.load());
+    tag.add(stats.allocations.load());
+    tag.add(stats.frees.load());
+    tag.add(stats.min_largest_block.load());
+  }
+#endif
+}
+
+HeapScope::HeapScope(HeapTag tag) :
+    tag_(tag),
+    previous_tag_(HeapTracer::setTaskTag(tag)) {}
+
+HeapScope::~HeapScope() {
+#if HEAP_TRACER_ACTIVE
+  heap_tracer.recordLargestBlock(tag_);
+#endif
+  HeapTracer::setTaskTag(previous_tag_);
+}
+
+HeapTracer heap_tracer;
+
+#if HEAP_TRACER_ACTIVE
+
+void *operator new(size_t size) {
+  void *block = heap_tracer.allocate(size);
+  if (block == nullptr) {
+#if __cpp_exceptions
+    throw std::bad_alloc();
+#else
+    abort();
+#endif
+  }
+  return block;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return heap_tracer.allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return heap_tracer.allocate(size);
+}
+
+void operator delete(void *block) noexcept {
+  heap_tracer.release(block);
+}
+
+void operator delete[](void *block) noexcept {
+  heap_tracer.release(block);
+}
+
+void operator delete(void *block, const std::nothrow_t &) noexcept {
+  heap_tracer.release(block);
+}
+
+void operator delete[](void *block, const std::nothrow_t &) noexcept {
+  heap_tracer.release(block);
+}
+
+void operator delete(void *block, size_t) noexcept {
+  heap_tracer.release(block);
+}
+
+void operator delete[](void *block, size_t) noexcept {
+  heap_tracer.release(block);
+}
+
+#endif
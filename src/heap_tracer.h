@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Arduino.h"
+#include <ArduinoJson.h>
+#include <atomic>
+#include "user_settings.h"
+#include "system_settings.h"
+
+/**
+ * Subsystems allocations are attributed to
+ */
+enum class HeapTag : uint8_t {
+  Other, Requests, Logger, Gadgets, Storage
+};
+
+#define HEAP_TAG_COUNT 5
+
+/**
+ * Traces the heap usage of the subsystems.
+ * With HEAP_TRACER_ACTIVE, operator new and delete are replaced to count every allocation for the tag of the
+ * allocating task, set using HeapScope. Allocations using malloc directly (like ArduinoJson documents) are not
+ * counted, but show in the largest free block recorded whenever a scope ends.
+ * Has no constructor, so it is usable by allocations happening before the static initialization.
+ */
+class HeapTracer {
+private:
+
+  /**
+   * Heap usage of a tag
+   */
+  struct TagStats {
+    std::atomic<uint32_t> allocations;
+    std::atomic<uint32_t> frees;
+    // Bytes currently allocated
+    std::atomic<uint32_t> live_bytes;
+    std::atomic<uint32_t> peak_bytes;
+    // Smallest largest free block seen when a scope of the tag ended, 0 if none ended yet
+    std::atomic<uint32_t> min_largest_block;
+  };
+
+  TagStats stats_[HEAP_TAG_COUNT];
+
+public:
+
+  /**
+   * @param tag A tag
+   * @return The name of the tag
+   */
+  static const char *getTagName(HeapTag tag);
+
+  /**
+   * Sets the tag for the allocations of the current task
+   * @param tag The new tag
+   * @return The previous tag
+   */
+  static HeapTag setTaskTag(HeapTag tag);
+
+  /**
+   * Allocates a block and counts it for the tag of the current task
+   * @param size Size of the block
+   * @return The block or nullptr if there is not enough memory
+   */
+  void *allocate(size_t size);
+
+  /**
+   * Releases a block allocated using allocate()
+   * @param block The block, may be nullptr
+   */
+  void release(void *block);
+
+  /**
+   * Records the current largest free block for a tag
+   * @param tag The tag
+   */
+  void recordLargestBlock(HeapTag tag);
+
+  /**
+   * Starts printing the report periodically
+   */
+  void begin();
+
+  /**
+   * Prints the heap state and the usage of every tag
+   */
+  void printReport();
+
+  /**
+   * Writes the heap state and the usage of every tag.
+   * Every tag is an array of live bytes, peak bytes, allocations, frees and the smallest largest free block.
+   * @param doc Document to write to
+   */
+  void serialize(DynamicJsonDocument &doc);
+};
+
+extern HeapTracer heap_tracer;
+
+/**
+ * Attributes the allocations of the current task to a tag until the scope ends
+ */
+class HeapScope {
+private:
+  HeapTag tag_;
+  HeapTag previous_tag_;
+
+public:
+  explicit HeapScope(HeapTag tag);
+
+  ~HeapScope();
+
+  HeapScope(const HeapScope &) = delete;
+
+  HeapScope &operator=(const HeapScope &) = delete;
+};
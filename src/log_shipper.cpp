@@ -0,0 +1,155 @@
+#include "log_shipper.h"
+#include "protocol_paths.h"
+#include "timer_wheel.h"
+#include "heap_tracer.h"
+
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <climits>
+#include <cstring>
+#include <utility>
+
+using std::placeholders::_1;
+using std::placeholders::_2;
+using std::placeholders::_3;
+using std::placeholders::_4;
+
+LogShipper::LogShipper() :
+    network_gadget_(nullptr),
+    batch_bytes_(0),
+    envelope_bytes_(0),
+    last_flush_(0),
+    tokens_(LOG_SHIPPING_BURST * 1000UL),
+    last_refill_(0),
+    dropped_lines_(0) {}
+
+void LogShipper::begin(std::shared_ptr<RequestGadget> network_gadget, const std::string &client_id) {
+  network_gadget->setSendFailedCallback(std::bind(&LogShipper::handleSendFailed, this, _1));
+  {
+    std::lock_guard<std::mutex> guard(batch_mutex_);
+    network_gadget_ = std::move(network_gadget);
+    client_id_ = client_id;
+    last_flush_ = millis();
+    last_refill_ = last_flush_;
+
+    // Measured with the longest session id and dropped count, so every batch fits
+    auto empty_batch = createBatchRequest(INT_MIN, {}, ULONG_MAX);
+    envelope_bytes_ = MQTT_MAX_HEADER_SIZE + 2 + strlen(PATH_LOG) + empty_batch->getBody().size();
+  }
+  logger.setCallback(std::bind(&LogShipper::addLine, this, _1, _2, _3, _4));
+  timer_wheel.schedulePeriodic(LOG_SHIPPING_INTERVAL_MS, std::bind(&LogShipper::refresh, this));
+}
+
+void LogShipper::setLevelStatus(LOG_TYPE type, bool status) {
+  logger.setCallbackStatus(type, status);
+}
+
+void LogShipper::fillLine(JsonObject obj, const ShippedLine &line) {
+  obj["time"] = line.timestamp;
+  obj["type"] = int(line.log_type);
+  if (!line.name.empty()) {
+    obj["name"] = line.name;
+  }
+  obj["msg"] = line.message;
+}
+
+std::shared_ptr<Request> LogShipper::createBatchRequest(int session_id, const std::vector<ShippedLine> &lines,
+                                                        unsigned long dropped) {
+  size_t capacity = JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(lines.size()) + lines.size() * JSON_OBJECT_SIZE(4);
+  for (auto &line: lines) {
+    capacity += line.name.size() + line.message.size() + 2;
+  }
+  DynamicJsonDocument req_doc(capacity);
+  JsonArray json_lines = req_doc.createNestedArray("lines");
+  for (auto &line: lines) {
+    fillLine(json_lines.createNestedObject(), line);
+  }
+  req_doc["dropped"] = dropped;
+
+  return std::make_shared<Request>(PATH_LOG,
+                                   session_id,
+                                   client_id_,
+                                   PROTOCOL_BRIDGE_NAME,
+                                   req_doc);
+}
+
+void LogShipper::handleSendFailed(const std::shared_ptr<Request> &request) {
+  if (request->getPath() != PATH_LOG) {
+    return;
+  }
+  auto payload = request->getPayload();
+  unsigned long lost = payload["lines"].size() + payload["dropped"].as<unsigned long>();
+  std::lock_guard<std::mutex> guard(batch_mutex_);
+  dropped_lines_ += lost;
+}
+
+void LogShipper::refillTokens(unsigned long now) {
+  tokens_ += (now - last_refill_) * LOG_SHIPPING_RATE;
+  if (tokens_ > LOG_SHIPPING_BURST * 1000UL) {
+    tokens_ = LOG_SHIPPING_BURST * 1000UL;
+  }
+  last_refill_ = now;
+}
+
+void LogShipper::addLine(LOG_TYPE type, std::string message, std::string name, int /*task_id*/) {
+  unsigned long now = millis();
+  std::lock_guard<std::mutex> guard(batch_mutex_);
+  if (network_gadget_ == nullptr) {
+    return;
+  }
+
+  refillTokens(now);
+  if (tokens_ < 1000) {
+    dropped_lines_++;
+    return;
+  }
+  tokens_ -= 1000;
+
+  ShippedLine line = {now, type, std::move(name), std::move(message)};
+  DynamicJsonDocument line_doc(JSON_OBJECT_SIZE(4) + line.name.size() + line.message.size() + 2);
+  fillLine(line_doc.to<JsonObject>(), line);
+  // Includes the comma separating it from the previous line, one byte too much for the first line
+  size_t line_bytes = measureJson(line_doc) + 1;
+
+  if (envelope_bytes_ + batch_bytes_ + line_bytes > MQTT_MAX_PACKET_SIZE) {
+    sendBatch(now);
+    if (envelope_bytes_ + line_bytes > MQTT_MAX_PACKET_SIZE) {
+      dropped_lines_++;
+      return;
+    }
+  }
+
+  batch_bytes_ += line_bytes;
+  batch_.push_back(std::move(line));
+}
+
+void LogShipper::sendBatch(unsigned long now) {
+  last_flush_ = now;
+  if (batch_.empty() && dropped_lines_ == 0) {
+    return;
+  }
+
+  auto log_req = createBatchRequest(int(now), batch_, dropped_lines_);
+
+  // Never wait for the network, the lines are dropped if the queue is full.
+  // Lines of batches that cannot be published are counted again by handleSendFailed().
+  if (network_gadget_->trySendRequest(log_req)) {
+    dropped_lines_ = 0;
+  } else {
+    dropped_lines_ += batch_.size();
+  }
+  batch_.clear();
+  batch_bytes_ = 0;
+}
+
+void LogShipper::refresh() {
+  HeapScope heap_scope(HeapTag::Logger);
+  unsigned long now = millis();
+  std::lock_guard<std::mutex> guard(batch_mutex_);
+  if (network_gadget_ == nullptr || now - last_flush_ < LOG_SHIPPING_INTERVAL_MS) {
+    return;
+  }
+  sendBatch(now);
+}
+
+LogShipper log_shipper;
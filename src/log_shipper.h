@@ -0,0 +1,126 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "console_logger.h"
+#include "connectors/request_gadget.h"
+#include "system_settings.h"
+
+/**
+ * Ships log lines to the bridge using the network gadget.
+ * Lines are collected from the logger callback, limited by a token bucket and sent as one batch per interval.
+ */
+class LogShipper {
+private:
+
+  /**
+   * A log line waiting to be shipped
+   */
+  struct ShippedLine {
+    unsigned long timestamp;
+    LOG_TYPE log_type;
+    std::string name;
+    std::string message;
+  };
+
+  // Gadget used to send the batches
+  std::shared_ptr<RequestGadget> network_gadget_;
+
+  // ID of the client to use as sender
+  std::string client_id_;
+
+  // Lines waiting to be shipped
+  std::vector<ShippedLine> batch_;
+
+  // Size of the serialized lines in the batch, including the commas between them
+  size_t batch_bytes_;
+
+  // Size of the MQTT packet of a batch without any lines
+  size_t envelope_bytes_;
+
+  // Timestamp the last batch was sent at
+  unsigned long last_flush_;
+
+  // Lines that may currently be shipped (token bucket), scaled by 1000 for smooth refilling
+  unsigned long tokens_;
+
+  // Timestamp the bucket was last refilled at
+  unsigned long last_refill_;
+
+  // Lines dropped since the last batch because of the rate limit, a full batch or a failed publish
+  unsigned long dropped_lines_;
+
+  // Guards the batch, accessed by the logger drain task and the network task
+  std::mutex batch_mutex_;
+
+  /**
+   * Callback for the logger, collects a line. Must not log anything itself.
+   * @param type Type of the line
+   * @param message The message of the line
+   * @param name The name of the line
+   * @param task_id ID of the task that logged the line, not shipped
+   */
+  void addLine(LOG_TYPE type, std::string message, std::string name, int task_id);
+
+  /**
+   * Writes a line into a JSON object, the same way for measuring and sending it
+   * @param obj The object to fill
+   * @param line The line
+   */
+  static void fillLine(JsonObject obj, const ShippedLine &line);
+
+  /**
+   * Creates the request carrying a batch
+   * @param session_id Session id of the request
+   * @param lines The lines to send
+   * @param dropped Count of lines dropped before the batch
+   * @return The request
+   */
+  std::shared_ptr<Request> createBatchRequest(int session_id, const std::vector<ShippedLine> &lines,
+                                              unsigned long dropped);
+
+  /**
+   * Counts the lines of a batch the network gadget could not send as dropped
+   * @param request The request that failed
+   */
+  void handleSendFailed(const std::shared_ptr<Request> &request);
+
+  /**
+   * Refills the token bucket
+   * @param now The current timestamp
+   */
+  void refillTokens(unsigned long now);
+
+  /**
+   * Sends the collected lines. batch_mutex_ has to be held by the caller.
+   * @param now The current timestamp
+   */
+  void sendBatch(unsigned long now);
+
+public:
+  LogShipper();
+
+  /**
+   * Starts collecting lines from the logger
+   * @param network_gadget The gadget to send the batches with
+   * @param client_id ID of the client to use as sender
+   */
+  void begin(std::shared_ptr<RequestGadget> network_gadget, const std::string &client_id);
+
+  /**
+   * Enables or disables shipping for a log type
+   * @param type The log type
+   * @param status Whether lines of the type should be shipped
+   */
+  void setLevelStatus(LOG_TYPE type, bool status);
+
+  /**
+   * Sends the collected lines if the shipping interval is over. Called periodically by the timer wheel.
+   */
+  void refresh();
+};
+
+extern LogShipper log_shipper;
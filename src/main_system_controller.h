@@ -6,29 +6,44 @@
 class MainSystemController {
 private:
   TaskHandle_t network_task_;
-  TaskHandle_t heartbeat_task_;
+  TaskHandle_t main_task_;
 
 public:
-  MainSystemController(TaskHandle_t network_task, TaskHandle_t heartbeat_task) :
+  explicit MainSystemController(TaskHandle_t network_task) :
       network_task_(network_task),
-      heartbeat_task_(heartbeat_task) {}
+      main_task_(nullptr) {}
+
+  /**
+   * Sets the main task to wake up using wakeMainTask()
+   * @param main_task The main task
+   */
+  void setMainTask(TaskHandle_t main_task) {
+    main_task_ = main_task;
+  }
+
+  /**
+   * Wakes up the main task to handle new input right away instead of waiting for its next timeout
+   */
+  void wakeMainTask() {
+    if (main_task_ != nullptr) {
+      xTaskNotifyGive(main_task_);
+    }
+  }
 
   /**
    * Pauses all tasks except the main task. Only usw when necessary!
    */
   void pause_all_tasks_except_main() {
-    logger.println("Pausing all tasks except main...");
+    LOG_TOKEN(LOG_TYPE::INFO, "Pausing all tasks except main...");
 //    vTaskSuspend(network_task_);
-//    vTaskResume(heartbeat_task_);
   }
 
   /**
    * Resumes all tasks on the system
    */
   void resume_all_tasks() {
-    logger.println("Resuming all tasks...");
+    LOG_TOKEN(LOG_TYPE::INFO, "Resuming all tasks...");
 //    vTaskResume(network_task_);
-//    vTaskResume(heartbeat_task_);
   }
 
 };
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 // Names and other constants
 #define PROTOCOL_BRIDGE_NAME "<bridge>"
 
@@ -7,6 +10,7 @@
 #define PATH_CODE_UPDATE_TO_BRIDGE "smarthome/to/code"
 #define PATH_CHARACTERISTIC_UPDATE_TO_BRIDGE "smarthome/remotes/gadget/update"
 #define PATH_EVENT_UPDATE_TO_BRIDGE "smarthome/remotes/event/send"
+#define PATH_LOG "smarthome/debug/log"
 
 // Receiving
 #define PATH_CODE_UPDATE_FROM_BRIDGE "smarthome/from/code"
@@ -22,6 +26,7 @@
 
 #define PATH_HEARTBEAT "smarthome/heartbeat"
 #define PATH_SYNC "smarthome/sync"
+#define PATH_SYNC_TIME "smarthome/sync/time"
 #define PATH_TEST "smarthome/test"
 
 // Paths that are used by broadcast requests
@@ -37,4 +42,5 @@ static const std::vector<std::string> system_request_paths = {PATH_CONFIG_READ,
 
 // Paths that are used by any other component but the core system
 static const std::vector<std::string> additional_request_paths = {PATH_SYNC,
+                                                                  PATH_SYNC_TIME,
                                                                   PATH_TEST};
\ No newline at end of file
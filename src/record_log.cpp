@@ -0,0 +1,625 @@
+#include "record_log.h"
+#include "console_logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+// "SHLG"
+#define RECORD_LOG_MAGIC 0x53484C47
+#define RECORD_BATCH_CONTINUES 0x80
+#define RECORD_LOG_MAX_SECTORS 32
+
+static const size_t sector_header_size = sizeof(uint32_t) * 2;
+static const size_t record_header_size = sizeof(uint32_t) * 2 + sizeof(uint16_t) + sizeof(uint8_t) * 2;
+
+RecordLog::RecordLog(FlashRegion &region, const char *name) :
+    region_(region),
+    name_(name),
+    active_(-1),
+    next_seq_(1),
+    batch_depth_(0),
+    batch_failed_(false),
+    erases_(0),
+    compactions_(0) {}
+
+uint32_t RecordLog::updateCrc(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+size_t RecordLog::getRecordSize(size_t key_len, size_t value_len) {
+  return (record_header_size + key_len + value_len + 3) & ~((size_t) 3);
+}
+
+bool RecordLog::formatSector(size_t sector, uint32_t erase_count) {
+  erases_++;
+  auto &state = sectors_[sector];
+  state.erase_count = erase_count;
+  state.live_bytes = 0;
+  // Not usable until the header is written
+  state.write_pos = FLASH_SECTOR_SIZE;
+
+  SectorHeader header = {RECORD_LOG_MAGIC, erase_count};
+  if (!region_.eraseSector(sector) || !region_.write(sector * FLASH_SECTOR_SIZE, &header, sector_header_size)) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Could not format sector %d of the %s log", (int) sector, name_);
+    return false;
+  }
+  state.write_pos = sector_header_size;
+  return true;
+}
+
+void RecordLog::scanSector(size_t sector, const uint8_t *data, uint32_t &max_seq) {
+  auto &state = sectors_[sector];
+
+  // Records of the batch read last, applied once its last record is found
+  std::vector<std::pair<RecordHeader, size_t>> batch;
+
+  size_t pos = sector_header_size;
+  while (pos + record_header_size <= FLASH_SECTOR_SIZE) {
+    RecordHeader header;
+    memcpy(&header.crc, data + pos, sizeof(uint32_t));
+    memcpy(&header.seq, data + pos + 4, sizeof(uint32_t));
+    memcpy(&header.value_len, data + pos + 8, sizeof(uint16_t));
+    header.key_len = data[pos + 10];
+    header.type = data[pos + 11];
+
+    bool erased = header.crc == 0xFFFFFFFF && header.seq == 0xFFFFFFFF && header.value_len == 0xFFFF &&
+                  header.key_len == 0xFF && header.type == 0xFF;
+    if (erased) {
+      break;
+    }
+
+    size_t size = getRecordSize(header.key_len, header.value_len);
+    auto type = (uint8_t) (header.type & ~RECORD_BATCH_CONTINUES);
+    bool valid = header.key_len != 0 && header.key_len != 0xFF && (type == Put || type == Delete) &&
+                 pos + size <= FLASH_SECTOR_SIZE &&
+                 updateCrc(0, data + pos + 4, record_header_size - 4 + header.key_len + header.value_len) == header.crc;
+    if (!valid) {
+      // Torn by losing power while writing, nothing may be appended behind it
+      LOG_TOKEN(LOG_TYPE::WARN, "Found torn record in sector %d of the %s log", (int) sector, name_);
+      state.write_pos = FLASH_SECTOR_SIZE;
+      return;
+    }
+
+    max_seq = std::max(max_seq, header.seq);
+    batch.emplace_back(header, pos);
+    pos += size;
+
+    if (!(header.type & RECORD_BATCH_CONTINUES)) {
+      for (auto &record: batch) {
+        std::string key((const char *) data + record.second + record_header_size, record.first.key_len);
+        applyRecord(key, record.first, sector, record.second, false);
+      }
+      batch.clear();
+    }
+  }
+
+  state.write_pos = pos;
+  if (!batch.empty()) {
+    // The batch was never completed, appending behind it would complete it
+    LOG_TOKEN(LOG_TYPE::WARN, "Discarded incomplete batch in sector %d of the %s log", (int) sector, name_);
+    state.write_pos = FLASH_SECTOR_SIZE;
+  }
+}
+
+bool RecordLog::scan() {
+  index_.clear();
+  active_ = -1;
+  next_seq_ = 1;
+
+  size_t sector_count = std::min((size_t) RECORD_LOG_MAX_SECTORS, region_.getSize() / FLASH_SECTOR_SIZE);
+  if (sector_count < RECORD_LOG_RESERVED_SECTORS + 2) {
+    LOG_TOKEN(LOG_TYPE::ERR, "The %s log needs at least %d sectors", name_, RECORD_LOG_RESERVED_SECTORS + 2);
+    return false;
+  }
+  sectors_.assign(sector_count, {0, FLASH_SECTOR_SIZE, 0});
+
+  // Sectors are only copied if the region is not mapped
+  const uint8_t *mapping = region_.getMapping();
+  std::vector<uint8_t> buffer(mapping == nullptr ? FLASH_SECTOR_SIZE : 0);
+  std::vector<size_t> unformatted;
+  std::vector<uint32_t> max_seqs(sector_count, 0);
+  uint32_t max_erase_count = 0;
+
+  for (size_t i = 0; i < sector_count; i++) {
+    const uint8_t *data = mapping + i * FLASH_SECTOR_SIZE;
+    if (mapping == nullptr) {
+      if (!region_.read(i * FLASH_SECTOR_SIZE, buffer.data(), FLASH_SECTOR_SIZE)) {
+        LOG_TOKEN(LOG_TYPE::ERR, "Could not read sector %d of the %s log", (int) i, name_);
+        return false;
+      }
+      data = buffer.data();
+    }
+    SectorHeader header;
+    memcpy(&header, data, sector_header_size);
+    if (header.magic != RECORD_LOG_MAGIC) {
+      unformatted.push_back(i);
+      continue;
+    }
+    sectors_[i].erase_count = header.erase_count;
+    max_erase_count = std::max(max_erase_count, header.erase_count);
+    scanSector(i, data, max_seqs[i]);
+    next_seq_ = std::max(next_seq_, max_seqs[i] + 1);
+  }
+
+  // Never used or erasing was interrupted, the erase count is lost
+  for (auto sector: unformatted) {
+    formatSector(sector, max_erase_count);
+  }
+
+  // Keep appending to the sector written last
+  for (size_t i = 0; i < sector_count; i++) {
+    if (!isFree(i) && sectors_[i].write_pos < FLASH_SECTOR_SIZE &&
+        (active_ < 0 || max_seqs[i] > max_seqs[active_])) {
+      active_ = (int) i;
+    }
+  }
+  return true;
+}
+
+void RecordLog::applyRecord(const std::string &key, const RecordHeader &header, size_t sector, size_t offset,
+                            bool replace_equal) {
+  bool deleted = (header.type & ~RECORD_BATCH_CONTINUES) == Delete;
+  uint16_t size = getRecordSize(key.size(), header.value_len);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    index_[key] = {header.seq, (uint16_t) sector, (uint16_t) offset, header.value_len, deleted, 1u << sector};
+    sectors_[sector].live_bytes += size;
+    return;
+  }
+
+  auto &entry = it->second;
+  entry.sectors |= 1u << sector;
+  if (header.seq < entry.seq || (header.seq == entry.seq && !replace_equal)) {
+    return;
+  }
+  sectors_[entry.sector].live_bytes -= getRecordSize(key.size(), entry.value_len);
+  entry.seq = header.seq;
+  entry.sector = sector;
+  entry.offset = offset;
+  entry.value_len = header.value_len;
+  entry.deleted = deleted;
+  sectors_[sector].live_bytes += size;
+}
+
+bool RecordLog::writeRecord(RecordType type, bool batch_continues, const std::string &key, const std::string &value,
+                            uint32_t seq) {
+  auto &sector = sectors_[active_];
+  size_t size = getRecordSize(key.size(), value.size());
+
+  RecordHeader header = {0, seq, (uint16_t) value.size(), (uint8_t) key.size(),
+                         (uint8_t) (type | (batch_continues ? RECORD_BATCH_CONTINUES : 0))};
+  std::vector<uint8_t> buffer(size, 0xFF);
+  memcpy(buffer.data() + 4, &header.seq, sizeof(uint32_t));
+  memcpy(buffer.data() + 8, &header.value_len, sizeof(uint16_t));
+  buffer[10] = header.key_len;
+  buffer[11] = header.type;
+  memcpy(buffer.data() + record_header_size, key.data(), key.size());
+  memcpy(buffer.data() + record_header_size + key.size(), value.data(), value.size());
+  header.crc = updateCrc(0, buffer.data() + 4, record_header_size - 4 + key.size() + value.size());
+  memcpy(buffer.data(), &header.crc, sizeof(uint32_t));
+
+  size_t offset = sector.write_pos;
+  // The bytes are used either way, a failed write may have left parts of the record behind
+  sector.write_pos += size;
+  if (!region_.write(active_ * FLASH_SECTOR_SIZE + offset, buffer.data(), size)) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Could not write to sector %d of the %s log", active_, name_);
+    sector.write_pos = FLASH_SECTOR_SIZE;
+    return false;
+  }
+  applyRecord(key, header, active_, offset, true);
+  return true;
+}
+
+bool RecordLog::readValue(const Entry &entry, size_t key_len, std::string &value) {
+  value.resize(entry.value_len);
+  if (entry.value_len == 0) {
+    return true;
+  }
+  const uint8_t *mapped = getMappedValue(entry, key_len);
+  if (mapped != nullptr) {
+    memcpy(&value[0], mapped, entry.value_len);
+    return true;
+  }
+  return region_.read(entry.sector * FLASH_SECTOR_SIZE + entry.offset + record_header_size + key_len,
+                      &value[0], entry.value_len);
+}
+
+const uint8_t *RecordLog::getMappedValue(const Entry &entry, size_t key_len) const {
+  const uint8_t *mapping = region_.getMapping();
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  return mapping + entry.sector * FLASH_SECTOR_SIZE + entry.offset + record_header_size + key_len;
+}
+
+bool RecordLog::isFree(size_t sector) const {
+  return (int) sector != active_ && sectors_[sector].write_pos == sector_header_size;
+}
+
+size_t RecordLog::countFreeSectors() const {
+  size_t count = 0;
+  for (size_t i = 0; i < sectors_.size(); i++) {
+    if (isFree(i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+int RecordLog::findWornVictim() const {
+  uint32_t max_erase_count = 0;
+  for (auto &sector: sectors_) {
+    max_erase_count = std::max(max_erase_count, sector.erase_count);
+  }
+  int least_worn = -1;
+  for (size_t i = 0; i < sectors_.size(); i++) {
+    if ((int) i != active_ && !isFree(i) &&
+        (least_worn < 0 || sectors_[i].erase_count < sectors_[least_worn].erase_count)) {
+      least_worn = (int) i;
+    }
+  }
+  if (least_worn >= 0 && sectors_[least_worn].erase_count + RECORD_LOG_WEAR_SPREAD < max_erase_count) {
+    return least_worn;
+  }
+  return -1;
+}
+
+int RecordLog::pickVictim() const {
+  int least_live = -1;
+  for (size_t i = 0; i < sectors_.size(); i++) {
+    if ((int) i == active_ || isFree(i)) {
+      continue;
+    }
+    auto &sector = sectors_[i];
+    // Compacting only frees the space of outdated records
+    bool has_garbage = sector.live_bytes + sector_header_size < sector.write_pos;
+    if (has_garbage && (least_live < 0 || sector.live_bytes < sectors_[least_live].live_bytes)) {
+      least_live = (int) i;
+    }
+  }
+  return least_live;
+}
+
+bool RecordLog::reserveSpace(size_t bytes, bool use_reserve) {
+  if (bytes > FLASH_SECTOR_SIZE - sector_header_size) {
+    return false;
+  }
+  if (active_ >= 0 && sectors_[active_].write_pos + bytes <= FLASH_SECTOR_SIZE) {
+    return true;
+  }
+
+  for (size_t attempt = 0; attempt <= sectors_.size(); attempt++) {
+    if (countFreeSectors() > (use_reserve ? 0 : RECORD_LOG_RESERVED_SECTORS)) {
+      // Take the least worn free sector
+      int next = -1;
+      for (size_t i = 0; i < sectors_.size(); i++) {
+        if (isFree(i) && (next < 0 || sectors_[i].erase_count < sectors_[next].erase_count)) {
+          next = (int) i;
+        }
+      }
+      active_ = next;
+      return true;
+    }
+    if (use_reserve) {
+      break;
+    }
+    int victim = pickVictim();
+    if (victim < 0 || !compactSector(victim)) {
+      break;
+    }
+  }
+  LOG_TOKEN(LOG_TYPE::ERR, "The %s log is full", name_);
+  return false;
+}
+
+bool RecordLog::compactSector(size_t sector) {
+  std::vector<std::string> keys;
+  for (auto &it: index_) {
+    if (it.second.sector == sector) {
+      keys.push_back(it.first);
+    }
+  }
+
+  for (auto &key: keys) {
+    auto entry = index_[key];
+    if (entry.deleted && (entry.sectors & ~(1u << sector)) == 0) {
+      // No older record left for the tombstone to hide
+      sectors_[sector].live_bytes -= getRecordSize(key.size(), entry.value_len);
+      index_.erase(key);
+      continue;
+    }
+    std::string value;
+    if (!readValue(entry, key.size(), value) || !reserveSpace(getRecordSize(key.size(), value.size()), true) ||
+        !writeRecord(entry.deleted ? Delete : Put, false, key, value, entry.seq)) {
+      // The sector is not erased, so nothing is lost
+      LOG_TOKEN(LOG_TYPE::ERR, "Could not compact sector %d of the %s log", (int) sector, name_);
+      return false;
+    }
+  }
+
+  for (auto &it: index_) {
+    it.second.sectors &= ~(1u << sector);
+  }
+  compactions_++;
+  return formatSector(sector, sectors_[sector].erase_count + 1);
+}
+
+bool RecordLog::appendRecords(const std::vector<StagedRecord> &records) {
+  size_t size = 0;
+  for (auto &record: records) {
+    size += getRecordSize(record.key.size(), record.value.size());
+  }
+  // A batch never spans two sectors, so it is torn or complete as a whole
+  if (!reserveSpace(size, false)) {
+    return false;
+  }
+  for (size_t i = 0; i < records.size(); i++) {
+    auto &record = records[i];
+    if (!writeRecord(record.type, i + 1 < records.size(), record.key, record.value, next_seq_++)) {
+      // The index may contain parts of the torn batch
+      scan();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RecordLog::addRecord(RecordType type, const std::string &key, const std::string &value) {
+  if (key.empty() || key.size() >= 0xFF ||
+      getRecordSize(key.size(), value.size()) > FLASH_SECTOR_SIZE - sector_header_size) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Record does not fit into the %s log", name_);
+    return false;
+  }
+  if (batch_depth_ == 0) {
+    return appendRecords({{type, key, value}});
+  }
+  // Only the last write of a key in a batch counts
+  staged_.erase(std::remove_if(staged_.begin(), staged_.end(), [&key](const StagedRecord &record) {
+    return record.key == key;
+  }), staged_.end());
+  staged_.push_back({type, key, value});
+  return true;
+}
+
+bool RecordLog::lookup(const std::string &key, std::string &value) {
+  for (auto it = staged_.rbegin(); it != staged_.rend(); it++) {
+    if (it->key == key) {
+      value = it->value;
+      return it->type == Put;
+    }
+  }
+  auto it = index_.find(key);
+  if (it == index_.end() || it->second.deleted) {
+    return false;
+  }
+  return readValue(it->second, key.size(), value);
+}
+
+bool RecordLog::begin() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  unsigned long start = micros();
+  if (!region_.begin() || !scan()) {
+    return false;
+  }
+  LOG_TOKEN(LOG_TYPE::INFO, "Read %u records of the %s log in %lu us", (unsigned) index_.size(), name_, micros() - start);
+  return true;
+}
+
+bool RecordLog::put(const std::string &key, const std::string &value) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::string current;
+  if (lookup(key, current) && current == value) {
+    return true;
+  }
+  return addRecord(Put, key, value);
+}
+
+bool RecordLog::remove(const std::string &key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::string current;
+  if (!lookup(key, current)) {
+    return true;
+  }
+  return addRecord(Delete, key, "");
+}
+
+bool RecordLog::get(const std::string &key, std::string &value) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return lookup(key, value);
+}
+
+bool RecordLog::view(const std::string &key, const std::function<void(const uint8_t *data, size_t len)> &reader) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto it = staged_.rbegin(); it != staged_.rend(); it++) {
+    if (it->key == key) {
+      if (it->type != Put) {
+        return false;
+      }
+      reader((const uint8_t *) it->value.data(), it->value.size());
+      return true;
+    }
+  }
+  auto it = index_.find(key);
+  if (it == index_.end() || it->second.deleted) {
+    return false;
+  }
+  const uint8_t *mapped = getMappedValue(it->second, key.size());
+  if (mapped != nullptr) {
+    reader(mapped, it->second.value_len);
+    return true;
+  }
+  std::string value;
+  if (!readValue(it->second, key.size(), value)) {
+    return false;
+  }
+  reader((const uint8_t *) value.data(), value.size());
+  return true;
+}
+
+bool RecordLog::contains(const std::string &key) {
+  std::string value;
+  return get(key, value);
+}
+
+std::vector<std::string> RecordLog::getKeys(const std::string &prefix) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::vector<std::pair<uint32_t, std::string>> found;
+  for (auto &it: index_) {
+    if (!it.second.deleted && it.first.compare(0, prefix.size(), prefix) == 0) {
+      found.emplace_back(it.second.seq, it.first);
+    }
+  }
+  // Staged records are written after everything else
+  uint32_t staged_seq = next_seq_;
+  for (auto &record: staged_) {
+    if (record.key.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+    found.erase(std::remove_if(found.begin(), found.end(), [&record](const std::pair<uint32_t, std::string> &key) {
+      return key.second == record.key;
+    }), found.end());
+    if (record.type == Put) {
+      found.emplace_back(staged_seq++, record.key);
+    }
+  }
+  std::sort(found.begin(), found.end());
+
+  std::vector<std::string> keys;
+  for (auto &key: found) {
+    keys.push_back(key.second);
+  }
+  return keys;
+}
+
+void RecordLog::beginBatch() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  batch_depth_++;
+}
+
+bool RecordLog::commitBatch() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (batch_depth_ == 0) {
+    return false;
+  }
+  if (--batch_depth_ > 0) {
+    return !batch_failed_;
+  }
+  if (batch_failed_) {
+    batch_failed_ = false;
+    staged_.clear();
+    return false;
+  }
+  if (staged_.empty()) {
+    return true;
+  }
+  unsigned long start = micros();
+  bool success = appendRecords(staged_);
+  LOG_TOKEN(LOG_TYPE::DATA, "Committed %u records in %lu us", (unsigned) staged_.size(), micros() - start);
+  staged_.clear();
+  return success;
+}
+
+void RecordLog::abortBatch() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (batch_depth_ == 0) {
+    return;
+  }
+  if (--batch_depth_ > 0) {
+    batch_failed_ = true;
+    return;
+  }
+  batch_failed_ = false;
+  staged_.clear();
+}
+
+bool RecordLog::clear() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  staged_.clear();
+  index_.clear();
+  active_ = -1;
+  bool success = true;
+  for (size_t i = 0; i < sectors_.size(); i++) {
+    success = formatSector(i, sectors_[i].erase_count + 1) && success;
+  }
+  return success;
+}
+
+bool RecordLog::needsCompaction() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (findWornVictim() >= 0) {
+    return true;
+  }
+  return countFreeSectors() < RECORD_LOG_MIN_FREE_SECTORS && pickVictim() >= 0;
+}
+
+bool RecordLog::compact() {
+  if (!needsCompaction()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  int victim = findWornVictim();
+  if (victim < 0) {
+    victim = pickVictim();
+  }
+  return victim >= 0 && compactSector(victim);
+}
+
+size_t RecordLog::getLiveBytes() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  size_t bytes = 0;
+  for (auto &sector: sectors_) {
+    bytes += sector.live_bytes;
+  }
+  return bytes;
+}
+
+size_t RecordLog::getMaxValueSize(size_t key_len) {
+  return FLASH_SECTOR_SIZE - sector_header_size - record_header_size - key_len;
+}
+
+size_t RecordLog::getCapacity() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return sectors_.size() * (FLASH_SECTOR_SIZE - sector_header_size);
+}
+
+void RecordLog::printReport() {
+  size_t live_bytes = getLiveBytes();
+  size_t capacity = getCapacity();
+  std::lock_guard<std::mutex> guard(mutex_);
+  uint32_t min_erase_count = UINT32_MAX;
+  uint32_t max_erase_count = 0;
+  for (auto &sector: sectors_) {
+    min_erase_count = std::min(min_erase_count, sector.erase_count);
+    max_erase_count = std::max(max_erase_count, sector.erase_count);
+  }
+  if (sectors_.empty()) {
+    min_erase_count = 0;
+  }
+  logger.printfln("%s log: %u / %u bytes live, %u keys, %u / %u sectors free, erase counts %u - %u, "
+                  "%u erases and %u compactions since boot",
+                  name_,
+                  (unsigned) live_bytes,
+                  (unsigned) capacity,
+                  (unsigned) index_.size(),
+                  (unsigned) countFreeSectors(),
+                  (unsigned) sectors_.size(),
+                  min_erase_count,
+                  max_erase_count,
+                  erases_,
+                  compactions_);
+}
+
+static PartitionFlashRegion config_log_region(CONFIG_LOG_PARTITION);
+
+RecordLog config_log(config_log_region, "config");
+
+static PartitionFlashRegion state_log_region(STATE_LOG_PARTITION);
+
+RecordLog state_log(state_log_region, "state");
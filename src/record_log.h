@@ -0,0 +1,375 @@
+#pragma once
+
+#include "Arduino.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "flash_region.h"
+#include "system_settings.h"
+
+/**
+ * Append-only key/value store over a flash region.
+ * Every change is appended as a record with a sequence number, deleting appends a tombstone, so nothing is erased
+ * or rewritten in place. An index in RAM points to the newest record of every key. Sectors whose records are mostly
+ * outdated are compacted by copying their live records to the end of the log and erasing them, new sectors are taken
+ * in order of their erase count to spread the wear.
+ * Records are checksummed and the newest sequence number wins when scanning the log, so losing power at any time
+ * only loses the record or batch being written.
+ */
+class RecordLog {
+private:
+
+  /**
+   * Header of every sector
+   */
+  struct SectorHeader {
+    uint32_t magic;
+    // Times the sector was erased
+    uint32_t erase_count;
+  };
+
+  /**
+   * Header of every record, followed by the key, the value and padding to four bytes
+   */
+  struct RecordHeader {
+    // Checksum of everything following it
+    uint32_t crc;
+    uint32_t seq;
+    uint16_t value_len;
+    uint8_t key_len;
+    // RecordType, RECORD_BATCH_CONTINUES for all but the last record of a batch
+    uint8_t type;
+  };
+
+  enum RecordType : uint8_t {
+    Put = 1,
+    Delete = 2
+  };
+
+  /**
+   * State of a sector in RAM
+   */
+  struct Sector {
+    uint32_t erase_count;
+    // Offset new records are appended at, FLASH_SECTOR_SIZE if the sector is full or ends with a torn record
+    uint16_t write_pos;
+    // Bytes of the records the index points to
+    uint16_t live_bytes;
+  };
+
+  /**
+   * Newest record of a key
+   */
+  struct Entry {
+    uint32_t seq;
+    uint16_t sector;
+    // Offset of the record header in the sector
+    uint16_t offset;
+    uint16_t value_len;
+    // Whether the newest record is a tombstone
+    bool deleted;
+    // Bit i is set if sector i holds any record of the key, tombstones are dropped once no other sector does
+    uint32_t sectors;
+  };
+
+  /**
+   * Record written when the running batch is committed
+   */
+  struct StagedRecord {
+    RecordType type;
+    std::string key;
+    std::string value;
+  };
+
+  FlashRegion &region_;
+
+  // Name used for logging
+  const char *name_;
+
+  // Guards everything below
+  std::mutex mutex_;
+
+  std::vector<Sector> sectors_;
+
+  std::unordered_map<std::string, Entry> index_;
+
+  // Sector records are appended to, -1 if none was opened yet
+  int active_;
+
+  uint32_t next_seq_;
+
+  // Nesting depth of the running batch, 0 if none is running
+  uint8_t batch_depth_;
+
+  // Whether a nested batch was aborted, the outermost one is discarded when it ends
+  bool batch_failed_;
+
+  std::vector<StagedRecord> staged_;
+
+  // Sectors erased and compacted since booting
+  uint32_t erases_;
+  uint32_t compactions_;
+
+  /**
+   * @param key_len Length of the key
+   * @param value_len Length of the value
+   * @return Bytes the record uses in flash
+   */
+  static size_t getRecordSize(size_t key_len, size_t value_len);
+
+  /**
+   * Erases a sector and writes its header
+   * @param sector Index of the sector
+   * @param erase_count New erase count of the sector
+   * @return Whether formatting was successful
+   */
+  bool formatSector(size_t sector, uint32_t erase_count);
+
+  /**
+   * Reads all records of a sector into the index. Batches are only applied once their last record was read.
+   * @param sector Index of the sector
+   * @param data Content of the sector
+   * @param max_seq [out] Highest sequence number found in the sector
+   */
+  void scanSector(size_t sector, const uint8_t *data, uint32_t &max_seq);
+
+  /**
+   * Reads the whole log into the index
+   * @return Whether the log could be read
+   */
+  bool scan();
+
+  /**
+   * Points the index to a record if it is the newest one of its key
+   * @param key Key of the record
+   * @param header Header of the record
+   * @param sector Sector the record is stored in
+   * @param offset Offset of the record in the sector
+   * @param replace_equal Whether a record with the same sequence number replaces the indexed one
+   */
+  void applyRecord(const std::string &key, const RecordHeader &header, size_t sector, size_t offset,
+                   bool replace_equal);
+
+  /**
+   * Writes a record to the end of the active sector, which has to have room for it
+   * @param type Type of the record
+   * @param batch_continues Whether further records of the same batch follow
+   * @param key Key of the record
+   * @param value Value of the record
+   * @param seq Sequence number of the record
+   * @return Whether writing was successful
+   */
+  bool writeRecord(RecordType type, bool batch_continues, const std::string &key, const std::string &value,
+                   uint32_t seq);
+
+  /**
+   * Reads the value of an indexed record
+   * @param entry Index entry of the record
+   * @param key_len Length of the key
+   * @param value [out] The value
+   * @return Whether reading was successful
+   */
+  bool readValue(const Entry &entry, size_t key_len, std::string &value);
+
+  /**
+   * @param entry Index entry of a record
+   * @param key_len Length of the key
+   * @return The value of the record in the mapped region, nullptr if the region is not mapped
+   */
+  const uint8_t *getMappedValue(const Entry &entry, size_t key_len) const;
+
+  /**
+   * @param sector Index of the sector
+   * @return Whether a sector is erased and not in use
+   */
+  bool isFree(size_t sector) const;
+
+  /**
+   * @return Number of free sectors
+   */
+  size_t countFreeSectors() const;
+
+  /**
+   * Finds a sector falling more than RECORD_LOG_WEAR_SPREAD erases behind the most worn one.
+   * Such sectors hold records that are never changed, compacting them moves those to a more worn sector.
+   * @return Index of the sector or -1 if there is none
+   */
+  int findWornVictim() const;
+
+  /**
+   * Selects the sector freeing the most space when compacted
+   * @return Index of the sector or -1 if no sector would free any space
+   */
+  int pickVictim() const;
+
+  /**
+   * Makes sure the active sector has room for a number of bytes, opening and compacting sectors as needed
+   * @param bytes Bytes to write
+   * @param use_reserve Whether the sectors reserved for compaction may be used
+   * @return Whether there is enough room
+   */
+  bool reserveSpace(size_t bytes, bool use_reserve);
+
+  /**
+   * Copies the live records of a sector to the end of the log and erases it
+   * @param sector Index of the sector
+   * @return Whether compacting was successful
+   */
+  bool compactSector(size_t sector);
+
+  /**
+   * Writes records as one batch, which is applied completely or not at all after losing power
+   * @param records The records
+   * @return Whether writing was successful
+   */
+  bool appendRecords(const std::vector<StagedRecord> &records);
+
+  /**
+   * Writes a record right away or stages it if a batch is running
+   * @param type Type of the record
+   * @param key Key of the record
+   * @param value Value of the record
+   * @return Whether writing was successful
+   */
+  bool addRecord(RecordType type, const std::string &key, const std::string &value);
+
+  /**
+   * Looks up a key in the staged records and the index
+   * @param key The key
+   * @param value [out] The value
+   * @return Whether the key has a value
+   */
+  bool lookup(const std::string &key, std::string &value);
+
+public:
+  /**
+   * @param region Flash region to store the log in
+   * @param name Name of the log used for logging
+   */
+  RecordLog(FlashRegion &region, const char *name);
+
+  /**
+   * Continues a crc32 checksum
+   * @param crc Checksum of the previous data
+   * @param data Data to add
+   * @param len Length of the data
+   * @return The checksum
+   */
+  static uint32_t updateCrc(uint32_t crc, const uint8_t *data, size_t len);
+
+  /**
+   * Reads the log into the index, formats all sectors that were never used
+   * @return Whether the log is usable
+   */
+  bool begin();
+
+  /**
+   * Stores a value, nothing is written if the key already has the same value
+   * @param key The key, 1 to 254 bytes
+   * @param value The value, has to fit into a sector
+   * @return Whether storing was successful
+   */
+  bool put(const std::string &key, const std::string &value);
+
+  /**
+   * Deletes a key by writing a tombstone
+   * @param key The key
+   * @return Whether deleting was successful
+   */
+  bool remove(const std::string &key);
+
+  /**
+   * Reads a value, staged writes of the running batch included
+   * @param key The key
+   * @param value [out] The value
+   * @return Whether the key has a value
+   */
+  bool get(const std::string &key, std::string &value);
+
+  /**
+   * Passes a value to a reader without copying it if the region is mapped.
+   * The log is locked while the reader runs, it must not access the log itself.
+   * @param key The key
+   * @param reader Called with the value, which is only valid during the call
+   * @return Whether the key has a value
+   */
+  bool view(const std::string &key, const std::function<void(const uint8_t *data, size_t len)> &reader);
+
+  /**
+   * @param key The key
+   * @return Whether the key has a value
+   */
+  bool contains(const std::string &key);
+
+  /**
+   * Collects the keys starting with a prefix
+   * @param prefix The prefix
+   * @return The keys in the order they were last written in
+   */
+  std::vector<std::string> getKeys(const std::string &prefix);
+
+  /**
+   * Begins a batch. Writes are staged in RAM until the outermost batch is committed. Batches can be nested.
+   */
+  void beginBatch();
+
+  /**
+   * Ends a batch. Ending the outermost one writes all staged records, which are applied completely or not at all.
+   * If a nested batch was aborted, the outermost one discards all staged records instead.
+   * @return Whether committing was successful, false if a nested batch was aborted
+   */
+  bool commitBatch();
+
+  /**
+   * Aborts a batch. Aborting the outermost one discards all staged records, aborting a nested one marks the
+   * outermost one as failed. Writes keep being staged until the outermost batch ends.
+   */
+  void abortBatch();
+
+  /**
+   * Erases the whole log
+   * @return Whether erasing was successful
+   */
+  bool clear();
+
+  /**
+   * @return Whether there are few free sectors left or a sector should be compacted to spread the wear
+   */
+  bool needsCompaction();
+
+  /**
+   * Compacts a single sector if needed, meant to be called whenever the system is idle
+   * @return Whether a sector was compacted
+   */
+  bool compact();
+
+  /**
+   * @param key_len Length of the key
+   * @return Largest value that can be stored for a key of the length
+   */
+  static size_t getMaxValueSize(size_t key_len);
+
+  /**
+   * @return Bytes of the records the index points to
+   */
+  size_t getLiveBytes();
+
+  /**
+   * @return Bytes the log can store
+   */
+  size_t getCapacity();
+
+  /**
+   * Prints the usage and wear of the log
+   */
+  void printReport();
+};
+
+extern RecordLog config_log;
+
+extern RecordLog state_log;
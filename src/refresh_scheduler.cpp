@@ -0,0 +1,112 @@
+#include "refresh_scheduler.h"
+#include "heap_tracer.h"
+
+#include <algorithm>
+#include <climits>
+
+RefreshScheduler::RefreshScheduler() :
+    gadget_overruns_(0),
+    budget_overruns_(0),
+    deferred_refreshes_(0),
+    worst_overrun_(0),
+    last_report_(0) {}
+
+void RefreshScheduler::addGadget(const std::shared_ptr<SH_Gadget> &gadget) {
+  if (gadget == nullptr) {
+    return;
+  }
+  gadgets_.push_back({gadget, std::max(gadget->getRefreshInterval(), 1UL), gadget->getRefreshCost(), millis()});
+  due_.reserve(gadgets_.size());
+}
+
+void RefreshScheduler::refresh() {
+  HeapScope heap_scope(HeapTag::Gadgets);
+  unsigned long now = millis();
+
+  due_.clear();
+  for (size_t i = 0; i < gadgets_.size(); i++) {
+    auto &entry = gadgets_[i];
+    if (entry.gadget->takeRefreshRequest() ||
+        entry.gadget->hasPendingCommands() ||
+        entry.gadget->hasPendingInput()) {
+      entry.next_due = now;
+    }
+    if ((long) (now - entry.next_due) >= 0) {
+      due_.push_back(i);
+    }
+  }
+
+  // Most overdue first, so postponed gadgets are not postponed again
+  std::sort(due_.begin(), due_.end(), [this](size_t a, size_t b) {
+    return (long) (gadgets_[a].next_due - gadgets_[b].next_due) < 0;
+  });
+
+  unsigned long used = 0;
+  unsigned long planned = 0;
+  bool has_run = false;
+  for (auto index: due_) {
+    auto &entry = gadgets_[index];
+    if (has_run && used + entry.cost > GADGET_REFRESH_BUDGET_US) {
+      deferred_refreshes_++;
+      continue;
+    }
+
+    int64_t start = esp_timer_get_time();
+    entry.gadget->applyCommands();
+    entry.gadget->refresh();
+    auto duration = (unsigned long) (esp_timer_get_time() - start);
+    entry.interval = std::max(entry.gadget->getRefreshInterval(), 1UL);
+    entry.next_due = millis() + entry.interval;
+
+    used += duration;
+    planned += entry.cost;
+    has_run = true;
+    if (duration > entry.cost) {
+      gadget_overruns_++;
+      if (duration > worst_overrun_) {
+        worst_overrun_ = duration;
+        worst_overrun_gadget_ = entry.gadget->getName();
+      }
+    }
+  }
+  // A single gadget declaring a higher cost than the budget is expected to exceed it
+  if (used > std::max((unsigned long) GADGET_REFRESH_BUDGET_US, planned)) {
+    budget_overruns_++;
+  }
+
+  reportOverruns(now);
+}
+
+void RefreshScheduler::reportOverruns(unsigned long now) {
+  if (now - last_report_ < GADGET_REFRESH_REPORT_INTERVAL_MS) {
+    return;
+  }
+  if (gadget_overruns_ > 0 || budget_overruns_ > 0) {
+    logger.printfln(LOG_TYPE::WARN,
+                    "Gadget refresh overruns: %lu over cost (worst: '%s' with %lu us), %lu over budget, %lu deferred",
+                    gadget_overruns_,
+                    worst_overrun_gadget_.c_str(),
+                    worst_overrun_,
+                    budget_overruns_,
+                    deferred_refreshes_);
+  }
+  gadget_overruns_ = 0;
+  budget_overruns_ = 0;
+  deferred_refreshes_ = 0;
+  worst_overrun_ = 0;
+  worst_overrun_gadget_.clear();
+  last_report_ = now;
+}
+
+unsigned long RefreshScheduler::getTimeUntilNextRefresh() const {
+  unsigned long now = millis();
+  unsigned long wait = ULONG_MAX;
+  for (auto &entry: gadgets_) {
+    long remaining = (long) (entry.next_due - now);
+    if (remaining <= 0) {
+      return 0;
+    }
+    wait = std::min(wait, (unsigned long) remaining);
+  }
+  return wait;
+}
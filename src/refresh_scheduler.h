@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gadgets/sh_gadget.h"
+#include "system_settings.h"
+
+/**
+ * Refreshes the gadgets in the interval each of them needs.
+ * Every run only refreshes due gadgets as long as their declared cost fits into the time budget,
+ * gadgets that do not fit are refreshed in the next run. The most overdue gadget always runs.
+ * Refreshes (including applying queued commands) taking longer than declared and runs exceeding the budget are counted and reported as warnings.
+ */
+class RefreshScheduler {
+private:
+
+  /**
+   * A gadget and its refresh schedule
+   */
+  struct ScheduledGadget {
+    std::shared_ptr<SH_Gadget> gadget;
+    // Time between two refreshes in ms, updated after every refresh
+    unsigned long interval;
+    // Declared worst-case time of a refresh in us
+    unsigned long cost;
+    // Timestamp the next refresh is due at
+    unsigned long next_due;
+  };
+
+  std::vector<ScheduledGadget> gadgets_;
+
+  // Indexes of the gadgets due in the current run, kept to avoid allocating every run
+  std::vector<size_t> due_;
+
+  // Refreshes that took longer than declared since the last report
+  unsigned long gadget_overruns_;
+
+  // Runs that exceeded the time budget since the last report
+  unsigned long budget_overruns_;
+
+  // Refreshes postponed to the next run because they did not fit into the budget since the last report
+  unsigned long deferred_refreshes_;
+
+  // Longest refresh time exceeding its declared cost since the last report and the gadget it belongs to
+  unsigned long worst_overrun_;
+  std::string worst_overrun_gadget_;
+
+  // Timestamp of the last overrun report
+  unsigned long last_report_;
+
+  /**
+   * Logs a warning with the overruns since the last report if there are any
+   * @param now The current timestamp
+   */
+  void reportOverruns(unsigned long now);
+
+public:
+  RefreshScheduler();
+
+  /**
+   * Adds a gadget to the schedule, it is refreshed in the next run
+   * @param gadget The gadget
+   */
+  void addGadget(const std::shared_ptr<SH_Gadget> &gadget);
+
+  /**
+   * Refreshes all due gadgets within the time budget.
+   * Gadgets that requested a refresh or have pending commands or input are due right away.
+   * Queued commands are applied right before the refresh, so the scheduling task is the only one changing gadgets.
+   */
+  void refresh();
+
+  /**
+   * @return Time in ms until the next gadget is due, 0 if one is due already
+   */
+  unsigned long getTimeUntilNextRefresh() const;
+};
@@ -0,0 +1,291 @@
+#include "rtc_retention.h"
+#include "record_log.h"
+#include "system_timer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+#include "esp_system.h"
+#include "esp32/clk.h"
+
+// "SHRT"
+#define RTC_RETENTION_MAGIC 0x53485254
+
+/**
+ * A retained characteristic value
+ */
+struct RetainedValue {
+  uint32_t gadget_hash;
+  int32_t value;
+  uint8_t characteristic;
+};
+
+/**
+ * Layout of the retained state in RTC slow memory
+ */
+struct RetainedState {
+  uint32_t magic;
+  // Checksum of everything from runtime_id up to outbox_crc
+  uint32_t crc;
+  int32_t runtime_id;
+  int32_t drift_ppb;
+  // System time minus the RTC counter
+  int64_t time_offset_us;
+  uint8_t has_runtime_id;
+  uint8_t has_time;
+  uint8_t value_count;
+  // Ordered by their last change
+  RetainedValue values[RTC_RETAINED_VALUES];
+  // Checksum of outbox_len and the outbox, only written when rebooting
+  uint32_t outbox_crc;
+  uint16_t outbox_len;
+  uint8_t outbox[RTC_RETAINED_OUTBOX_SIZE];
+};
+
+static RTC_NOINIT_ATTR RetainedState retained_state;
+
+static const size_t state_crc_start = offsetof(RetainedState, runtime_id);
+static const size_t state_crc_end = offsetof(RetainedState, outbox_crc);
+static const size_t outbox_crc_start = offsetof(RetainedState, outbox_len);
+
+/**
+ * @return Checksum of the retained state
+ */
+static uint32_t getStateCrc() {
+  return RecordLog::updateCrc(0, (const uint8_t *) &retained_state + state_crc_start, state_crc_end - state_crc_start);
+}
+
+/**
+ * @return Checksum of the retained outbox
+ */
+static uint32_t getOutboxCrc() {
+  size_t len = std::min((size_t) retained_state.outbox_len, (size_t) RTC_RETAINED_OUTBOX_SIZE);
+  return RecordLog::updateCrc(0, (const uint8_t *) &retained_state + outbox_crc_start,
+                              offsetof(RetainedState, outbox) - outbox_crc_start + len);
+}
+
+RtcRetention::RtcRetention() :
+    restored_(false) {}
+
+void RtcRetention::seal() {
+  retained_state.crc = getStateCrc();
+}
+
+uint32_t RtcRetention::hashName(const std::string &gadget) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (char c: gadget) {
+    hash = (hash ^ (uint8_t) c) * 16777619u;
+  }
+  return hash;
+}
+
+bool RtcRetention::begin() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  // Powering up and brownouts clear the RTC counter, the memory content is random then
+  auto reason = esp_reset_reason();
+  bool reset_kept_rtc = reason == ESP_RST_SW || reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+                        reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT;
+  restored_ = reset_kept_rtc && retained_state.magic == RTC_RETENTION_MAGIC &&
+              retained_state.value_count <= RTC_RETAINED_VALUES && retained_state.crc == getStateCrc();
+  if (!restored_) {
+    memset(&retained_state, 0, sizeof(retained_state));
+    retained_state.magic = RTC_RETENTION_MAGIC;
+    retained_state.outbox_crc = getOutboxCrc();
+    seal();
+  }
+  return restored_;
+}
+
+bool RtcRetention::isRestored() const {
+  return restored_;
+}
+
+bool RtcRetention::getRuntimeId(int &runtime_id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!restored_ || !retained_state.has_runtime_id) {
+    return false;
+  }
+  runtime_id = retained_state.runtime_id;
+  return true;
+}
+
+void RtcRetention::setRuntimeId(int runtime_id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  retained_state.runtime_id = runtime_id;
+  retained_state.has_runtime_id = true;
+  seal();
+}
+
+void RtcRetention::saveTime() {
+  if (!system_timer.isSet()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  retained_state.time_offset_us = system_timer.getTimeMicros() - (int64_t) esp_clk_rtc_time();
+  retained_state.drift_ppb = system_timer.getDrift();
+  retained_state.has_time = true;
+  seal();
+}
+
+bool RtcRetention::restoreTime() {
+  int64_t system_us;
+  int32_t drift_ppb;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!restored_ || !retained_state.has_time) {
+      return false;
+    }
+    system_us = (int64_t) esp_clk_rtc_time() + retained_state.time_offset_us;
+    drift_ppb = retained_state.drift_ppb;
+  }
+  system_timer.restoreTime(system_us, drift_ppb);
+  return true;
+}
+
+void RtcRetention::recordValue(const std::string &gadget, CharacteristicIdentifier characteristic, int value) {
+  uint32_t hash = hashName(gadget);
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto &state = retained_state;
+
+  // Remove the previous value of the characteristic, or the oldest one if full
+  uint8_t remove_index = state.value_count;
+  for (uint8_t i = 0; i < state.value_count; i++) {
+    if (state.values[i].gadget_hash == hash && state.values[i].characteristic == (uint8_t) characteristic) {
+      remove_index = i;
+      break;
+    }
+  }
+  if (remove_index == state.value_count && state.value_count == RTC_RETAINED_VALUES) {
+    remove_index = 0;
+  }
+  if (remove_index < state.value_count) {
+    memmove(&state.values[remove_index], &state.values[remove_index + 1],
+            (state.value_count - remove_index - 1) * sizeof(RetainedValue));
+    state.value_count--;
+  }
+
+  state.values[state.value_count] = {hash, value, (uint8_t) characteristic};
+  state.value_count++;
+  seal();
+}
+
+int RtcRetention::restoreValues(const std::vector<std::string> &gadget_names,
+                                const std::function<void(const std::string &gadget,
+                                                         CharacteristicIdentifier characteristic,
+                                                         int value)> &apply) {
+  std::vector<RetainedValue> values;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!restored_) {
+      return 0;
+    }
+    values.assign(retained_state.values, retained_state.values + retained_state.value_count);
+  }
+
+  std::unordered_map<uint32_t, const std::string *> names;
+  for (auto &name: gadget_names) {
+    names[hashName(name)] = &name;
+  }
+
+  // Applying a value records it again, so the mutex must not be held here
+  int restored = 0;
+  for (auto &value: values) {
+    auto it = names.find(value.gadget_hash);
+    if (it != names.end()) {
+      apply(*it->second, (CharacteristicIdentifier) value.characteristic, value.value);
+      restored++;
+    }
+  }
+  return restored;
+}
+
+int RtcRetention::saveOutbox(const std::vector<std::shared_ptr<Request>> &requests) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto &state = retained_state;
+  size_t len = 0;
+  int saved = 0;
+
+  // Every request: path, sender and receiver prefixed by their length, the session id and the MessagePack payload
+  for (auto &request: requests) {
+    std::string payload;
+    serializeMsgPack(request->getPayload(), payload);
+    std::string path = request->getPath().substr(0, 0xFF);
+    std::string sender = request->getSender().substr(0, 0xFF);
+    std::string receiver = request->getReceiver().substr(0, 0xFF);
+    size_t size = 3 + path.size() + sender.size() + receiver.size() + sizeof(int32_t) + 2 + payload.size();
+    if (len + size > RTC_RETAINED_OUTBOX_SIZE || payload.size() > 0xFFFF) {
+      break;
+    }
+    uint8_t *out = state.outbox + len;
+    for (auto field: {&path, &sender, &receiver}) {
+      *out++ = (uint8_t) field->size();
+      memcpy(out, field->data(), field->size());
+      out += field->size();
+    }
+    int32_t session_id = request->getID();
+    memcpy(out, &session_id, sizeof(session_id));
+    out += sizeof(session_id);
+    *out++ = (uint8_t) (payload.size() >> 8);
+    *out++ = (uint8_t) (payload.size() & 0xFF);
+    memcpy(out, payload.data(), payload.size());
+    len += size;
+    saved++;
+  }
+
+  state.outbox_len = len;
+  state.outbox_crc = getOutboxCrc();
+  return saved;
+}
+
+std::vector<std::shared_ptr<Request>> RtcRetention::takeOutbox() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto &state = retained_state;
+  std::vector<std::shared_ptr<Request>> requests;
+  if (!restored_ || state.outbox_len > RTC_RETAINED_OUTBOX_SIZE || state.outbox_crc != getOutboxCrc()) {
+    return requests;
+  }
+
+  const uint8_t *data = state.outbox;
+  size_t len = state.outbox_len;
+  size_t pos = 0;
+  while (pos < len) {
+    std::string fields[3];
+    bool complete = true;
+    for (auto &field: fields) {
+      if (pos >= len || pos + 1 + data[pos] > len) {
+        complete = false;
+        break;
+      }
+      field.assign((const char *) data + pos + 1, data[pos]);
+      pos += 1 + data[pos];
+    }
+    if (!complete || pos + sizeof(int32_t) + 2 > len) {
+      break;
+    }
+    int32_t session_id;
+    memcpy(&session_id, data + pos, sizeof(session_id));
+    pos += sizeof(session_id);
+    size_t payload_len = (data[pos] << 8) | data[pos + 1];
+    pos += 2;
+    if (pos + payload_len > len) {
+      break;
+    }
+    // Every MessagePack byte may become a variant slot, only keep what is used
+    DynamicJsonDocument payload(payload_len * 16 + 64);
+    if (deserializeMsgPack(payload, (const char *) data + pos, payload_len) != DeserializationError::Ok) {
+      break;
+    }
+    payload.shrinkToFit();
+    pos += payload_len;
+    requests.push_back(std::make_shared<Request>(fields[0], session_id, fields[1], fields[2], payload));
+  }
+
+  // Every request is only sent once
+  state.outbox_len = 0;
+  state.outbox_crc = getOutboxCrc();
+  return requests;
+}
+
+RtcRetention rtc_retention;
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Arduino.h"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "system_settings.h"
+#include "gadgets/gadget_enums.h"
+#include "connectors/request.h"
+
+/**
+ * Runtime state kept in RTC slow memory, which keeps its content over software and watchdog resets.
+ * The state is written whenever it changes and protected by a checksum, so a reset at any time either keeps the
+ * complete state or none of it. Only restored after resets keeping the RTC memory and counter.
+ */
+class RtcRetention {
+private:
+  // Guards the retained state
+  std::mutex mutex_;
+
+  // Whether the state was retained over the last reset
+  bool restored_;
+
+  /**
+   * Updates the checksum after changing the retained state, the caller has to hold the mutex
+   */
+  void seal();
+
+  /**
+   * @param gadget Name of the gadget
+   * @return Hash identifying the gadget in the retained values
+   */
+  static uint32_t hashName(const std::string &gadget);
+
+public:
+  RtcRetention();
+
+  /**
+   * Checks the retained state, clears it if it did not survive the reset.
+   * Call it first thing after booting, before anything changes the state.
+   * @return Whether the state was retained over the last reset
+   */
+  bool begin();
+
+  /**
+   * @return Whether the state was retained over the last reset
+   */
+  bool isRestored() const;
+
+  /**
+   * @param runtime_id [out] The runtime id before the reset
+   * @return Whether there was a retained runtime id
+   */
+  bool getRuntimeId(int &runtime_id);
+
+  /**
+   * @param runtime_id The runtime id to retain
+   */
+  void setRuntimeId(int runtime_id);
+
+  /**
+   * Retains the current system time relative to the RTC counter, which keeps counting during the reset
+   */
+  void saveTime();
+
+  /**
+   * Sets the system time to the retained one plus the time passed since
+   * @return Whether there was a retained time
+   */
+  bool restoreTime();
+
+  /**
+   * Retains a changed characteristic value
+   * @param gadget Name of the gadget
+   * @param characteristic The changed characteristic
+   * @param value The new value
+   */
+  void recordValue(const std::string &gadget, CharacteristicIdentifier characteristic, int value);
+
+  /**
+   * Passes the retained values of the known gadgets to a callback in the order they were changed in
+   * @param gadget_names Names of the existing gadgets
+   * @param apply Called for every value
+   * @return Number of restored values
+   */
+  int restoreValues(const std::vector<std::string> &gadget_names,
+                    const std::function<void(const std::string &gadget, CharacteristicIdentifier characteristic,
+                                             int value)> &apply);
+
+  /**
+   * Retains requests that were not sent yet, as many as fit into RTC_RETAINED_OUTBOX_SIZE
+   * @param requests The requests, oldest first
+   * @return Number of retained requests
+   */
+  int saveOutbox(const std::vector<std::shared_ptr<Request>> &requests);
+
+  /**
+   * Takes the requests retained over the last reset
+   * @return The requests, oldest first
+   */
+  std::vector<std::shared_ptr<Request>> takeOutbox();
+};
+
+extern RtcRetention rtc_retention;
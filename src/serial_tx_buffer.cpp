@@ -0,0 +1,87 @@
+#include "serial_tx_buffer.h"
+
+SerialTxBuffer::SerialTxBuffer() :
+    ring_buffer_(nullptr),
+    drain_task_(nullptr),
+    dropped_messages_(0),
+    dropped_bytes_(0) {}
+
+[[noreturn]] void SerialTxBuffer::drainTask(void *args) {
+  auto buffer = (SerialTxBuffer *) args;
+  unsigned long reported_drops = 0;
+  while (true) {
+    buffer->drain(portMAX_DELAY);
+
+    // Report drops as soon as there is space on the line again
+    auto drops = buffer->getDroppedMessages();
+    if (drops != reported_drops) {
+      Serial.printf("[serial_tx] dropped %lu messages (%lu bytes)\n", drops, buffer->getDroppedBytes());
+      reported_drops = drops;
+    }
+  }
+}
+
+void SerialTxBuffer::drain(TickType_t wait_ticks) {
+  size_t item_size = 0;
+  auto item = (uint8_t *) xRingbufferReceiveUpTo(ring_buffer_, &item_size, wait_ticks, SERIAL_TX_CHUNK_SIZE);
+  while (item != nullptr) {
+    Serial.write(item, item_size);
+    vRingbufferReturnItem(ring_buffer_, item);
+    item = (uint8_t *) xRingbufferReceiveUpTo(ring_buffer_, &item_size, 0, SERIAL_TX_CHUNK_SIZE);
+  }
+}
+
+bool SerialTxBuffer::begin() {
+  ring_buffer_ = xRingbufferCreate(SERIAL_TX_BUFFER_SIZE, RINGBUF_TYPE_BYTEBUF);
+  if (ring_buffer_ == nullptr) {
+    return false;
+  }
+
+  xTaskCreatePinnedToCore(
+      drainTask,                        /* Task function. */
+      "Smarthome_SerialTX",     /* String with name of task. */
+      SERIAL_TX_TASK_STACK,     /* Stack size in words. */
+      this,                 /* Parameter passed as input of the task */
+      SERIAL_TX_TASK_PRIORITY, /* Priority of the task. */
+      &drain_task_,                     /* Task handle. */
+      SERIAL_TX_TASK_CORE);     /* Core to run on */
+  return true;
+}
+
+bool SerialTxBuffer::write(const char *data, size_t len) {
+  if (len == 0) {
+    return true;
+  }
+
+  // Write directly as long as there is no drain task
+  if (ring_buffer_ == nullptr) {
+    Serial.write((const uint8_t *) data, len);
+    return true;
+  }
+
+  if (xRingbufferSend(ring_buffer_, data, len, SERIAL_TX_MAX_WAIT_MS / portTICK_PERIOD_MS) == pdTRUE) {
+    return true;
+  }
+
+  dropped_messages_++;
+  dropped_bytes_ += len;
+  return false;
+}
+
+bool SerialTxBuffer::write(const std::string &data) {
+  return write(data.c_str(), data.size());
+}
+
+bool SerialTxBuffer::write(char c) {
+  return write(&c, 1);
+}
+
+unsigned long SerialTxBuffer::getDroppedMessages() const {
+  return dropped_messages_;
+}
+
+unsigned long SerialTxBuffer::getDroppedBytes() const {
+  return dropped_bytes_;
+}
+
+SerialTxBuffer serial_tx;
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Arduino.h"
+#include "freertos/ringbuf.h"
+#include <string>
+#include <atomic>
+#include "system_settings.h"
+
+/**
+ * Buffers outgoing serial data in a ring buffer that is drained to the uart by a low priority task.
+ * Writers only wait a bounded amount of time for free space and drop their message if there is none.
+ */
+class SerialTxBuffer {
+private:
+
+  // Ring buffer containing the bytes waiting to be sent
+  RingbufHandle_t ring_buffer_;
+
+  // Task writing the buffered bytes to the uart
+  TaskHandle_t drain_task_;
+
+  // Count of messages that were dropped because the buffer was full
+  std::atomic<unsigned long> dropped_messages_;
+
+  // Count of bytes that were dropped because the buffer was full
+  std::atomic<unsigned long> dropped_bytes_;
+
+  /**
+   * Function for the drain task writing the buffered data to the uart
+   * @param args Pointer to the SerialTxBuffer to drain
+   */
+  [[noreturn]] static void drainTask(void *args);
+
+  /**
+   * Drains everything currently stored in the ring buffer
+   * @param wait_ticks Ticks to wait for the first data to arrive
+   */
+  void drain(TickType_t wait_ticks);
+
+public:
+  SerialTxBuffer();
+
+  /**
+   * Creates the ring buffer and starts the drain task.
+   * Everything written before is sent directly.
+   * @return Whether the buffer was successfully created
+   */
+  bool begin();
+
+  /**
+   * Adds data to the buffer. Waits at most SERIAL_TX_MAX_WAIT_MS for free space.
+   * @param data Data to send
+   * @param len Length of the data
+   * @return Whether the data was buffered (false if it was dropped)
+   */
+  bool write(const char *data, size_t len);
+
+  /**
+   * Adds a string to the buffer
+   * @param data The string to send
+   * @return Whether the data was buffered (false if it was dropped)
+   */
+  bool write(const std::string &data);
+
+  /**
+   * Adds a single char to the buffer
+   * @param c The char to send
+   * @return Whether the char was buffered (false if it was dropped)
+   */
+  bool write(char c);
+
+  /**
+   * @return The count of messages dropped since launch
+   */
+  unsigned long getDroppedMessages() const;
+
+  /**
+   * @return The count of bytes dropped since launch
+   */
+  unsigned long getDroppedBytes() const;
+};
+
+extern SerialTxBuffer serial_tx;
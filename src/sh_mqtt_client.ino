@@ -24,6 +24,13 @@
 
 // Tools
 #include "console_logger.h"
+#include "serial_tx_buffer.h"
+#include "log_shipper.h"
+#include "timer_wheel.h"
+#include "gadget_executor.h"
+#include "gpio_input.h"
+#include "task_profiler.h"
+#include "heap_tracer.h"
 #include "system_timer.h"
 #include "boot_mode.h"
 #include "static_info.h"
@@ -36,6 +43,9 @@
 
 #include "gadget_collection.h"
 #include "system_storage.h"
+#include "record_log.h"
+#include "state_journal.h"
+#include "rtc_retention.h"
 
 #include "pin_profile.h"
 #include "color.h"
@@ -47,32 +57,13 @@
 
 // External imports
 #include <cstdlib>
+#include <mutex>
 #include "ArduinoJson.h"
 
 //endregion
 
 //region STATIC METHODS
 
-/**
- * Reboots the chip and prints out the given message
- * @param reason The reason to print to the terminal
- */
-static void rebootChip(const std::string &reason) {
-  if (!reason.empty()) {
-    logger.print("Rebooting Chip because: '");
-    logger.print(reason);
-    logger.print("' in ");
-  } else {
-    logger.println("Rebooting Chip in ");
-  }
-  for (byte k = 0; k < 5; k++) {
-    logger.print(5 - k);
-    logger.print(" ");
-    delay(1000);
-  }
-  ESP.restart();
-}
-
 /**
  * Method to check if request payload contains all of the selected keys. respondes a false ack if any of them misses
  * @param req Request to ckeck payload off
@@ -84,7 +75,7 @@ static bool checkPayloadForKeys(std::shared_ptr<Request>req, const std::vector<s
 
   for (const auto &key: key_list) {
     if (!json_body.containsKey(key)) {
-      logger.printfln(LOG_TYPE::ERR, "'%s' missing in request", key.c_str());
+      LOG_TOKEN(LOG_TYPE::ERR, "'%s' missing in request", key.c_str());
       std::stringstream sstr;
       sstr << "Key missing in payload: '" << key << "'." << std::endl;
       req->respond(false, sstr.str());
@@ -98,9 +89,12 @@ static bool checkPayloadForKeys(std::shared_ptr<Request>req, const std::vector<s
 
 //region GLOBAL VARIABLES
 
-// Name of the client to be identified in the network
+// Name of the client to be identified in the network, use getClientID() and setClientID()
 std::string client_id_;
 
+// Guards getClientID(), which is changed by config writes on the system worker and read by every task
+std::mutex client_id_mutex_;
+
 // Runtime id, number generated at startup to identify reboots to network partners
 int runtime_id_;
 
@@ -128,23 +122,50 @@ CodeCommandBuffer codes;
 // Whether eepro was successfully initialized
 bool eeprom_active_;
 
-// Main task, handling all of the gadgets and the main system
+// Main task, handling requests and codes
 TaskHandle_t main_task;
 
 // Network task, receiving and sending requests via the network gadget
 TaskHandle_t network_task;
 
-// Heartbeat task, sending a heartbeat request every 5 seconds
-TaskHandle_t heartbeat_task;
+// System worker task, handling the system requests accessing the storage
+TaskHandle_t system_worker_task = nullptr;
+
+// Requests waiting for the system worker
+QueueHandle_t system_worker_queue = nullptr;
+
+// Requests handled since the last heartbeat and the sum and max of their latency (creation until handled) in us
+std::atomic<unsigned long> request_latency_count_(0);
+std::atomic<unsigned long> request_latency_sum_(0);
+std::atomic<unsigned long> request_latency_max_(0);
+
+// Time sync measurements left to send in the current sync round
+std::atomic<byte> time_sync_samples_left_(TIME_SYNC_SAMPLES);
 
-// Whether gadget updates are locked or not (prevents gadget from sending an
-// update to the bridge which it has just received from the bridge)
-bool lock_gadget_updates = false;
+// Timestamp the last time sync measurement was sent at
+std::atomic<unsigned long> last_time_sync_(0);
 
 //endregion
 
 // region CONFIG HELPER METHODS
 
+/**
+ * @return The name of the client to be identified in the network
+ */
+std::string getClientID() {
+  std::lock_guard<std::mutex> guard(client_id_mutex_);
+  return client_id_;
+}
+
+/**
+ * Sets the name of the client to be identified in the network
+ * @param client_id The new name
+ */
+void setClientID(const std::string &client_id) {
+  std::lock_guard<std::mutex> guard(client_id_mutex_);
+  client_id_ = client_id;
+}
+
 /**
  * Reads the gadget with the selected index
  * @param index index of the gadget to load
@@ -268,15 +289,12 @@ WriteGadgetStatus writeGadget(DynamicJsonDocument json_body) {
  * @return whether writing was successful
  */
 bool writeConfigParam(const std::string& param_name, const std::string& param_val, uint8_t param_val_uint) {
-  logger.printfln("Write param '%s'", param_name.c_str());
+  LOG_TOKEN(LOG_TYPE::INFO, "Write param '%s'", param_name.c_str());
   bool write_successful = false;
 
   // write ID
   if (param_name == "id") {
     write_successful = System_Storage::writeID(param_val);
-    if (write_successful) {
-      client_id_ = param_val;
-    }
   }
 
     // Write Wifi SSID
@@ -380,10 +398,10 @@ bool writeConfigParam(const std::string& param_name, const std::string& param_va
  * @return Whether writing was successful
  */
 bool writeConfig(DynamicJsonDocument config) {
-  logger.println("Writing config");
+  LOG_TOKEN(LOG_TYPE::INFO, "Writing config");
   logger.incIndent();
 
-  logger.println("Writing system preferences");
+  LOG_TOKEN(LOG_TYPE::INFO, "Writing system preferences");
   logger.incIndent();
 
   bool writing_data_successful = true;
@@ -401,23 +419,23 @@ bool writeConfig(DynamicJsonDocument config) {
         auto result = writeConfigParam(param_name, string_value, uint_value);
         logger.incIndent();
         if (result) {
-          logger.printfln(LOG_TYPE::DATA, "Writing '%s' was successful", param_name.c_str());
+          LOG_TOKEN(LOG_TYPE::DATA, "Writing '%s' was successful", param_name.c_str());
         } else {
-          logger.printfln(LOG_TYPE::ERR, "Writing '%s' failed", param_name.c_str());
+          LOG_TOKEN(LOG_TYPE::ERR, "Writing '%s' failed", param_name.c_str());
           writing_data_successful = false;
         }
         logger.decIndent();
       } else {
-        logger.printfln(LOG_TYPE::DATA, "Skipped '%s'", param_name.c_str());
+        LOG_TOKEN(LOG_TYPE::DATA, "Skipped '%s'", param_name.c_str());
       }
     }
   } else {
-    logger.println(LOG_TYPE::DATA, "No 'data' in config");
+    LOG_TOKEN(LOG_TYPE::DATA, "No 'data' in config");
   }
 
   logger.decIndent();
 
-  logger.println("Writing gadgets");
+  LOG_TOKEN(LOG_TYPE::INFO, "Writing gadgets");
   logger.incIndent();
 
   // Write Gadgets
@@ -430,19 +448,19 @@ bool writeConfig(DynamicJsonDocument config) {
         std::string gadget_name = gadget_data["name"];
         logger.incIndent();
         if (write_status == WriteGadgetStatus::WritingOK) {
-          logger.printfln(LOG_TYPE::INFO, "Writing '%s' was successful", gadget_name.c_str());
+          LOG_TOKEN(LOG_TYPE::INFO, "Writing '%s' was successful", gadget_name.c_str());
         } else {
           auto err_msg = writeGadgetStatusToString(write_status);
-          logger.printfln(LOG_TYPE::ERR, "Writing '%s' failed: %s", gadget_name.c_str(), err_msg.c_str());
+          LOG_TOKEN(LOG_TYPE::ERR, "Writing '%s' failed: %s", gadget_name.c_str(), err_msg.c_str());
           writing_data_successful = false;
         }
         logger.decIndent();
       } else {
-        logger.println(LOG_TYPE::ERR, "'type' or 'name' missing in gadget config");
+        LOG_TOKEN(LOG_TYPE::ERR, "'type' or 'name' missing in gadget config");
       }
     }
   } else {
-    logger.println(LOG_TYPE::DATA, "No 'gadgets' in config");
+    LOG_TOKEN(LOG_TYPE::DATA, "No 'gadgets' in config");
   }
 
   logger.decIndent();
@@ -455,28 +473,6 @@ bool writeConfig(DynamicJsonDocument config) {
 
 //region SYNC AND HANDLE GADGETS AND CHARACTERISTICS
 
-/**
- * Prevents gadgets from getting updates
- */
-void lockGadgetUpdates() {
-  logger.println("Locking Updates");
-  lock_gadget_updates = true;
-}
-
-/**
- * Lets gadgets receive characteristic updates
- */
-void unlockGadgetUpdates() {
-  logger.println("Unlocking Updates");
-  lock_gadget_updates = false;
-}
-
-/**
- * Returns whether gadgets are currently allowed to receive updates
- * @return Whether gadgets are currently allowed to receive updates
- */
-bool gadgetUpdatesAreLocked() { return lock_gadget_updates; }
-
 /**
  * Sends a request updating a characteristic on the bridge
  * @param gadget_name Name of the gadget to be updated
@@ -484,10 +480,10 @@ bool gadgetUpdatesAreLocked() { return lock_gadget_updates; }
  * @param value New value of the characteristic
  */
 void updateCharacteristicOnBridge(const std::string &gadget_name, CharacteristicIdentifier characteristic, int value) {
-  if (gadgetUpdatesAreLocked()) return;
   auto target_gadget = gadgets.getGadget(gadget_name);
 
-  if (!target_gadget) {
+  // Restoring the gadget states happens before the network is up
+  if (!target_gadget || network_gadget == nullptr) {
     return;
   }
 
@@ -500,7 +496,7 @@ void updateCharacteristicOnBridge(const std::string &gadget_name, Characteristic
 
   auto out_req = std::make_shared<Request>(PATH_CHARACTERISTIC_UPDATE_TO_BRIDGE,
                              gen_req_id(),
-                             client_id_,
+                             getClientID(),
                              PROTOCOL_BRIDGE_NAME,
                              req_doc);
 
@@ -516,15 +512,18 @@ void updateCharacteristicOnBridge(const std::string &gadget_name, Characteristic
  * @param event
  */
 void forwardEvent(const std::shared_ptr<Event> &event) {
+  auto command = GadgetCommand::event(event->getSender(), event->getType());
   for (int i = 0; i < gadgets.getGadgetCount(); i++) {
-    gadgets[i]->handleEvent(event->getSender(), event->getType());
+    if (!gadgets[i]->postCommand(command)) {
+      logger.println(LOG_TYPE::ERR, gadgets[i]->getName(), "Command queue full, event dropped");
+    }
   }
 }
 
 
 void updateEventOnBridge(const string &sender, EventType type) {
   if (sender.empty()) {
-    logger.println("no sender specified, no event send");
+    LOG_TOKEN(LOG_TYPE::INFO, "no sender specified, no event send");
     return;
   }
 
@@ -542,11 +541,13 @@ void updateEventOnBridge(const string &sender, EventType type) {
 
   auto out_req = std::make_shared<Request>(PATH_EVENT_UPDATE_TO_BRIDGE,
                              gen_req_id(),
-                             client_id_,
+                             getClientID(),
                              PROTOCOL_BRIDGE_NAME,
                              req_doc);
 
-  network_gadget->sendRequest(out_req);
+  if (network_gadget != nullptr) {
+    network_gadget->sendRequest(out_req);
+  }
 
   forwardEvent(event_buf);
 }
@@ -557,17 +558,20 @@ void updateEventOnBridge(const string &sender, EventType type) {
 
 void addCodeToBuffer(const std::shared_ptr<CodeCommand> &code) {
   if (codes.addCode(code)) {
-    logger.println("Code added to buffer");
+    LOG_TOKEN(LOG_TYPE::INFO, "Code added to buffer");
     return;
   }
-  logger.println(LOG_TYPE::ERR, "Ignoring: Double Code");
+  LOG_TOKEN(LOG_TYPE::ERR, "Ignoring: Double Code");
 }
 
 void forwardCodeToGadgets(const std::shared_ptr<CodeCommand> &code) {
-  logger.printfln("Forwarding code %d to %d gadgets", code->getCode(), gadgets.getGadgetCount());
+  LOG_TOKEN(LOG_TYPE::INFO, "Forwarding code %lu to %d gadgets", code->getCode(), gadgets.getGadgetCount());
   logger.incIndent();
+  auto command = GadgetCommand::codeUpdate(code->getCode());
   for (int i = 0; i < gadgets.getGadgetCount(); i++) {
-    gadgets[i]->handleCodeUpdate(code->getCode());
+    if (!gadgets[i]->postCommand(command)) {
+      logger.println(LOG_TYPE::ERR, gadgets[i]->getName(), "Command queue full, code dropped");
+    }
   }
   logger.decIndent();
 }
@@ -597,7 +601,7 @@ void sendCodeToRemote(const std::shared_ptr<CodeCommand> &code) {
 
   network_gadget->sendRequest(std::make_shared<Request>(PATH_CODE_UPDATE_TO_BRIDGE,
                                           ident,
-                                          client_id_,
+                                          getClientID(),
                                           PROTOCOL_BRIDGE_NAME,
                                           doc));
 }
@@ -630,22 +634,20 @@ void handleGadgetCharacteristicUpdateRequest(std::shared_ptr<Request>req) {
 
   auto req_body = req->getPayload();
 
-  logger.print("System / Gadget-Remote", "Received characteristic update");
+  LOG_PRINTLN(LOG_TYPE::INFO, "System / Gadget-Remote", "Received characteristic update");
   auto target_gadget = gadgets.getGadget(req_body["name"]);
   if (target_gadget != nullptr) {
     auto characteristic = getCharacteristicIdentifierFromInt(req_body["characteristic"].as<int>());
     if (characteristic != CharacteristicIdentifier::err_type) {
-      logger.incIndent();
-      lockGadgetUpdates();
       int value = req_body["value"].as<int>();
-      target_gadget->handleCharacteristicUpdate(characteristic, value);
-      unlockGadgetUpdates();
-      logger.decIndent();
+      if (!target_gadget->postCommand(GadgetCommand::characteristicUpdate(characteristic, value, true))) {
+        LOG_TOKEN(LOG_TYPE::ERR, "Command queue full, update dropped");
+      }
     } else {
-      logger.print(LOG_TYPE::ERR, "Illegal err_characteristic 0");
+      LOG_TOKEN(LOG_TYPE::ERR, "Illegal err_characteristic 0");
     }
   } else {
-    logger.print("Unknown Gadget");
+    LOG_TOKEN(LOG_TYPE::ERR, "Unknown Gadget");
   }
 }
 
@@ -662,7 +664,7 @@ void handleEventUpdateRequest(std::shared_ptr<Request>req) {
 
   auto req_body = req->getPayload();
 
-  logger.print("System / Event-Remote", "Received event_type update");
+  LOG_PRINTLN(LOG_TYPE::INFO, "System / Event-Remote", "Received event_type update");
   logger.incIndent();
   auto sender = req_body["name"].as<string>();
   auto timestamp = req_body["timestamp"].as<unsigned long long>();
@@ -696,11 +698,38 @@ void handleCodeUpdateRequest(std::shared_ptr<Request>req) {
  * @param req Request that contains the broadcast request information
  */
 void handleBroadcastRequest(std::shared_ptr<Request>req) {
-  logger.println("Broadcast");
+  LOG_TOKEN(LOG_TYPE::INFO, "Broadcast");
   DynamicJsonDocument doc(10);
   req->respond("smarthome/broadcast/res", doc);
 }
 
+/**
+ * Reboots the chip and prints out the given message
+ * @param reason The reason to print to the terminal
+ */
+static void rebootChip(const std::string &reason) {
+  if (!reason.empty()) {
+    logger.print("Rebooting Chip because: '");
+    logger.print(reason);
+    logger.print("' in ");
+  } else {
+    logger.println("Rebooting Chip in ");
+  }
+  for (byte k = 0; k < 5; k++) {
+    logger.print(5 - k);
+    logger.print(" ");
+    delay(1000);
+  }
+  // Keep the latest gadget states
+  state_journal.flush();
+  // Keep the requests that were not sent yet and the time in RTC memory
+  if (network_gadget) {
+    rtc_retention.saveOutbox(network_gadget->takeQueuedRequests());
+  }
+  rtc_retention.saveTime();
+  ESP.restart();
+}
+
 /**
  * Handles a request that contains system control information
  * @param req Request that contains system control information
@@ -723,6 +752,35 @@ void handleSystemControlRequest(std::shared_ptr<Request>req) {
     }
     rebootChip("Network Request");
   }
+  if (subject == "profile") {
+    task_profiler.printReport();
+    gadget_executor.printReport();
+    DynamicJsonDocument res_doc(1500);
+    if (json_body.containsKey("section") && json_body["section"].as<std::string>() == "loops") {
+      task_profiler.serializeLoops(res_doc);
+    } else {
+      task_profiler.serializeTasks(res_doc, json_body.containsKey("offset") ? json_body["offset"].as<int>() : 0);
+    }
+    req->respond(res_doc);
+    return;
+  }
+  if (subject == "heap") {
+    heap_tracer.printReport();
+    DynamicJsonDocument res_doc(600);
+    heap_tracer.serialize(res_doc);
+    req->respond(res_doc);
+    return;
+  }
+  if (subject == "log_shipping") {
+    if (json_body.containsKey("log_type") && json_body.containsKey("status")) {
+      int log_type = json_body["log_type"].as<int>();
+      if (log_type >= 0 && log_type <= int(LOG_TYPE::WARN)) {
+        log_shipper.setLevelStatus(LOG_TYPE(log_type), json_body["status"].as<bool>());
+        req->respond(true);
+        return;
+      }
+    }
+  }
   req->respond(false);
 }
 
@@ -743,10 +801,11 @@ void handleConfigResetRequest(std::shared_ptr<Request>req) {
   auto reset_option = json_body["reset_option"].as<std::string>();
 
   bool success = false;
+  StorageTransaction transaction;
 
   // reset complete config
   if (reset_option == "erase") {
-    System_Storage::writeTestEEPROM();
+    System_Storage::eraseStorage();
     System_Storage::resetContentFlag();
     System_Storage::resetGadgets();
     success = true;
@@ -771,6 +830,7 @@ void handleConfigResetRequest(std::shared_ptr<Request>req) {
     success = true;
   }
 
+  success = success && transaction.commit();
   req->respond(success);
 }
 
@@ -799,6 +859,9 @@ void handleConfigWriteRequest(std::shared_ptr<Request>req) {
     auto reset_gadgets = json_body["reset_gadgets"].as<bool>();
     auto config = json_body["config"].as<JsonObject>();
 
+    // Resetting and writing the config is committed at once, a failed write leaves the old config in place
+    StorageTransaction transaction;
+
     if (reset_config) {
       System_Storage::resetContentFlag();
     }
@@ -807,10 +870,15 @@ void handleConfigWriteRequest(std::shared_ptr<Request>req) {
       System_Storage::resetGadgets();
     }
 
-    auto status = writeConfig(config);
+    auto status = writeConfig(config) && transaction.commit();
 
     req->respond(status);
 
+    // The id is only applied once it is stored
+    if (status && System_Storage::hasValidID()) {
+      setClientID(System_Storage::readID());
+    }
+
   } else if (cfg_write_mode == "param") {
 
     // Check payload for missing keys
@@ -825,15 +893,16 @@ void handleConfigWriteRequest(std::shared_ptr<Request>req) {
     // Value to write as uint8_t
     auto param_val_uint = json_body["value"].as<uint8_t>();
 
-    bool write_successful = writeConfigParam(param_name, param_val, param_val_uint);
+    StorageTransaction transaction;
+    bool write_successful = writeConfigParam(param_name, param_val, param_val_uint) && transaction.commit();
 
     req->respond(write_successful);
 
     if (param_name == "id" && write_successful) {
-      client_id_ = param_val;
+      setClientID(param_val);
     }
   } else {
-    logger.printfln(LOG_TYPE::ERR, "Unknown config write mode '%s'", cfg_write_mode.c_str());
+    LOG_TOKEN(LOG_TYPE::ERR, "Unknown config write mode '%s'", cfg_write_mode.c_str());
   }
 }
 
@@ -855,7 +924,7 @@ void handleConfigReadRequest(std::shared_ptr<Request>req) {
   std::string read_val_str;
   uint8_t read_val_uint;
 
-  logger.printfln("Read param '%s'", param_name.c_str());
+  LOG_TOKEN(LOG_TYPE::INFO, "Read param '%s'", param_name.c_str());
 
   // read wifi ssid
   if (param_name == "wifi_ssid") {
@@ -971,6 +1040,27 @@ void handleGadgetWriteRequest(std::shared_ptr<Request>req) {
   }
 }
 
+/**
+ * Handles the response of the bridge to a time sync measurement
+ * @param req Request that contains the timestamps of the bridge
+ */
+void handleTimeSyncResponse(std::shared_ptr<Request>req) {
+  // Taken when the network task received the response, waiting in the queue must not count as network delay
+  auto client_receive = req->getCreationTime();
+
+  if (!checkPayloadForKeys(req, {"client_send", "server_receive", "server_send"})) {
+    return;
+  }
+  req->dontRespond();
+
+  auto req_payload = req->getPayload();
+  system_timer.addSyncSample(req_payload["client_send"].as<long long>(),
+                             req_payload["server_receive"].as<unsigned long long>(),
+                             req_payload["server_send"].as<unsigned long long>(),
+                             client_receive);
+  rtc_retention.saveTime();
+}
+
 /**
  * Handles a request to sync settings between client and bridge
  * @param req Request that contains the sync information
@@ -981,10 +1071,15 @@ void handleSyncRequest(std::shared_ptr<Request>req) {
 
   // Get time sync data from request
   if (req_payload.containsKey("server_time")) {
-    auto buf_time = req_payload["server_time"].as<unsigned long long int>();
-    system_timer.setTime(buf_time, 0);
+    // The server time does not include the network delay, only use it as long as there are no measurements
+    if (!system_timer.hasSyncSamples()) {
+      auto buf_time = req_payload["server_time"].as<unsigned long long int>();
+      system_timer.setTime(buf_time, 0);
+      rtc_retention.saveTime();
+    }
+    time_sync_samples_left_ = TIME_SYNC_SAMPLES;
   } else {
-    logger.println(LOG_TYPE::ERR, "Have not received server sync time");
+    LOG_TOKEN(LOG_TYPE::ERR, "Have not received server sync time");
   }
 
   DynamicJsonDocument data_json(4500);
@@ -1036,6 +1131,45 @@ void handleSyncRequest(std::shared_ptr<Request>req) {
 
 //region SORTING OF REQUESTS
 
+/**
+ * Handles a system request accessing the storage and logs how long it took
+ * @param req Request to handle
+ * @return Time it took to handle the request in us
+ */
+unsigned long handleStorageRequest(const std::shared_ptr<Request> &req) {
+  int64_t start = SystemTimer::getLocalTimeMicros();
+
+  if (req->getPath() == PATH_CONFIG_RESET) {
+    handleConfigResetRequest(req);
+  } else if (req->getPath() == PATH_CONFIG_WRITE) {
+    handleConfigWriteRequest(req);
+  } else if (req->getPath() == PATH_CONFIG_READ) {
+    handleConfigReadRequest(req);
+  } else if (req->getPath() == PATH_GADGET_WRITE) {
+    handleGadgetWriteRequest(req);
+  }
+
+  auto duration = (unsigned long) (SystemTimer::getLocalTimeMicros() - start);
+  LOG_TOKEN(LOG_TYPE::INFO, "Handled '%s' in %lu us", req->getPath().c_str(), duration);
+  return duration;
+}
+
+/**
+ * Hands a system request accessing the storage over to the system worker, which responds once it is done.
+ * Handles the request right away if the worker is not running.
+ * @param req Request to hand over
+ */
+void offloadStorageRequest(std::shared_ptr<Request> req) {
+  if (system_worker_queue == nullptr) {
+    handleStorageRequest(req);
+    return;
+  }
+  if (!queueRequest(system_worker_queue, req, 0)) {
+    LOG_TOKEN(LOG_TYPE::ERR, "System worker busy, rejecting '%s'", req->getPath().c_str());
+    req->respond(false);
+  }
+}
+
 void handleSystemRequest(std::shared_ptr<Request>req) {
 
   DynamicJsonDocument json_body = req->getPayload();
@@ -1046,7 +1180,7 @@ void handleSystemRequest(std::shared_ptr<Request>req) {
     return;
   }
 
-  logger.println("System command received");
+  LOG_PRINTLN(LOG_TYPE::INFO, "System command received");
 
   // React to broadcast
   if (req->getPath() == PATH_BROADCAST) {
@@ -1055,7 +1189,7 @@ void handleSystemRequest(std::shared_ptr<Request>req) {
   }
 
   // All directed Requests
-  logger.println("Directed Request");
+  LOG_TOKEN(LOG_TYPE::INFO, "Directed Request");
 
   // system commands
   if (req->getPath() == PATH_SYSTEM_CONTROL) {
@@ -1063,27 +1197,13 @@ void handleSystemRequest(std::shared_ptr<Request>req) {
     return;
   }
 
-  // Reset config
-  if (req->getPath() == PATH_CONFIG_RESET) {
-    handleConfigResetRequest(req);
-    return;
-  }
-
-  // Write parameters
-  if (req->getPath() == PATH_CONFIG_WRITE) {
-    handleConfigWriteRequest(req);
-    return;
-  }
-
-  // Read parameters
-  if (req->getPath() == PATH_CONFIG_READ) {
-    handleConfigReadRequest(req);
-    return;
-  }
-
-  // Write gadget
-  if (req->getPath() == PATH_GADGET_WRITE) {
-    handleGadgetWriteRequest(req);
+  // Reset config, write and read parameters and write gadgets on the system worker.
+  // Reads are handled there too, so they see all writes requested before.
+  if (req->getPath() == PATH_CONFIG_RESET ||
+      req->getPath() == PATH_CONFIG_WRITE ||
+      req->getPath() == PATH_CONFIG_READ ||
+      req->getPath() == PATH_GADGET_WRITE) {
+    offloadStorageRequest(req);
     return;
   }
 
@@ -1096,8 +1216,9 @@ void handleSystemRequest(std::shared_ptr<Request>req) {
  */
 void handleRequest(std::shared_ptr<Request>req) {
   std::string req_path = req->getPath();
+  auto client_id = getClientID();
   if (!req->hasReceiver()) {
-    req->updateReceiver(client_id_);
+    req->updateReceiver(client_id);
     for (const auto &list_path: broadcast_request_paths) {
       if (req_path == list_path) {
         // Handle broadcasts which do not have an receiver
@@ -1106,7 +1227,7 @@ void handleRequest(std::shared_ptr<Request>req) {
       }
     }
     return;
-  } else if (client_id_ != req->getReceiver()) {
+  } else if (client_id != req->getReceiver()) {
     // Return if the client is not the receiver of the message
     return;
   }
@@ -1142,7 +1263,12 @@ void handleRequest(std::shared_ptr<Request>req) {
     return;
   }
 
-  logger.printfln(LOG_TYPE::ERR, "Received request to unhandled path");
+  if (req->getPath() == PATH_SYNC_TIME) {
+    handleTimeSyncResponse(req);
+    return;
+  }
+
+  LOG_TOKEN(LOG_TYPE::ERR, "Received request to unhandled path");
 }
 
 //endregion
@@ -1150,25 +1276,17 @@ void handleRequest(std::shared_ptr<Request>req) {
 //region INITIALIZATION METHODS
 
 /**
- * Initialized all of the gadgets stored in the EEPROM
- * @return Whether initializing all gadgets was successful or not
+ * Resolves the stored gadgets: translates their ports to pins and parses their code mapping
+ * @return The resolved gadgets, gadgets with a faulty code config are left out
  */
-bool initGadgets() {
-  auto eeprom_gadgets = System_Storage::readAllGadgets();
-
-  logger.printfln("Initializing Gadgets: %d", eeprom_gadgets.size());
-  logger.incIndent();
+std::vector<boot_gadget_tuple> resolveGadgets() {
+  auto stored_gadgets = System_Storage::readAllGadgets();
+  std::vector<boot_gadget_tuple> resolved_gadgets;
 
-  for (auto gadget: eeprom_gadgets) {
-    auto gadget_ident = (GadgetIdentifier) std::get<0>(gadget);
-    auto remote_bf = std::get<1>(gadget);
+  for (auto &gadget: stored_gadgets) {
     auto ports = std::get<2>(gadget);
-    auto name = std::get<3>(gadget);
-    auto gadget_config_str = std::get<4>(gadget);
-    auto code_config_str = std::get<5>(gadget);
-
-    logger.printfln("Initializing %s", name.c_str());
-    logger.incIndent();
+    auto &name = std::get<3>(gadget);
+    auto &code_config_str = std::get<5>(gadget);
 
     // Translate stored ports to actual pins
     pin_set pins;
@@ -1181,127 +1299,187 @@ bool initGadgets() {
       pins[i] = pin;
     }
 
-    DynamicJsonDocument gadget_config(2500);
-    DynamicJsonDocument code_config(2500);
+    // Configs are stored as MessagePack
+    code_mapping codes;
+    if (!code_config_str.empty()) {
+      // Every MessagePack byte may become a variant slot
+      DynamicJsonDocument code_config(code_config_str.size() * 16 + 64);
+      if (deserializeMsgPack(code_config, code_config_str) != DeserializationError::Ok) {
+        LOG_TOKEN(LOG_TYPE::ERR, "Error in code config deserialization process of %s", name.c_str());
+        continue;
+      }
+      for (int method_index = 0; method_index < GadgetMethodCount; method_index++) {
+        std::stringstream ss;
+        ss << method_index;
+        std::string method_str = ss.str();
+        if (code_config.containsKey(method_str)) {
+          JsonArray code_arr = code_config[method_str].as<JsonArray>();
+          for (int i = 0; i < code_arr.size(); i++) {
+            codes.emplace_back(method_index, code_arr[i].as<unsigned long>());
+          }
+        }
+      }
+    }
 
-    bool deserialization_ok = true;
+    resolved_gadgets.emplace_back(std::get<0>(gadget), std::get<1>(gadget), pins, name, std::get<4>(gadget), codes);
+  }
+  return resolved_gadgets;
+}
 
-    DeserializationError err;
+/**
+ * Creates a resolved gadget and links it to the remotes and connectors.
+ * The gadget constructors take their parameters as JSON, so the gadget config is still deserialized here.
+ * @param gadget The resolved gadget
+ */
+void initGadget(const boot_gadget_tuple &gadget) {
+  auto gadget_ident = (GadgetIdentifier) std::get<0>(gadget);
+  auto &remote_bf = std::get<1>(gadget);
+  auto &pins = std::get<2>(gadget);
+  auto &name = std::get<3>(gadget);
+  auto &gadget_config_str = std::get<4>(gadget);
+  auto &codes = std::get<5>(gadget);
+
+  LOG_TOKEN(LOG_TYPE::INFO, "Initializing %s", name.c_str());
+  logger.incIndent();
 
-    if (!gadget_config_str.empty()) {
-      err = deserializeJson(gadget_config, gadget_config_str);
-      if (err != DeserializationError::Ok) {
-        deserialization_ok = false;
-      }
-    }
+  // Configs are stored as MessagePack, every byte of it may become a variant slot
+  DynamicJsonDocument gadget_config(gadget_config_str.size() * 16 + 64);
+  if (!gadget_config_str.empty() &&
+      deserializeMsgPack(gadget_config, gadget_config_str) != DeserializationError::Ok) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Error in config deserialization process");
+    logger.decIndent();
+    return;
+  }
 
-    if (!gadget_config_str.empty()) {
-      err = deserializeJson(code_config, code_config_str);
-      if (err != DeserializationError::Ok) {
-        deserialization_ok = false;
-      }
-    }
+  LOG_TOKEN(LOG_TYPE::DATA, "Creating Gadget");
+  logger.incIndent();
+  auto buf_gadget = createGadget(gadget_ident, pins, name, gadget_config.as<JsonObject>());
+  logger.decIndent();
 
-    if (deserialization_ok) {
-      logger.println(LOG_TYPE::DATA, "Creating Gadget");
-      logger.incIndent();
-      auto buf_gadget = createGadget(gadget_ident, pins, name, gadget_config.as<JsonObject>());
-      logger.decIndent();
+  if (buf_gadget == nullptr) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Gadget could not be created");
+    logger.decIndent();
+    return;
+  }
 
-      if (buf_gadget != nullptr) {
-        // Gadget Remote
-        if (remote_bf[0]) {
-          logger.println(LOG_TYPE::DATA, "Linking Gadget Remote");
-          logger.incIndent();
+  // Gadget Remote
+  if (remote_bf[0]) {
+    LOG_TOKEN(LOG_TYPE::DATA, "Linking Gadget Remote");
+    logger.incIndent();
 
-          using std::placeholders::_1;
-          using std::placeholders::_2;
-          using std::placeholders::_3;
+    // Serializing the updates does not touch hardware, so any gadget worker may do it
+    buf_gadget->setGadgetRemoteCallback([](const std::string &name, CharacteristicIdentifier characteristic, int value) {
+      gadget_executor.submit(name, [name, characteristic, value]() {
+        updateCharacteristicOnBridge(name, characteristic, value);
+      });
+    });
+    buf_gadget->setEventRemoteCallback([](const std::string &sender, EventType type) {
+      gadget_executor.submit(sender, [sender, type]() {
+        updateEventOnBridge(sender, type);
+      });
+    });
+    buf_gadget->setMainController(main_controller);
 
-          buf_gadget->setGadgetRemoteCallback(std::bind(&updateCharacteristicOnBridge, _1, _2, _3));
-          buf_gadget->setEventRemoteCallback(std::bind(&updateEventOnBridge, _1, _2));
-          buf_gadget->setMainController(main_controller);
+    logger.decIndent();
+  }
 
-          logger.decIndent();
-        }
+  buf_gadget->setStateCallback([](const std::string &name, CharacteristicIdentifier characteristic, int value) {
+    state_journal.record(name, characteristic, value);
+    rtc_retention.recordValue(name, characteristic, value);
+  });
 
-        // Code Remote
-        if (remote_bf[1]) {
-          logger.println(LOG_TYPE::DATA, "Linking Code Remote");
-          logger.incIndent();
-
-          logger.decIndent();
-
-          for (int method_index = 0; method_index < GadgetMethodCount; method_index++) {
-            std::stringstream ss;
-            ss << method_index;
-            std::string method_str = ss.str();
-            if (code_config.containsKey(method_str)) {
-              JsonArray code_arr = code_config[method_str].as<JsonArray>();
-              for (int i = 0; i < code_arr.size(); i++) {
-                unsigned long code = code_arr[i].as<unsigned long>();
-                buf_gadget->setMethodForCode((GadgetMethod) method_index, code);
-              }
-            }
-          }
+  // Code Remote
+  if (remote_bf[1]) {
+    LOG_TOKEN(LOG_TYPE::DATA, "Linking Code Remote");
 
-          buf_gadget->printMapping();
-        }
+    for (auto &mapping: codes) {
+      buf_gadget->setMethodForCode((GadgetMethod) mapping.first, mapping.second);
+    }
 
-        // Event Remote
-        if (remote_bf[2]) {
-          logger.println(LOG_TYPE::DATA, "Linking Gadget Remote");
-          logger.incIndent();
-          // TODO: init event remote on gadgets
-          logger.println(LOG_TYPE::ERR, "Not Implemented");
+    buf_gadget->printMapping();
+  }
 
-          logger.decIndent();
-        }
+  // Event Remote
+  if (remote_bf[2]) {
+    LOG_TOKEN(LOG_TYPE::DATA, "Linking Gadget Remote");
+    logger.incIndent();
+    // TODO: init event remote on gadgets
+    LOG_TOKEN(LOG_TYPE::ERR, "Not Implemented");
 
-        // IR Gadget
-        bool ir_ok = true;
-        if (gadgetRequiresIR(gadget_ident)) {
-          if (ir_gadget != nullptr) {
-            logger.println(LOG_TYPE::DATA, "Linking IR gadget");
-            buf_gadget->setIR(ir_gadget);
-          } else {
-            logger.println(LOG_TYPE::ERR, "No IR gadget available");
-            ir_ok = false;
-          }
-        } else {
-          logger.println(LOG_TYPE::DATA, "No IR required");
-        }
+    logger.decIndent();
+  }
 
-        // Radio
-        // TODO: check when radio is implemented
-        bool radio_ok = true;
-        if (gadgetRequiresRadio(gadget_ident)) {
-          if (radio_gadget != nullptr) {
-            logger.println(LOG_TYPE::DATA, "Linking radio gadget");
-            buf_gadget->setRadio(radio_gadget);
-          } else {
-            logger.println(LOG_TYPE::DATA, "No radio gadget available");
-            radio_ok = false;
-          }
-        } else {
-          logger.println(LOG_TYPE::DATA, "No radio required");
-        }
+  // IR Gadget
+  bool ir_ok = true;
+  if (gadgetRequiresIR(gadget_ident)) {
+    if (ir_gadget != nullptr) {
+      LOG_TOKEN(LOG_TYPE::DATA, "Linking IR gadget");
+      buf_gadget->setIR(ir_gadget);
+    } else {
+      LOG_TOKEN(LOG_TYPE::ERR, "No IR gadget available");
+      ir_ok = false;
+    }
+  } else {
+    LOG_TOKEN(LOG_TYPE::DATA, "No IR required");
+  }
 
-        // Add created gadget to the list
-        if (ir_ok && radio_ok) {
-          gadgets.addGadget(buf_gadget);
-        } else {
-          logger.println(LOG_TYPE::DATA, "Gadget initialization failed due to ir/radio problems");
-        }
-      } else {
-        logger.println(LOG_TYPE::ERR, "Gadget could not be created");
-      }
+  // Radio
+  // TODO: check when radio is implemented
+  bool radio_ok = true;
+  if (gadgetRequiresRadio(gadget_ident)) {
+    if (radio_gadget != nullptr) {
+      LOG_TOKEN(LOG_TYPE::DATA, "Linking radio gadget");
+      buf_gadget->setRadio(radio_gadget);
     } else {
-      logger.println(LOG_TYPE::ERR, "Error in config deserialization process");
+      LOG_TOKEN(LOG_TYPE::DATA, "No radio gadget available");
+      radio_ok = false;
     }
-    logger.decIndent();
+  } else {
+    LOG_TOKEN(LOG_TYPE::DATA, "No radio required");
+  }
+
+  // Add created gadget to the list
+  if (ir_ok && radio_ok) {
+    gadgets.addGadget(buf_gadget);
+    gadget_executor.addGadget(buf_gadget);
+  } else {
+    LOG_TOKEN(LOG_TYPE::DATA, "Gadget initialization failed due to ir/radio problems");
+  }
+  logger.decIndent();
+}
+
+/**
+ * Initialized all of the stored gadgets.
+ * Uses the gadgets resolved by the previous boot if neither the config nor the firmware changed since, otherwise
+ * resolves them and stores the result for the next boot.
+ * @return Whether initializing all gadgets was successful or not
+ */
+bool initGadgets() {
+  HeapScope heap_scope(HeapTag::Gadgets);
+  unsigned long start_time = micros();
+
+  // Flashing sets a new date, so the snapshot never outlives the firmware that wrote it
+  std::string firmware = getSoftwareGitCommit() + " " + getSoftwareFlashDate();
+  std::vector<boot_gadget_tuple> boot_gadgets;
+  bool from_snapshot = System_Storage::readBootSnapshot(firmware, boot_gadgets);
+  if (!from_snapshot) {
+    boot_gadgets = resolveGadgets();
+  }
+
+  LOG_TOKEN(LOG_TYPE::INFO, "Initializing Gadgets: %d", boot_gadgets.size());
+  logger.incIndent();
+
+  for (auto &gadget: boot_gadgets) {
+    initGadget(gadget);
   }
+
   logger.decIndent();
+  logger.printfln("Initialized gadgets in %lu us (%s)", micros() - start_time,
+                  from_snapshot ? "snapshot" : "resolved");
+
+  if (!from_snapshot) {
+    System_Storage::writeBootSnapshot(firmware, boot_gadgets);
+  }
   return true;
 }
 
@@ -1310,28 +1488,29 @@ bool initGadgets() {
  * @return Whether initializing connectors was successful or not
  */
 bool initConnectors() {
-  logger.println("Initializing Connectors: ");
+  HeapScope heap_scope(HeapTag::Gadgets);
+  LOG_TOKEN(LOG_TYPE::INFO, "Initializing Connectors: ");
 
   int ir_recv = System_Storage::readIRrecvPin();
   int ir_send = System_Storage::readIRsendPin();
   int radio = 0;
 
-  logger.println("Creating IR-Gadget: ");
+  LOG_TOKEN(LOG_TYPE::INFO, "Creating IR-Gadget: ");
   logger.incIndent();
   if (ir_recv || ir_send) {
     ir_gadget = std::make_shared<IR_Gadget>(ir_recv, ir_send);
   } else {
-    logger.println("No IR Configured");
+    LOG_TOKEN(LOG_TYPE::INFO, "No IR Configured");
     ir_gadget = nullptr;
   }
   logger.decIndent();
 
-  logger.println("Creating Radio-Gadget:");
+  LOG_TOKEN(LOG_TYPE::INFO, "Creating Radio-Gadget:");
   logger.incIndent();
   if (radio) {
-    logger.println("Radio Configured bot not implemented");
+    LOG_TOKEN(LOG_TYPE::INFO, "Radio Configured bot not implemented");
   } else {
-    logger.println("No Radio Configured");
+    LOG_TOKEN(LOG_TYPE::INFO, "No Radio Configured");
     radio_gadget = nullptr;
   }
   logger.decIndent();
@@ -1347,7 +1526,7 @@ bool initConnectors() {
  */
 bool initNetwork(NetworkMode mode) {
   if (mode == NetworkMode::None) {
-    logger.println(LOG_TYPE::ERR, "No network configured.");
+    LOG_TOKEN(LOG_TYPE::ERR, "No network configured.");
     return false;
   }
 
@@ -1355,22 +1534,22 @@ bool initNetwork(NetworkMode mode) {
   if (mode == NetworkMode::MQTT) {
 
     if (!System_Storage::hasValidWifiSSID()) {
-      logger.println(LOG_TYPE::ERR, "Config has no valid wifi ssid");
+      LOG_TOKEN(LOG_TYPE::ERR, "Config has no valid wifi ssid");
       return false;
     }
 
     if (!System_Storage::hasValidWifiPW()) {
-      logger.println(LOG_TYPE::ERR, "Config has no valid wifi password");
+      LOG_TOKEN(LOG_TYPE::ERR, "Config has no valid wifi password");
       return false;
     }
 
     if (!System_Storage::hasValidMQTTIP()) {
-      logger.println(LOG_TYPE::ERR, "Config has no valid mqtt ip");
+      LOG_TOKEN(LOG_TYPE::ERR, "Config has no valid mqtt ip");
       return false;
     }
 
     if (!System_Storage::hasValidMQTTPort()) {
-      logger.println(LOG_TYPE::ERR, "Config has no valid mqtt port");
+      LOG_TOKEN(LOG_TYPE::ERR, "Config has no valid mqtt port");
       return false;
     }
 
@@ -1381,7 +1560,7 @@ bool initNetwork(NetworkMode mode) {
     std::string user = System_Storage::readMQTTUsername();
     std::string mqtt_pw = System_Storage::readMQTTPassword();
 
-    network_gadget = std::make_shared<MQTTGadget>(client_id_,
+    network_gadget = std::make_shared<MQTTGadget>(getClientID(),
                                                   ssid,
                                                   wifi_pw,
                                                   ip,
@@ -1392,7 +1571,7 @@ bool initNetwork(NetworkMode mode) {
   } else if (mode == NetworkMode::Serial) {
     network_gadget = std::make_shared<SerialGadget>();
   } else {
-    logger.println(LOG_TYPE::ERR, "Unknown Network Settings");
+    LOG_TOKEN(LOG_TYPE::ERR, "Unknown Network Settings");
     return false;
   }
   logger.decIndent();
@@ -1405,9 +1584,9 @@ bool initNetwork(NetworkMode mode) {
 void initModeSerial() {
   bool status = initNetwork(NetworkMode::Serial);
   if (status) {
-    logger.println("Serial network initialized");
+    LOG_TOKEN(LOG_TYPE::INFO, "Serial network initialized");
   } else {
-    logger.println(LOG_TYPE::ERR, "serial network was not initialized");
+    LOG_TOKEN(LOG_TYPE::ERR, "serial network was not initialized");
   }
 }
 
@@ -1419,25 +1598,54 @@ void initModeNetwork() {
     auto mode = System_Storage::readNetworkMode();
     initNetwork(mode);
   } else {
-    logger.println(LOG_TYPE::ERR, "network type could not be loaded");
+    LOG_TOKEN(LOG_TYPE::ERR, "network type could not be loaded");
+  }
+}
+
+/**
+ * Restores the last known characteristic values of all gadgets from the state journal and the RTC memory
+ */
+void restoreGadgetStates() {
+  unsigned long start_time = micros();
+  int restored = state_journal.restore([](const std::string &name, CharacteristicIdentifier characteristic, int value) {
+    auto gadget = gadgets.getGadget(name);
+    if (!gadget) {
+      return false;
+    }
+    gadget->handleCharacteristicUpdate(characteristic, value);
+    return true;
+  });
+
+  // Values changed after the last journal write are still in RTC memory after a warm reboot
+  std::vector<std::string> names;
+  for (int i = 0; i < gadgets.getGadgetCount(); i++) {
+    names.push_back(gadgets[i]->getName());
   }
+  restored += rtc_retention.restoreValues(names, [](const std::string &name, CharacteristicIdentifier characteristic,
+                                                    int value) {
+    gadgets.getGadget(name)->handleCharacteristicUpdate(characteristic, value);
+  });
+  LOG_TOKEN(LOG_TYPE::INFO, "Restored %d gadget states in %lu us", restored, micros() - start_time);
 }
 
 /**
- * Initializes the chip with all gadgets and connectors loaded
+ * Initializes the chip with all gadgets and connectors loaded.
+ * The gadgets are restored to their last state before connecting to the network, which may take seconds.
  */
 void initModeComplete() {
-  if (eeprom_active_) {
-    auto mode = System_Storage::readNetworkMode();
-    initNetwork(mode);
-  } else {
-    logger.println(LOG_TYPE::ERR, "network type could not be loaded");
+  if (!eeprom_active_) {
+    LOG_TOKEN(LOG_TYPE::ERR, "network type could not be loaded");
     return;
   }
 
   initConnectors();
 
   initGadgets();
+
+  restoreGadgetStates();
+
+  auto mode = System_Storage::readNetworkMode();
+  initNetwork(mode);
 }
 
 //endregion
@@ -1450,8 +1658,7 @@ void handleCodeConnector(const std::shared_ptr<Code_Gadget> &gadget) {
   }
   if (gadget->hasNewCommand()) {
     auto com = gadget->getCommand();
-    logger.print("Command: ");
-    logger.println(com->getCode());
+    LOG_TOKEN(LOG_TYPE::INFO, "Command: %lu", com->getCode());
 
     logger.incIndent();
     handleNewCodeFromConnector(com);
@@ -1460,29 +1667,48 @@ void handleCodeConnector(const std::shared_ptr<Code_Gadget> &gadget) {
 }
 
 /**
- * Gets new requests from the network gadget.
+ * Adds the time from receiving a request until it was handled to the latency statistics
+ * @param req The handled request
+ */
+void recordRequestLatency(const std::shared_ptr<Request> &req) {
+  auto latency = (unsigned long) (SystemTimer::getLocalTimeMicros() - req->getCreationTime());
+  request_latency_count_++;
+  request_latency_sum_ += latency;
+  if (latency > request_latency_max_) {
+    request_latency_max_ = latency;
+  }
+}
+
+/**
+ * Gets all new requests from the network gadget.
  */
 void handleNetwork() {
   if (network_gadget == nullptr) {
     return;
   }
-  if (network_gadget->hasRequest()) {
-    std::string type;
+  while (network_gadget->hasRequest()) {
+    HeapScope heap_scope(HeapTag::Requests);
     std::shared_ptr<Request>req = network_gadget->getRequest();
-    RequestGadgetType g_type = network_gadget->getGadgetType();
-    if (g_type == RequestGadgetType::MQTT_G)
-      type = "MQTT";
-    else if (g_type == RequestGadgetType::SERIAL_G)
-      type = "Serial";
-    else
-      type = "<o.O>";
-
-    std::string r_body = req->getBody();
-    if (r_body.length() > 400) {
-      r_body = "[Body too long]";
+
+    // Serializing the body is only worth it if the line is printed at all
+    if (Console_Logger::levelIsEnabled(LOG_TYPE::DATA)) {
+      const char *type;
+      RequestGadgetType g_type = network_gadget->getGadgetType();
+      if (g_type == RequestGadgetType::MQTT_G)
+        type = "MQTT";
+      else if (g_type == RequestGadgetType::SERIAL_G)
+        type = "Serial";
+      else
+        type = "<o.O>";
+
+      std::string r_body = req->getBody();
+      if (r_body.length() > 400) {
+        r_body = "[Body too long]";
+      }
+      LOG_TOKEN(LOG_TYPE::DATA, "[%s] '%s': %s", type, req->getPath().c_str(), r_body.c_str());
     }
-    logger.printfln("[%s] '%s': %s", type.c_str(), req->getPath().c_str(), r_body.c_str());
     handleRequest(req);
+    recordRequestLatency(req);
   }
 }
 
@@ -1509,11 +1735,6 @@ void refreshModeComplete() {
 
   ir_gadget->refresh();
   handleCodeConnector(ir_gadget);
-
-  for (byte c = 0; c < gadgets.getGadgetCount(); c++) {
-    // TODO
-//    gadgets.getGadget(c)->refresh();
-  }
 }
 
 /**
@@ -1536,6 +1757,23 @@ void refresh() {
   }
 }
 
+/**
+ * @return Ticks the main task may sleep until it has to refresh again if no event wakes it up
+ */
+TickType_t getMainLoopWaitTicks() {
+#if MAIN_LOOP_EVENT_DRIVEN
+  unsigned long wait_time = MAIN_LOOP_MAX_WAIT_MS;
+  if (system_mode_ == BootMode::Full_Operation) {
+    if (ir_gadget != nullptr) {
+      wait_time = MAIN_LOOP_IR_POLL_INTERVAL_MS;
+    }
+  }
+  return wait_time / portTICK_PERIOD_MS;
+#else
+  return MAIN_LOOP_POLL_INTERVAL_MS / portTICK_PERIOD_MS;
+#endif
+}
+
 /**
  * Refresh method for network operation
  */
@@ -1546,24 +1784,59 @@ void refreshNetwork() {
   network_gadget->refresh();
 }
 
+/**
+ * Sends a time sync measurement request to the bridge if a sync round is running or due.
+ * The bridge answers with the timestamps it received and sent the response at.
+ */
+void sendTimeSyncRequest() {
+  if (network_gadget == nullptr) {
+    return;
+  }
+  if (time_sync_samples_left_ == 0) {
+    if (millis() - last_time_sync_ < TIME_SYNC_INTERVAL_MS) {
+      return;
+    }
+    time_sync_samples_left_ = TIME_SYNC_SAMPLES;
+  }
+  time_sync_samples_left_--;
+  last_time_sync_ = millis();
+
+  DynamicJsonDocument req_doc(100);
+  req_doc["client_send"] = (long long) SystemTimer::getLocalTimeMicros();
+
+  auto sync_request = std::make_shared<Request>(PATH_SYNC_TIME,
+                                                gen_req_id(),
+                                                getClientID(),
+                                                PROTOCOL_BRIDGE_NAME,
+                                                req_doc);
+  network_gadget->trySendRequest(sync_request);
+}
+
+/**
+ * Sends a heartbeat request to the bridge. Does not block if the outgoing queue is full, the heartbeat is dropped then.
+ */
 void sendHeartbeat() {
   if (network_gadget != nullptr) {
-    DynamicJsonDocument req_doc(100);
-
-    // Just call the method periodically to detect time rollovers
-    system_timer.getTime();
+    DynamicJsonDocument req_doc(250);
 
     req_doc["runtime_id"] = runtime_id_;
 
     // NOT PART OF THE PROTOCOL, debugging purposes only
     req_doc["system_time"] = system_timer.getTime();
+    unsigned long latency_count = request_latency_count_.exchange(0);
+    unsigned long latency_sum = request_latency_sum_.exchange(0);
+    req_doc["request_latency_avg"] = latency_count > 0 ? latency_sum / latency_count : 0;
+    req_doc["request_latency_max"] = request_latency_max_.exchange(0);
+    JsonArray core_load = req_doc.createNestedArray("core_load");
+    core_load.add(task_profiler.getCoreLoad(0));
+    core_load.add(task_profiler.getCoreLoad(1));
 
     auto heartbeat_request = std::make_shared<Request>(PATH_HEARTBEAT,
                                          gen_req_id(),
-                                         client_id_,
+                                         getClientID(),
                                          PROTOCOL_BRIDGE_NAME,
                                          req_doc);
-    network_gadget->sendRequest(heartbeat_request);
+    network_gadget->trySendRequest(heartbeat_request);
   }
 }
 
@@ -1572,13 +1845,21 @@ void sendHeartbeat() {
 //region TASKS
 
 /**
- * Function for the main task refresing the main content
+ * Function for the main task refresing the main content.
+ * Sleeps until the network gadget or a gadget notifies it about new input or the wait time is over.
  * @param args Unused
  */
 [[noreturn]] static void mainTask(void *args) {
+  int profiled_loop = task_profiler.registerLoop("refresh");
   while (true) {
+    int64_t loop_start = SystemTimer::getLocalTimeMicros();
     refresh();
-    vTaskDelay(10 / portTICK_PERIOD_MS);
+    task_profiler.recordLoop(profiled_loop, (uint32_t) (SystemTimer::getLocalTimeMicros() - loop_start));
+#if MAIN_LOOP_EVENT_DRIVEN
+    ulTaskNotifyTake(pdTRUE, getMainLoopWaitTicks());
+#else
+    vTaskDelay(getMainLoopWaitTicks());
+#endif
   }
 }
 
@@ -1587,53 +1868,100 @@ void sendHeartbeat() {
  * @param args Unused
  */
 [[noreturn]] static void networkTask(void *args) {
+  int profiled_loop = task_profiler.registerLoop("refresh_network");
+  HeapTracer::setTaskTag(HeapTag::Requests);
   while (true) {
+    int64_t loop_start = SystemTimer::getLocalTimeMicros();
     refreshNetwork();
+    task_profiler.recordLoop(profiled_loop, (uint32_t) (SystemTimer::getLocalTimeMicros() - loop_start));
     vTaskDelay(10 / portTICK_PERIOD_MS);
   }
 }
 
 /**
- * Function for the network tasks receiving and sending requests
+ * Function for the system worker handling the system requests accessing the storage
  * @param args Unused
  */
-[[noreturn]] static void heartbeatTask(void *args) {
+[[noreturn]] static void systemWorkerTask(void *args) {
+  int profiled_loop = task_profiler.registerLoop("storage_requests");
+  HeapTracer::setTaskTag(HeapTag::Storage);
   while (true) {
-    sendHeartbeat();
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    std::shared_ptr<Request> req;
+    // Write the gadget states and compact the logs while there are no requests to handle
+    TickType_t wait_ticks = state_journal.getTicksUntilFlush();
+    if (config_log.needsCompaction() || state_log.needsCompaction()) {
+      wait_ticks = 0;
+    }
+    if (xQueueReceive(system_worker_queue, &req, wait_ticks) == pdTRUE) {
+      task_profiler.recordLoop(profiled_loop, handleStorageRequest(req));
+    } else if (!state_journal.flushIfDue() && !config_log.compact() && !state_log.compact()) {
+      vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
   }
 }
 
 /**
- * Creates and starts the tasks used by the system
+ * Creates and starts the tasks used by the system.
+ * The network task shares core 0 with the WiFi stack, the main task handling the gadgets runs on core 1.
  */
 static void createTasks() {
-//  xTaskCreatePinnedToCore(
-//      mainTask,                          Task function.
-//      "Smarthome_Main",          String with name of task.
-//      10000,                 Stack size in words.
-//      NULL,                  Parameter passed as input of the task
-//      1,                        Priority of the task.
-//      &main_task,                        Task handle.
-//      0);                        Core to run on
+  system_worker_queue = xQueueCreate(SYSTEM_WORKER_QUEUE_LEN, sizeof(std::shared_ptr<Request>));
+  BaseType_t worker_status = xTaskCreatePinnedToCore(
+      systemWorkerTask,                 /* Task function. */
+      "Smarthome_System",       /* String with name of task. */
+      SYSTEM_WORKER_TASK_STACK, /* Stack size in words. */
+      NULL,                 /* Parameter passed as input of the task */
+      SYSTEM_WORKER_TASK_PRIORITY, /* Priority of the task. */
+      &system_worker_task,              /* Task handle. */
+      SYSTEM_WORKER_TASK_CORE); /* Core to run on */
+  if (worker_status != pdPASS) {
+    // Storage requests are handled by the main task then
+    LOG_TOKEN(LOG_TYPE::ERR, "Could not start the system worker");
+    vQueueDelete(system_worker_queue);
+    system_worker_queue = nullptr;
+    system_worker_task = nullptr;
+  }
+
+  xTaskCreatePinnedToCore(
+      mainTask,                         /* Task function. */
+      "Smarthome_Main",         /* String with name of task. */
+      MAIN_TASK_STACK,      /* Stack size in words. */
+      NULL,                 /* Parameter passed as input of the task */
+      MAIN_TASK_PRIORITY,      /* Priority of the task. */
+      &main_task,                       /* Task handle. */
+      MAIN_TASK_CORE);          /* Core to run on */
+
+  // Wake the main task as soon as there is something to handle
+  main_controller->setMainTask(main_task);
+  if (network_gadget != nullptr) {
+    network_gadget->setRequestNotifyTask(main_task);
+  }
 
   xTaskCreatePinnedToCore(
       networkTask,                      /* Task function. */
       "Smarthome_MQTT",         /* String with name of task. */
-      10000,                /* Stack size in words. */
+      NETWORK_TASK_STACK,   /* Stack size in words. */
       NULL,                 /* Parameter passed as input of the task */
-      1,                       /* Priority of the task. */
+      NETWORK_TASK_PRIORITY,   /* Priority of the task. */
       &network_task,                    /* Task handle. */
-      1);                       /* Core to run on */
+      NETWORK_TASK_CORE);       /* Core to run on */
 
-  xTaskCreatePinnedToCore(
-      heartbeatTask,                    /* Task function. */
-      "Smarthome_Heartbeat",    /* String with name of task. */
-      10000,                /* Stack size in words. */
-      NULL,                 /* Parameter passed as input of the task */
-      1,                       /* Priority of the task. */
-      &heartbeat_task,                  /* Task handle. */
-      1);                       /* Core to run on */
+  // Sending the heartbeat only builds and queues a request, too little work for a task of its own
+  timer_wheel.schedulePeriodic(HEARTBEAT_INTERVAL_MS, []() {
+    sendHeartbeat();
+    sendTimeSyncRequest();
+  });
+
+  if (system_mode_ == BootMode::Full_Operation) {
+    gadget_executor.begin();
+  }
+
+  task_profiler.registerTask(main_task);
+  task_profiler.registerTask(network_task);
+  if (system_worker_task != nullptr) {
+    task_profiler.registerTask(system_worker_task);
+  }
+  task_profiler.begin();
 }
 
 //endregion
@@ -1644,13 +1972,13 @@ static void createTasks() {
  * Test-Fuction for debugging
  */
 void testStuff() {
-  logger.println("Testing Stuff");
+  LOG_TOKEN(LOG_TYPE::INFO, "Testing Stuff");
   logger.incIndent();
 
   if (eeprom_active_) {
-    logger.println("testing eeprom:");
+    LOG_TOKEN(LOG_TYPE::INFO, "testing eeprom:");
 
-    logger.println("Status-Byte:");
+    LOG_TOKEN(LOG_TYPE::INFO, "Status-Byte:");
     logger.println(System_Storage::hasValidID());
     logger.println(System_Storage::hasValidWifiSSID());
     logger.println(System_Storage::hasValidWifiPW());
@@ -1659,10 +1987,10 @@ void testStuff() {
     logger.println(System_Storage::hasValidMQTTUsername());
     logger.println(System_Storage::hasValidMQTTPassword());
 
-    logger.println("Done");
+    LOG_TOKEN(LOG_TYPE::INFO, "Done");
 
   } else {
-    logger.println(LOG_TYPE::FATAL, "eeprom isn't initialized");
+    LOG_TOKEN(LOG_TYPE::FATAL, "eeprom isn't initialized");
   }
 
   logger.decIndent();
@@ -1672,25 +2000,54 @@ void testStuff() {
  * Setup-method that is automatically called once on launch
  */
 void setup() {
+  // Restore the RTC memory before anything changes it
+  rtc_retention.begin();
+  rtc_retention.restoreTime();
+
   Serial.begin(SERIAL_SPEED);
-  logger.println("Launching...");
+  if (!serial_tx.begin()) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Serial transmit buffer could not be created");
+  }
+  if (!logger.begin()) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Logger drain task could not be started");
+  }
+  if (!timer_wheel.begin()) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Timer task could not be started");
+  }
+  LOG_TOKEN(LOG_TYPE::INFO, "Launching...");
+
+  if (rtc_retention.isRestored()) {
+    LOG_TOKEN(LOG_TYPE::INFO, "Restored state from RTC memory, time %s", system_timer.isSet() ? "kept" : "not set");
+  }
+  // The bridge does not need to notice a warm reboot
+  if (!rtc_retention.getRuntimeId(runtime_id_)) {
+    runtime_id_ = int(random(10000));
+    rtc_retention.setRuntimeId(runtime_id_);
+  }
+  LOG_TOKEN(LOG_TYPE::INFO, "Runtime ID: %d", runtime_id_);
 
-  runtime_id_ = int(random(10000));
-  logger.printfln("Runtime ID: %d", runtime_id_);
+  // Keep the time over a warm reboot, the RTC counter keeps running during it
+  timer_wheel.schedulePeriodic(RTC_RETENTION_TIME_REFRESH_MS, []() {
+    rtc_retention.saveTime();
+  });
 
-  logger.println("Software Info:");
+  LOG_TOKEN(LOG_TYPE::INFO, "Software Info:");
   logger.incIndent();
-  logger.printfln("Flash Date: %s", getSoftwareFlashDate().c_str());
-  logger.printfln("Git Branch: %s", getSoftwareGitBranch().c_str());
-  logger.printfln("Git Commit: %s", getSoftwareGitCommit().c_str());
+  LOG_TOKEN(LOG_TYPE::INFO, "Flash Date: %s", getSoftwareFlashDate().c_str());
+  LOG_TOKEN(LOG_TYPE::INFO, "Git Branch: %s", getSoftwareGitBranch().c_str());
+  LOG_TOKEN(LOG_TYPE::INFO, "Git Commit: %s", getSoftwareGitCommit().c_str());
   logger.decIndent();
 
-  main_controller = std::make_shared<MainSystemController>(network_task, heartbeat_task);
+  main_controller = std::make_shared<MainSystemController>(network_task);
 
   eeprom_active_ = System_Storage::initEEPROM();
   if (eeprom_active_) {
-    client_id_ = System_Storage::readID();
-    logger.printfln("Client ID: '%s'", client_id_.c_str());
+    setClientID(System_Storage::readID());
+    LOG_TOKEN(LOG_TYPE::INFO, "Client ID: '%s'", getClientID().c_str());
+  }
+
+  if (!state_journal.begin()) {
+    LOG_TOKEN(LOG_TYPE::ERR, "State journal could not be read");
   }
 
   testStuff();
@@ -1716,18 +2073,41 @@ void setup() {
       break;
   }
 
-  logger.printfln("EEPROM usage: %d / %d bytes\n", System_Storage::getEEPROMUsage(), EEPROM_SIZE);
-  logger.printfln("Free Heap: %d", ESP.getFreeHeap());
+  // Send the requests that were waiting when rebooting
+  auto retained_requests = rtc_retention.takeOutbox();
+  if (!retained_requests.empty()) {
+    int dropped = 0;
+    for (auto &request: retained_requests) {
+      if (!network_gadget || !network_gadget->trySendRequest(request)) {
+        dropped++;
+      }
+    }
+    if (dropped) {
+      LOG_TOKEN(LOG_TYPE::WARN, "Dropped %d of %d retained requests", dropped, (int) retained_requests.size());
+    }
+  }
+
+  // Ship warnings and errors to the bridge if connected via MQTT
+  if (network_gadget != nullptr && network_gadget->getGadgetType() == RequestGadgetType::MQTT_G) {
+    log_shipper.begin(network_gadget, getClientID());
+    log_shipper.setLevelStatus(LOG_TYPE::WARN, true);
+    log_shipper.setLevelStatus(LOG_TYPE::ERR, true);
+    log_shipper.setLevelStatus(LOG_TYPE::FATAL, true);
+  }
+
+  config_log.printReport();
+  heap_tracer.printReport();
+  heap_tracer.begin();
 
   createTasks();
 }
 
 /**
  * Loop-Method that is called forever while chip is running.
- * Used for the heartbeat sending.
+ * Everything runs in the tasks, so the loop task is deleted.
  */
 void loop() {
-  refresh();
+  vTaskDelete(nullptr);
 }
 
 //endregion
@@ -0,0 +1,120 @@
+#include "state_journal.h"
+#include "console_logger.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+StateJournal::StateJournal(RecordLog &log, unsigned long interval) :
+    log_(log),
+    interval_(interval),
+    pending_since_(0) {}
+
+std::string StateJournal::getKey(const std::string &gadget, CharacteristicIdentifier characteristic) {
+  return gadget + "/" + std::to_string(int(characteristic));
+}
+
+bool StateJournal::begin() {
+  return log_.begin();
+}
+
+void StateJournal::record(const std::string &gadget, CharacteristicIdentifier characteristic, int value) {
+  auto key = getKey(gadget, characteristic);
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (pending_.empty()) {
+    pending_since_ = millis();
+  }
+  // Only the newest value of a characteristic is written, in the order of the last change
+  pending_.erase(std::remove_if(pending_.begin(), pending_.end(), [&key](const std::pair<std::string, int> &entry) {
+    return entry.first == key;
+  }), pending_.end());
+  pending_.emplace_back(key, value);
+}
+
+TickType_t StateJournal::getTicksUntilFlush() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (pending_.empty()) {
+    return portMAX_DELAY;
+  }
+  unsigned long elapsed = millis() - pending_since_;
+  if (elapsed >= interval_) {
+    return 0;
+  }
+  return (interval_ - elapsed) / portTICK_PERIOD_MS + 1;
+}
+
+bool StateJournal::flushIfDue() {
+  if (getTicksUntilFlush() != 0) {
+    return false;
+  }
+  return flush();
+}
+
+bool StateJournal::flush() {
+  std::vector<std::pair<std::string, int>> changes;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    changes.swap(pending_);
+  }
+  if (changes.empty()) {
+    return true;
+  }
+
+  log_.beginBatch();
+  for (auto &change: changes) {
+    uint32_t value = (uint32_t) change.second;
+    std::string bytes;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+      bytes += (char) ((value >> shift) & 0xFF);
+    }
+    log_.put(change.first, bytes);
+  }
+  if (!log_.commitBatch()) {
+    LOG_TOKEN(LOG_TYPE::ERR, "Could not write %d gadget states", (int) changes.size());
+    std::lock_guard<std::mutex> guard(mutex_);
+    // Retried with the next write, values recorded in the meantime are newer
+    if (pending_.empty()) {
+      pending_since_ = millis();
+    }
+    changes.erase(std::remove_if(changes.begin(), changes.end(), [this](const std::pair<std::string, int> &change) {
+      return std::any_of(pending_.begin(), pending_.end(), [&change](const std::pair<std::string, int> &entry) {
+        return entry.first == change.first;
+      });
+    }), changes.end());
+    pending_.insert(pending_.begin(), changes.begin(), changes.end());
+    return false;
+  }
+  return true;
+}
+
+int StateJournal::restore(const std::function<bool(const std::string &gadget, CharacteristicIdentifier characteristic,
+                                                   int value)> &apply) {
+  int restored = 0;
+  std::vector<std::string> unknown;
+  for (auto &key: log_.getKeys("")) {
+    auto split = key.rfind('/');
+    std::string value;
+    if (split == std::string::npos || !log_.get(key, value) || value.size() != 4) {
+      unknown.push_back(key);
+      continue;
+    }
+    auto characteristic = (CharacteristicIdentifier) atoi(key.c_str() + split + 1);
+    auto data = (const uint8_t *) value.data();
+    auto state = (int) (((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3]);
+    if (apply(key.substr(0, split), characteristic, state)) {
+      restored++;
+    } else {
+      unknown.push_back(key);
+    }
+  }
+
+  if (!unknown.empty()) {
+    log_.beginBatch();
+    for (auto &key: unknown) {
+      log_.remove(key);
+    }
+    log_.commitBatch();
+  }
+  return restored;
+}
+
+StateJournal state_journal(state_log, STATE_JOURNAL_INTERVAL_MS);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Arduino.h"
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "record_log.h"
+#include "user_settings.h"
+#include "gadgets/gadget_enums.h"
+
+/**
+ * Journal of the last known characteristic values of all gadgets, restored after booting.
+ * Changes are collected in RAM and written as a single batch at most once per interval, so dragging a slider
+ * only costs one write no matter how many values it passes. Only the newest value of every characteristic is
+ * written, and values that did not change are skipped by the record log.
+ */
+class StateJournal {
+private:
+  RecordLog &log_;
+
+  // Minimum time between two writes
+  const unsigned long interval_;
+
+  // Guards everything below
+  std::mutex mutex_;
+
+  // Changed values by their key, ordered by their last change
+  std::vector<std::pair<std::string, int>> pending_;
+
+  // Time the oldest pending change was recorded at
+  unsigned long pending_since_;
+
+  /**
+   * @param gadget Name of the gadget
+   * @param characteristic The characteristic
+   * @return Key of the characteristic in the log
+   */
+  static std::string getKey(const std::string &gadget, CharacteristicIdentifier characteristic);
+
+public:
+  /**
+   * @param log Log to store the values in
+   * @param interval Minimum time between two writes in ms
+   */
+  StateJournal(RecordLog &log, unsigned long interval);
+
+  /**
+   * Reads the journal from flash
+   * @return Whether the journal is usable
+   */
+  bool begin();
+
+  /**
+   * Records a changed value, which is written once the interval has passed
+   * @param gadget Name of the gadget
+   * @param characteristic The changed characteristic
+   * @param value The new value
+   */
+  void record(const std::string &gadget, CharacteristicIdentifier characteristic, int value);
+
+  /**
+   * @return Ticks until the pending changes are due to be written, portMAX_DELAY if there are none
+   */
+  TickType_t getTicksUntilFlush();
+
+  /**
+   * Writes the pending changes if the interval has passed
+   * @return Whether anything was written
+   */
+  bool flushIfDue();
+
+  /**
+   * Writes the pending changes right away, they stay pending if writing fails
+   * @return Whether writing was successful
+   */
+  bool flush();
+
+  /**
+   * Passes all stored values to a callback in the order they were changed in.
+   * Values of gadgets the callback does not know are removed from the journal.
+   * @param apply Called for every value, returns whether the gadget exists
+   * @return Number of restored values
+   */
+  int restore(const std::function<bool(const std::string &gadget, CharacteristicIdentifier characteristic,
+                                       int value)> &apply);
+};
+
+extern StateJournal state_journal;
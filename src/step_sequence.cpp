@@ -0,0 +1,113 @@
+#include "step_sequence.h"
+
+#include <algorithm>
+#include <utility>
+
+StepSequence::StepSequence() :
+    current_(0),
+    step_start_(0),
+    running_(false),
+    timed_out_(false),
+    advancing_(false),
+    start_count_(0) {}
+
+StepSequence &StepSequence::then(std::function<void()> action) {
+  steps_.push_back({StepType::Action, std::move(action), nullptr, 0});
+  return *this;
+}
+
+StepSequence &StepSequence::delay(unsigned long duration_ms) {
+  steps_.push_back({StepType::Delay, nullptr, nullptr, duration_ms});
+  return *this;
+}
+
+StepSequence &StepSequence::waitFor(std::function<bool()> condition, unsigned long timeout_ms) {
+  steps_.push_back({StepType::WaitFor, nullptr, std::move(condition), timeout_ms});
+  return *this;
+}
+
+void StepSequence::start(unsigned long now) {
+  current_ = 0;
+  step_start_ = now;
+  running_ = true;
+  timed_out_ = false;
+  start_count_++;
+  advance(now);
+}
+
+void StepSequence::cancel() {
+  if (advancing_) {
+    // An action or condition of these steps may be running
+    retired_steps_.push_back(std::move(steps_));
+  }
+  steps_.clear();
+  current_ = 0;
+  running_ = false;
+}
+
+void StepSequence::advance(unsigned long now) {
+  bool nested = advancing_;
+  advancing_ = true;
+  while (running_ && current_ < steps_.size()) {
+    auto &step = steps_[current_];
+    unsigned long duration = step.duration;
+    unsigned int start_count = start_count_;
+    bool done = true;
+    if (step.type == StepType::Delay) {
+      done = now - step_start_ >= duration;
+    } else {
+      // Called on a copy, appending steps may move the original
+      if (step.type == StepType::WaitFor) {
+        auto condition = step.condition;
+        done = condition();
+      } else {
+        auto action = step.action;
+        action();
+      }
+      // The step may have cancelled or restarted the sequence
+      if (!running_ || start_count != start_count_) {
+        break;
+      }
+      if (!done && now - step_start_ >= duration) {
+        timed_out_ = true;
+        done = true;
+      }
+    }
+    if (!done) {
+      break;
+    }
+    current_++;
+    step_start_ = now;
+  }
+  if (running_ && current_ >= steps_.size()) {
+    cancel();
+  }
+  advancing_ = nested;
+  if (!nested) {
+    retired_steps_.clear();
+  }
+}
+
+bool StepSequence::isRunning() const {
+  return running_;
+}
+
+bool StepSequence::hasTimedOut() const {
+  return timed_out_;
+}
+
+unsigned long StepSequence::getTimeUntilNextStep(unsigned long now) const {
+  if (!running_ || current_ >= steps_.size()) {
+    return ULONG_MAX;
+  }
+  auto &step = steps_[current_];
+  if (step.type == StepType::Action) {
+    return 0;
+  }
+  unsigned long elapsed = now - step_start_;
+  unsigned long remaining = elapsed < step.duration ? step.duration - elapsed : 0;
+  if (step.type == StepType::WaitFor) {
+    return std::min(remaining, (unsigned long) STEP_SEQUENCE_POLL_INTERVAL_MS);
+  }
+  return remaining;
+}
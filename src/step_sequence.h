@@ -0,0 +1,112 @@
+#pragma once
+
+#include <climits>
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "system_settings.h"
+
+/**
+ * A sequence of steps (actions, delays and waiting for conditions) advanced by the task owning it.
+ * Replaces blocking multi-step protocols: instead of sleeping, the owner calls advance() whenever
+ * getTimeUntilNextStep() says the next step is due, so the task keeps serving everything else in between.
+ * Time is passed in by the caller, so sequences do not depend on the system clock.
+ */
+class StepSequence {
+private:
+
+  enum class StepType {
+    Action, Delay, WaitFor
+  };
+
+  /**
+   * A single step of the sequence
+   */
+  struct Step {
+    StepType type;
+    // Action to run for Action steps, condition to wait for for WaitFor steps
+    std::function<void()> action;
+    std::function<bool()> condition;
+    // Time to wait for Delay steps, max time to wait for WaitFor steps in ms
+    unsigned long duration;
+  };
+
+  std::vector<Step> steps_;
+
+  // Index of the next step to run
+  size_t current_;
+
+  // Timestamp the current step started at
+  unsigned long step_start_;
+
+  bool running_;
+
+  // Whether a WaitFor step ran into its timeout since the sequence started
+  bool timed_out_;
+
+  // Whether advance() is running, steps cancelled meanwhile are kept in retired_steps_ until it returns
+  bool advancing_;
+
+  std::vector<std::vector<Step>> retired_steps_;
+
+  // Counts the calls of start(), so advance() notices a step restarting the sequence
+  unsigned int start_count_;
+
+public:
+  StepSequence();
+
+  /**
+   * Appends an action. Actions run right after the previous step finished.
+   * @param action Function to run
+   * @return The sequence
+   */
+  StepSequence &then(std::function<void()> action);
+
+  /**
+   * Appends a delay
+   * @param duration_ms Time to wait before the next step
+   * @return The sequence
+   */
+  StepSequence &delay(unsigned long duration_ms);
+
+  /**
+   * Appends waiting for a condition, checked every STEP_SEQUENCE_POLL_INTERVAL_MS
+   * @param condition Function returning whether the wait is over
+   * @param timeout_ms Max time to wait, the sequence continues and is marked as timed out afterwards
+   * @return The sequence
+   */
+  StepSequence &waitFor(std::function<bool()> condition, unsigned long timeout_ms);
+
+  /**
+   * Starts the appended steps and runs all steps due right away
+   * @param now The current timestamp in ms
+   */
+  void start(unsigned long now);
+
+  /**
+   * Stops the sequence and removes all steps. May be called from an action or condition of the sequence.
+   */
+  void cancel();
+
+  /**
+   * Runs all due steps until a step has to wait
+   * @param now The current timestamp in ms
+   */
+  void advance(unsigned long now);
+
+  /**
+   * @return Whether there are steps left to run
+   */
+  bool isRunning() const;
+
+  /**
+   * @return Whether a wait for a condition ran into its timeout since the sequence started
+   */
+  bool hasTimedOut() const;
+
+  /**
+   * @param now The current timestamp in ms
+   * @return Time in ms until advance() has to be called again, 0 if a step is due, ULONG_MAX if not running
+   */
+  unsigned long getTimeUntilNextStep(unsigned long now) const;
+};
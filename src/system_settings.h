@@ -18,6 +18,138 @@
 
 #define REQUEST_QUEUE_LEN 5
 
+// Serial transmit buffer
+#define SERIAL_TX_BUFFER_SIZE 8192
+#define SERIAL_TX_CHUNK_SIZE 256
+#define SERIAL_TX_MAX_WAIT_MS 5
+#define SERIAL_TX_TASK_STACK 2048
+#define SERIAL_TX_TASK_PRIORITY 1
+#define SERIAL_TX_TASK_CORE 0
+
+// Logger
+#define LOGGER_MAX_TASKS 10
+#define LOGGER_MAX_MESSAGE_LEN 200
+#define LOGGER_MAX_NAME_LEN GADGET_NAME_LEN_MAX
+// Has to be a power of two
+#define LOGGER_RING_SIZE 32
+#define LOGGER_DRAIN_INTERVAL_MS 50
+#define LOGGER_TASK_STACK 4096
+#define LOGGER_TASK_PRIORITY 1
+#define LOGGER_TASK_CORE 0
+
+// Log shipping
+#define LOG_SHIPPING_INTERVAL_MS 5000
+// Lines per second that may be shipped on average
+#define LOG_SHIPPING_RATE 2
+// Lines that may be shipped at once after a quiet period, a batch is sent early once it fills an MQTT packet
+#define LOG_SHIPPING_BURST 20
+
+// MQTT reconnect backoff
+#define MQTT_RECONNECT_MIN_DELAY_MS 1000
+#define MQTT_RECONNECT_MAX_DELAY_MS 60000
+
+// Timer wheel
+#define TIMER_WHEEL_TICK_MS 10
+#define TIMER_WHEEL_MAX_TIMERS 32
+#define TIMER_WHEEL_TASK_STACK 4096
+#define TIMER_WHEEL_TASK_PRIORITY 2
+#define TIMER_WHEEL_TASK_CORE 0
+
+// Time sync
+// Measurements used to estimate offset and drift
+#define TIME_SYNC_SAMPLES 8
+// Time between two sync rounds, one round sends TIME_SYNC_SAMPLES requests (one per heartbeat)
+#define TIME_SYNC_INTERVAL_MS 600000
+// Measurements with a longer round trip are ignored
+#define TIME_SYNC_MAX_DELAY_MS 1000
+// Min time span of the measurements to estimate the drift
+#define TIME_SYNC_MIN_DRIFT_SPAN_MS 30000
+#define TIME_SYNC_MAX_DRIFT_PPM 500
+
+// RTC retention
+// Characteristic values kept over a reset, the oldest change is dropped when full
+#define RTC_RETAINED_VALUES 48
+// Bytes for the outgoing requests kept over a reboot
+#define RTC_RETAINED_OUTBOX_SIZE 1024
+// Time between two updates of the retained system time, the RTC clock is less accurate than the system clock
+#define RTC_RETENTION_TIME_REFRESH_MS 1000
+
+// Main loop
+// Set to 0 to refresh every MAIN_LOOP_POLL_INTERVAL_MS instead of waiting for events (for latency comparisons)
+#define MAIN_LOOP_EVENT_DRIVEN 1
+#define MAIN_LOOP_POLL_INTERVAL_MS 10
+// The ir receiver has no event to wait for and is polled in this interval
+#define MAIN_LOOP_IR_POLL_INTERVAL_MS 20
+// Max time the main loop sleeps without any event
+#define MAIN_LOOP_MAX_WAIT_MS 1000
+
+// Task topology
+// Transport I/O runs on core 0 next to the WiFi stack, the main task handling requests and codes on core 1.
+// The gadgets are refreshed by the gadget executor, which runs one worker per core.
+#define MAIN_TASK_STACK 10000
+#define MAIN_TASK_PRIORITY 1
+#define MAIN_TASK_CORE 1
+#define NETWORK_TASK_STACK 10000
+#define NETWORK_TASK_PRIORITY 1
+#define NETWORK_TASK_CORE 0
+// Heartbeat and time sync requests are sent by the timer wheel in this interval
+#define HEARTBEAT_INTERVAL_MS 5000
+
+// System worker
+// Handles the system requests accessing the storage, below the other tasks so writing never delays gadget traffic
+#define SYSTEM_WORKER_TASK_STACK 8192
+#define SYSTEM_WORKER_TASK_PRIORITY 0
+#define SYSTEM_WORKER_TASK_CORE 0
+// Requests waiting for the system worker, further requests are rejected
+#define SYSTEM_WORKER_QUEUE_LEN 4
+
+// GPIO input
+// Edges buffered per input pin until they are handled
+#define GPIO_INPUT_QUEUE_LEN 16
+
+// Commands buffered per gadget until the main task applies them
+#define GADGET_COMMAND_QUEUE_LEN 8
+
+// Task profiler
+#define PROFILER_SAMPLE_INTERVAL_MS 10000
+#define PROFILER_MAX_LOOPS 6
+// Loop durations are counted in power of two buckets starting at 1 us, the last one counts everything longer
+#define PROFILER_HISTOGRAM_BUCKETS 20
+// Tasks sent per profile response, all tasks do not fit into one MQTT message
+#define PROFILER_TASKS_PER_MESSAGE 6
+
+// Heap tracer
+#define HEAP_REPORT_INTERVAL_MS 300000
+
+// Gadget refresh scheduler
+// Used for gadgets not declaring their own refresh interval and cost
+#define GADGET_REFRESH_DEFAULT_INTERVAL_MS 50
+#define GADGET_REFRESH_DEFAULT_COST_US 1000
+// Max time spent refreshing gadgets per worker loop run, the most overdue gadget always runs
+#define GADGET_REFRESH_BUDGET_US 20000
+// Min time between two overrun reports
+#define GADGET_REFRESH_REPORT_INTERVAL_MS 60000
+
+// Step sequences
+// Interval conditions of waiting steps are checked in
+#define STEP_SEQUENCE_POLL_INTERVAL_MS 20
+
+// Gadget executor
+// One worker per shard, shard i runs on core i
+#define GADGET_EXECUTOR_SHARDS 2
+// Shard running all gadgets sharing the IR or radio connector, those are not safe to use from two tasks
+#define GADGET_EXECUTOR_SHARED_IO_SHARD 1
+#define GADGET_WORKER_STACK 8192
+#define GADGET_WORKER_PRIORITY 1
+// Max time a worker sleeps without any event
+#define GADGET_WORKER_MAX_WAIT_MS 1000
+// Jobs queued per shard, further jobs are dropped
+#define GADGET_EXECUTOR_MAX_JOBS 32
+// Max time spent on jobs per worker loop run, the first job always runs
+#define GADGET_EXECUTOR_JOB_BUDGET_US 10000
+// Queued jobs of a shard from which the other workers are woken up to steal them
+#define GADGET_EXECUTOR_STEAL_THRESHOLD 2
+
 // CodeCommands
 #define CODE_BUFFER_SIZE 15
 #define CODE_TIME_GAP 150
@@ -26,3 +158,17 @@
 
 // System Storage
 #define GADGET_PIN_BLOCK_LEN 5
+
+// Record log
+#define FLASH_SECTOR_SIZE 4096
+// Data partition holding the config log, see partitions.csv
+#define CONFIG_LOG_PARTITION "config_log"
+// Data partition holding the journal of the gadget states
+#define STATE_LOG_PARTITION "state_log"
+#define RECORD_LOG_PARTITION_SUBTYPE 0x40
+// Sectors kept free for compaction, normal writes never use them
+#define RECORD_LOG_RESERVED_SECTORS 1
+// Free sectors below which the system worker compacts the log in the background
+#define RECORD_LOG_MIN_FREE_SECTORS 3
+// Erase count difference from which a sector is compacted to move its static records to a more worn sector
+#define RECORD_LOG_WEAR_SPREAD 64
@@ -2,12 +2,20 @@
 
 #include <ArduinoJson.h>
 #include <EEPROM.h>
+#include <algorithm>
 #include <sstream>
 #include <utility>
 #include <cmath>
+#include <cstring>
+#include <bitset>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "system_settings.h"
 #include "console_logger.h"
+#include "serial_tx_buffer.h"
+#include "heap_tracer.h"
+#include "record_log.h"
 #include "datatypes.h"
 
 #include "network_library.h"
@@ -16,6 +24,9 @@
 #include "gadgets/gadget_characteristic_settings.h"
 #include "status_codes.h"
 
+// Every field is a record in the config log keyed by its position in the former EEPROM layout.
+// The positions are still used to import the EEPROM once.
+
 // valid config bitfield
 #define VALID_CONFIG_BITFIELD_BYTE 0
 
@@ -49,6 +60,9 @@
 #define CODE_REMOTE_POS GADGET_REMOTE_POS + 1
 #define EVENT_REMOTE_POS CODE_REMOTE_POS + 1
 
+// version of the gadget record format
+#define GADGET_FORMAT_POS 11
+
 // id
 #define ID_POS 15
 #define ID_MAX_LEN 20
@@ -79,9 +93,25 @@
 
 //gadgets
 #define GADGET_POS_START (MQTT_PW_POS + MQTT_PW_MAX_LEN + 1)
-#define GADGET_MAX_COUNT 8
+#define GADGET_MAX_COUNT 24
 #define GADGET_BLOCK_START (GADGET_POS_START + ((GADGET_MAX_COUNT + 1) * 2))
 
+// Records store the gadget and code config as MessagePack, any other value at GADGET_FORMAT_POS is the legacy format
+#define GADGET_FORMAT_VERSION 2
+// Written to GADGET_FORMAT_POS of the EEPROM once it was imported into the config log
+#define GADGET_FORMAT_IMPORTED 0x80
+
+// legacy gadget format (JSON text configs, 8 gadgets)
+#define GADGET_LEGACY_MAX_COUNT 8
+#define GADGET_LEGACY_BLOCK_START (GADGET_POS_START + ((GADGET_LEGACY_MAX_COUNT + 1) * 2))
+
+// Gadgets are records of the config log keyed by this prefix and their name
+#define GADGET_KEY_PREFIX "g/"
+
+// Gadgets as resolved by the last boot, dropped whenever the config changes
+#define BOOT_SNAPSHOT_KEY "boot/snapshot"
+#define BOOT_SNAPSHOT_VERSION 1
+
 #define GADADGET_BF_POS 0
 #define GADGET_TYPE_POS 1
 #define GADGET_PIN_BLOCK_POS 2
@@ -90,11 +120,137 @@
 #define GADGET_NAME_POS (GADGET_JSON_LEN_POS + 2)
 
 /**
- *
+ * Runs the storage writes of a scope in a transaction, which is aborted when the scope ends without commit()
+ */
+class StorageTransaction {
+private:
+  bool active_;
+
+public:
+  StorageTransaction();
+
+  ~StorageTransaction();
+
+  StorageTransaction(const StorageTransaction &) = delete;
+
+  StorageTransaction &operator=(const StorageTransaction &) = delete;
+
+  /**
+   * Ends the transaction
+   * @return whether committing was successful
+   */
+  bool commit();
+};
+
+/**
+ * Stores the system config and the gadgets as records of the config log
  */
 class System_Storage {
 private:
 
+  /**
+   * Names and ports of the stored gadgets, parsed once and kept in sync by the write paths
+   */
+  struct GadgetIndex {
+    bool valid;
+    std::vector<std::string> names;
+    std::vector<pin_set> ports;
+    std::unordered_map<std::string, uint8_t> name_lookup;
+    // Bit i is set if port i is used by a stored gadget
+    std::bitset<256> used_ports;
+  };
+
+  /**
+   * @return The index of the stored gadgets, may be invalid
+   */
+  static GadgetIndex &gadgetIndex() {
+    static GadgetIndex index = {false, {}, {}, {}, {}};
+    return index;
+  }
+
+  /**
+   * Adds a gadget to the end of the index
+   * @param name The name of the gadget
+   * @param ports The ports used by the gadget
+   */
+  static void appendToGadgetIndex(const std::string &name, const pin_set &ports) {
+    auto &index = gadgetIndex();
+    index.name_lookup[name] = (uint8_t) index.names.size();
+    index.names.push_back(name);
+    index.ports.push_back(ports);
+    for (auto port: ports) {
+      if (port != 0) {
+        index.used_ports.set(port);
+      }
+    }
+  }
+
+  /**
+   * Removes a gadget from the index
+   * @param gadget_index The position of the gadget
+   */
+  static void removeFromGadgetIndex(uint8_t gadget_index) {
+    auto &index = gadgetIndex();
+    auto names = index.names;
+    auto ports = index.ports;
+    index.names.clear();
+    index.ports.clear();
+    index.name_lookup.clear();
+    index.used_ports.reset();
+    for (uint8_t i = 0; i < names.size(); i++) {
+      if (i != gadget_index) {
+        appendToGadgetIndex(names[i], ports[i]);
+      }
+    }
+  }
+
+  /**
+   * Parses all stored gadgets into the index, ordered by when they were written
+   */
+  static void buildGadgetIndex() {
+    auto &index = gadgetIndex();
+    index.names.clear();
+    index.ports.clear();
+    index.name_lookup.clear();
+    index.used_ports.reset();
+    index.valid = true;
+    for (auto &key: config_log.getKeys(GADGET_KEY_PREFIX)) {
+      config_log.view(key, [](const uint8_t *data, size_t len) {
+        auto gadget = decodeGadgetRecord(data, len);
+        appendToGadgetIndex(std::get<3>(gadget), std::get<2>(gadget));
+      });
+    }
+  }
+
+  /**
+   * @return The index of the stored gadgets, built first if it is invalid
+   */
+  static GadgetIndex &getGadgetIndex() {
+    auto &index = gadgetIndex();
+    if (!index.valid) {
+      buildGadgetIndex();
+    }
+    return index;
+  }
+
+  /**
+   * @param pos position of the field in the former EEPROM layout
+   * @return key of the field in the config log
+   */
+  static std::string getFieldKey(int pos) {
+    char key[8];
+    snprintf(key, sizeof(key), "f%d", pos);
+    return key;
+  }
+
+  /**
+   * @param name name of the gadget
+   * @return key of the gadget in the config log
+   */
+  static std::string getGadgetKey(const std::string &name) {
+    return GADGET_KEY_PREFIX + name;
+  }
+
   /**
    * Method takes a bitfield, changes the selected bit to the passed value and returns the new bitfield
    * @param index the bit to be written (0-7)
@@ -128,25 +284,24 @@ private:
 
   /**
    * Sets the bit of a bitfield to the selected value
-   * @param bitfield_address the eeprom-address the bitfield is stored in
+   * @param bitfield_address the field the bitfield is stored in
    * @param index the bit to be written (0-7)
    * @param value the value to be written
    */
   static void setFlag(int bitfield_address, uint8_t index, bool value) {
-    uint8_t content_flag = EEPROM.readByte(bitfield_address);
+    uint8_t content_flag = readUInt8(bitfield_address);
     content_flag = calculateNewContentFlag(index, value, content_flag);
-    EEPROM.writeByte(bitfield_address, content_flag);
-    EEPROM.commit();
+    writeUInt8(bitfield_address, content_flag);
   }
 
   /**
    * Reads the value stored at the selected index of a bitfield
-   * @param bitfield_address the eeprom-address the bitfield is stored in
+   * @param bitfield_address the field the bitfield is stored in
    * @param index the bit to be read (0-7)
    * @return the value of the read bit
    */
   static bool getFlag(int bitfield_address, uint8_t index) {
-    uint8_t content_flag = EEPROM.readByte(bitfield_address);
+    uint8_t content_flag = readUInt8(bitfield_address);
     return getValueFromContentFlag(index, content_flag);
   }
 
@@ -169,375 +324,633 @@ private:
   }
 
   /**
-   * Writes a uint8_t (one byte) to the eeprom
-   * @param pos position to write to
+   * Stores a record of the config, dropping the boot snapshot first if the value changes
+   * @param key key of the record
+   * @param value the value to store
+   * @return whether storing was successful
+   */
+  static bool putRecord(const std::string &key, const std::string &value) {
+    bool unchanged = false;
+    config_log.view(key, [&value, &unchanged](const uint8_t *data, size_t len) {
+      unchanged = len == value.size() && memcmp(data, value.data(), len) == 0;
+    });
+    if (unchanged) {
+      return true;
+    }
+    return config_log.remove(BOOT_SNAPSHOT_KEY) && config_log.put(key, value);
+  }
+
+  /**
+   * Deletes a record of the config, dropping the boot snapshot first
+   * @param key key of the record
+   * @return whether deleting was successful
+   */
+  static bool removeRecord(const std::string &key) {
+    if (!config_log.contains(key)) {
+      return true;
+    }
+    return config_log.remove(BOOT_SNAPSHOT_KEY) && config_log.remove(key);
+  }
+
+  /**
+   * Writes raw bytes to a field, they may contain zeros
+   * @param pos field to write to
+   * @param content the bytes to write
+   * @return whether writing was successful
+   */
+  static bool writeBytes(int pos, const std::string &content) {
+    return putRecord(getFieldKey(pos), content);
+  }
+
+  /**
+   * Reads the raw bytes of a field
+   * @param pos field to read from
+   * @param len how many bytes to read at most
+   * @return the read bytes, empty if the field was never written
+   */
+  static std::string readBytes(int pos, int len) {
+    std::string content;
+    config_log.get(getFieldKey(pos), content);
+    if ((int) content.size() > len) {
+      content.resize(len);
+    }
+    return content;
+  }
+
+  /**
+   * Writes a uint8_t (one byte) to a field
+   * @param pos field to write to
    * @param value value to be written
    * @return whether writing was successful
    */
   static bool writeUInt8(int pos, uint8_t value) {
-    EEPROM.writeByte(pos, value);
-    EEPROM.commit();
-    return true;
+    return writeBytes(pos, std::string(1, (char) value));
   }
 
   /**
-   * Reads a uint8_t (one byte) from the selected part of the memory
-   * @param pos position to read from
-   * @return the uint16_t value
+   * Reads a uint8_t (one byte) from a field
+   * @param pos field to read from
+   * @return the uint8_t value, 0 if the field was never written
    */
   static uint8_t readUInt8(int pos) {
-    return EEPROM.readByte(pos);
+    auto content = readBytes(pos, 1);
+    return content.empty() ? 0 : (uint8_t) content[0];
   }
 
   /**
-   * Writes a uint16_t (two bytes) to the selected part of the memory
-   * @param pos position to write to
+   * Writes a uint16_t (two bytes) to a field
+   * @param pos field to write to
    * @param value the value to write
    * @return whether writing was successful
    */
   static bool writeUInt16(int pos, uint16_t value) {
-
-    uint8_t first = value >> (uint8_t) 8;
-    uint8_t second = value & (uint16_t) 0x00ff;
-
-    bool success = writeUInt8(pos, first);
-    success = success & writeUInt8(pos + 1, second);
-
-    return success;
+    std::string content;
+    content += (char) (value >> (uint8_t) 8);
+    content += (char) (value & (uint16_t) 0x00ff);
+    return writeBytes(pos, content);
   }
 
   /**
-   * Reads a uint16_t (two bytes) from the selected part of the memory
-   * @param pos position to read from
-   * @return the uint16_t value
+   * Reads a uint16_t (two bytes) from a field
+   * @param pos field to read from
+   * @return the uint16_t value, 0 if the field was never written
    */
   static uint16_t readUInt16(int pos) {
-    auto first = readUInt8(pos);
-    auto second = readUInt8(pos + 1);
-    return (uint16_t) ((first * (0xFF + 1)) + second);
+    auto content = readBytes(pos, 2);
+    if (content.size() < 2) {
+      return 0;
+    }
+    return (uint16_t) (((uint8_t) content[0] * (0xFF + 1)) + (uint8_t) content[1]);
   }
 
   /**
-   * Writes the content of a string to the eeprom
-   * @param start start-index for the string
-   * @param max_len length of the string
+   * Writes a string to a field
+   * @param pos field to write to
+   * @param max_len maximum length of the string
    * @param content the string to write
    * @return whether writing was successful
    */
-  static bool writeString(int start, int max_len, std::string content) {
-    int id_length = content.size();
-    if (id_length > max_len) {
-      logger.println(LOG_TYPE::ERR, "written content is too long");
+  static bool writeString(int pos, int max_len, const std::string &content) {
+    if ((int) content.size() > max_len) {
+      LOG_TOKEN(LOG_TYPE::ERR, "written content is too long");
       return false;
     }
-    for (int pos = 0; pos < id_length; pos++) {
-      EEPROM.writeChar(pos + start, content[pos]);
+    return writeBytes(pos, content);
+  }
+
+  /**
+   * Reads a string from a field
+   * @param pos field to read from
+   * @param max_len maximum length of the string to read
+   * @return the read content
+   */
+  static std::string readString(int pos, int max_len) {
+    return readBytes(pos, max_len);
+  }
+
+  /**
+   * Reads a uint16_t (two bytes) from the EEPROM to import it
+   * @param pos position to read from
+   * @return the uint16_t value
+   */
+  static uint16_t readEEPROMUInt16(int pos) {
+    return (uint16_t) ((EEPROM.readByte(pos) * (0xFF + 1)) + EEPROM.readByte(pos + 1));
+  }
+
+  /**
+   * Reads raw bytes from the EEPROM to import them
+   * @param start start-index of the bytes
+   * @param len how many bytes to read
+   * @return the read bytes
+   */
+  static std::string readEEPROMBytes(int start, int len) {
+    if (start < 0 || start >= EEPROM_SIZE || len <= 0) {
+      return "";
     }
-    EEPROM.writeChar(id_length + start, '\0');
-    EEPROM.commit();
-    return true;
+    len = std::min(len, EEPROM_SIZE - start);
+    return std::string((const char *) EEPROM.getDataPtr() + start, len);
   }
 
   /**
-   * Reads the sontent of the eeprom as a string
+   * Reads a string from the EEPROM to import it
    * @param start start-index of the string
    * @param max_len maximum length of the string to read
    * @return the read content
    */
-  static std::string readString(int start, int max_len) {
-    std::stringstream ss;
-    for (int pos = 0; pos < max_len; pos++) {
-      char c = EEPROM.readChar(pos + start);
-      if (c == '\n' || c == 0) {
-        return ss.str();
-      }
-      ss << c;
+  static std::string readEEPROMString(int start, int max_len) {
+    auto content = readEEPROMBytes(start, max_len);
+    auto end = content.find_first_of(std::string("\n\0", 2));
+    if (end != std::string::npos) {
+      content.resize(end);
     }
-    return ss.str();
+    return content;
   }
 
   /**
-   * Reads how many gadgets are currently saved in the eeprom
-   * @return the gadget count
+   * Converts a JSON config to the MessagePack stored in the gadget records
+   * @param json the config as JSON, may be empty
+   * @param packed [out] the config as MessagePack, empty if the json was empty
+   * @return whether the json was valid
    */
-  static uint8_t getGadgetCount() {
-    return readUInt8(GADGET_COUNT_POS);
+  static bool packConfig(const std::string &json, std::string &packed) {
+    packed.clear();
+    if (json.empty()) {
+      return true;
+    }
+    DynamicJsonDocument buf_doc(2000);
+    if (deserializeJson(buf_doc, json) != DeserializationError::Ok) {
+      return false;
+    }
+    serializeMsgPack(buf_doc, packed);
+    return true;
   }
 
   /**
-   * Writes the new gadget count to the eerpom
-   * @param count how many gadgets are stored in eeprom
-   * @return whether saving was successful or not
+   * Creates the record stored for a gadget
+   * @param gadget_type The type of the gadget
+   * @param config_bf The configuration-bitfield
+   * @param ports The ports used by the gadget
+   * @param name The name of the gadget
+   * @param gadget_config The general gadget config as MessagePack
+   * @param code_config The code-mapping config as MessagePack
+   * @return the record
    */
-  static bool writeGadgetCount(uint8_t count) {
-    return writeUInt8(GADGET_COUNT_POS, count);
+  static std::string encodeGadgetRecord(uint8_t gadget_type, bitfield_set config_bf, pin_set ports,
+                                        const std::string &name, const std::string &gadget_config,
+                                        const std::string &code_config) {
+    std::string record(GADGET_NAME_POS, '\0');
+
+    // Create the bitfield
+    uint8_t buf_bitfield = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+      buf_bitfield = calculateNewContentFlag(i, config_bf[i], buf_bitfield);
+    }
+
+    record[GADADGET_BF_POS] = (char) buf_bitfield;
+    record[GADGET_TYPE_POS] = (char) gadget_type;
+    for (uint8_t i = 0; i < GADGET_PIN_BLOCK_LEN; i++) {
+      record[GADGET_PIN_BLOCK_POS + i] = (char) ports[i];
+    }
+    record[GADGET_NAME_LEN_POS] = (char) name.size();
+    record[GADGET_JSON_LEN_POS] = (char) (gadget_config.size() >> 8);
+    record[GADGET_JSON_LEN_POS + 1] = (char) (gadget_config.size() & 0xFF);
+
+    // The name is followed by a terminator, the code config ends with the record
+    record += name;
+    record += '\0';
+    record += gadget_config;
+    record += code_config;
+    return record;
   }
 
   /**
-   * Gets the memory position the selected gadget starts at
-   * @param gadget_nr the nr of the wanted gadget
-   * @return the memory position
+   * Parses the record stored for a gadget
+   * @param data The record, may be mapped flash
+   * @param len Length of the record
+   * @return the data for the gadget, gadget and code config are MessagePack
    */
-  static uint16_t getGadgetMemoryStart(uint8_t gadget_nr) {
-    if (gadget_nr >= GADGET_MAX_COUNT) {
-      return 0;
+  static gadget_tuple decodeGadgetRecord(const uint8_t *data, size_t len) {
+    pin_set pins = {0, 0, 0, 0, 0};
+    bitfield_set remote_bf = {false, false, false, false, false, false, false, false};
+
+    if (len < GADGET_NAME_POS) {
+      return gadget_tuple(0, remote_bf, pins, "", "", "");
     }
-    if (gadget_nr == 0) {
-      return GADGET_BLOCK_START;
+
+    uint8_t config_bf = data[GADADGET_BF_POS];
+    uint8_t gadget_type = data[GADGET_TYPE_POS];
+    uint8_t gadget_name_len = data[GADGET_NAME_LEN_POS];
+    uint16_t gadget_config_len = (data[GADGET_JSON_LEN_POS] << 8) | data[GADGET_JSON_LEN_POS + 1];
+
+    size_t name_start = GADGET_NAME_POS;
+    size_t config_start = name_start + gadget_name_len + 1;
+    size_t code_start = config_start + gadget_config_len;
+    if (code_start > len) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Gadget record is corrupted");
+      return gadget_tuple(0, remote_bf, pins, "", "", "");
     }
-    return readUInt16(GADGET_POS_START + (gadget_nr * 2));
+
+    for (uint8_t i = 0; i < GADGET_PIN_BLOCK_LEN; i++) {
+      pins[i] = data[GADGET_PIN_BLOCK_POS + i];
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+      remote_bf[i] = getValueFromContentFlag(i, config_bf);
+    }
+
+    auto chars = (const char *) data;
+    return gadget_tuple(gadget_type, remote_bf, pins, std::string(chars + name_start, gadget_name_len),
+                        std::string(chars + config_start, gadget_config_len),
+                        std::string(chars + code_start, len - code_start));
   }
 
   /**
-   * Gets the end of the memory segment for the selected gadget
-   * @param gadget_nr the nr of the wanted gadget
-   * @return the end of the memory
+   * Parses the record stored for a gadget
+   * @param record The record
+   * @return the data for the gadget, gadget and code config are MessagePack
    */
-  static uint16_t getGadgetMemoryEnd(uint8_t gadget_nr) {
-    if (gadget_nr >= GADGET_MAX_COUNT) {
-      return 0;
+  static gadget_tuple decodeGadgetRecord(const std::string &record) {
+    return decodeGadgetRecord((const uint8_t *) record.data(), record.size());
+  }
+
+  /**
+   * Reads a gadget stored in the EEPROM by the previous format, which kept the records behind a table of their
+   * end positions for GADGET_MAX_COUNT gadgets
+   * @param gadget_index the position of the gadget
+   * @return the data for the gadget, gadget and code config are MessagePack
+   */
+  static gadget_tuple readEEPROMGadget(uint8_t gadget_index) {
+    uint16_t addr = GADGET_BLOCK_START;
+    if (gadget_index > 0) {
+      addr = readEEPROMUInt16(GADGET_POS_START + (gadget_index * 2));
+    }
+    uint16_t addr_end = readEEPROMUInt16(GADGET_POS_START + ((gadget_index + 1) * 2));
+    if (addr < GADGET_BLOCK_START || addr_end <= addr || addr_end > EEPROM_SIZE) {
+      return decodeGadgetRecord("");
     }
-    return readUInt16(GADGET_POS_START + ((gadget_nr + 1) * 2));
+    return decodeGadgetRecord(readEEPROMBytes(addr, addr_end - addr));
   }
 
   /**
-   * Sets the end of the memory segment for the selected gadget
-   * @param gadget_nr the nr of the wanted gadget
-   * @param mem_end the end of the memory
-   * @return whether writing was successful
+   * Reads a gadget stored in the EEPROM by the legacy format, which kept the configs as JSON text behind a table for
+   * GADGET_LEGACY_MAX_COUNT gadgets
+   * @param gadget_index the position of the gadget
+   * @return the data for the gadget with the configs as JSON
+   */
+  static gadget_tuple readLegacyGadget(uint8_t gadget_index) {
+    pin_set pins = {0, 0, 0, 0, 0};
+    bitfield_set remote_bf = {false, false, false, false, false, false, false, false};
+
+    uint16_t addr = GADGET_LEGACY_BLOCK_START;
+    if (gadget_index > 0) {
+      addr = readEEPROMUInt16(GADGET_POS_START + (gadget_index * 2));
+    }
+    auto addr_end = readEEPROMUInt16(GADGET_POS_START + ((gadget_index + 1) * 2));
+    if (addr < GADGET_LEGACY_BLOCK_START || addr_end <= addr || addr_end > EEPROM_SIZE) {
+      return gadget_tuple(0, remote_bf, pins, "", "", "");
+    }
+
+    auto config_bf = EEPROM.readByte(addr + GADADGET_BF_POS);
+    auto gadget_type = EEPROM.readByte(addr + GADGET_TYPE_POS);
+    auto gadget_name_len = EEPROM.readByte(addr + GADGET_NAME_LEN_POS);
+    auto gadget_json_len = readEEPROMUInt16(addr + GADGET_JSON_LEN_POS);
+
+    uint16_t name_start = addr + GADGET_NAME_POS;
+    uint16_t config_start = name_start + gadget_name_len + 1;
+    uint16_t code_start = config_start + gadget_json_len + 1;
+
+    auto gadget_name = readEEPROMString(name_start, gadget_name_len);
+    auto gadget_json = readEEPROMString(config_start, gadget_json_len);
+    auto code_json = readEEPROMString(code_start, addr_end - code_start);
+
+    for (uint8_t i = 0; i < GADGET_PIN_BLOCK_LEN; i++) {
+      pins[i] = EEPROM.readByte(addr + GADGET_PIN_BLOCK_POS + i);
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+      remote_bf[i] = getValueFromContentFlag(i, config_bf);
+    }
+
+    return gadget_tuple(gadget_type, remote_bf, pins, gadget_name, gadget_json, code_json);
+  }
+
+  /**
+   * Copies the config and all gadgets stored in the EEPROM into the config log in a single batch.
+   * Runs once, the EEPROM is marked as imported afterwards. Gadgets that cannot be converted are dropped.
+   * @return whether importing was successful
    */
-  static bool setGadgetMemoryEnd(uint8_t gadget_nr, uint16_t mem_end) {
-    if (gadget_nr >= GADGET_MAX_COUNT) {
+  static bool importEEPROM() {
+    if (!EEPROM.begin(EEPROM_SIZE)) {
+      LOG_TOKEN(LOG_TYPE::WARN, "No EEPROM to import");
+      return writeUInt8(GADGET_FORMAT_POS, GADGET_FORMAT_VERSION);
+    }
+    uint8_t format = EEPROM.readByte(GADGET_FORMAT_POS);
+    if (format == GADGET_FORMAT_IMPORTED) {
+      return writeUInt8(GADGET_FORMAT_POS, GADGET_FORMAT_VERSION);
+    }
+
+    auto gadget_count = EEPROM.readByte(GADGET_COUNT_POS);
+    uint8_t max_count = format == GADGET_FORMAT_VERSION ? GADGET_MAX_COUNT : GADGET_LEGACY_MAX_COUNT;
+    if (gadget_count > max_count) {
+      // Never written by the EEPROM format, the EEPROM is uninitialized
+      gadget_count = 0;
+    }
+    LOG_TOKEN(LOG_TYPE::INFO, "Importing EEPROM with %d gadgets", gadget_count);
+    logger.incIndent();
+
+    StorageTransaction transaction;
+
+    for (int pos: {VALID_CONFIG_BITFIELD_BYTE, SYSTEM_SETTINGS_BITFIELD_BYTE, IR_RECV_PIN_POS, IR_SEND_PIN_POS,
+                   RADIO_RECV_POS, RADIO_SEND_POS, NETWORK_MODE_POS, GADGET_REMOTE_POS, CODE_REMOTE_POS,
+                   EVENT_REMOTE_POS}) {
+      writeUInt8(pos, EEPROM.readByte(pos));
+    }
+    writeBytes(MQTT_IP_POS, readEEPROMBytes(MQTT_IP_POS, MQTT_IP_MAX_LEN));
+    writeBytes(MQTT_PORT_POS, readEEPROMBytes(MQTT_PORT_POS, MQTT_PORT_MAX_LEN));
+    writeString(ID_POS, ID_MAX_LEN, readEEPROMString(ID_POS, ID_MAX_LEN));
+    writeString(WIFI_SSID_POS, WIFI_SSID_MAX_LEN, readEEPROMString(WIFI_SSID_POS, WIFI_SSID_MAX_LEN));
+    writeString(WIFI_PW_POS, WIFI_PW_MAX_LEN, readEEPROMString(WIFI_PW_POS, WIFI_PW_MAX_LEN));
+    writeString(MQTT_USER_POS, MQTT_USER_MAX_LEN, readEEPROMString(MQTT_USER_POS, MQTT_USER_MAX_LEN));
+    writeString(MQTT_PW_POS, MQTT_PW_MAX_LEN, readEEPROMString(MQTT_PW_POS, MQTT_PW_MAX_LEN));
+
+    gadgetIndex().valid = false;
+    for (uint8_t i = 0; i < gadget_count; i++) {
+      gadget_tuple gadget;
+      if (format == GADGET_FORMAT_VERSION) {
+        gadget = readEEPROMGadget(i);
+      } else {
+        gadget = readLegacyGadget(i);
+        std::string gadget_config;
+        std::string code_config;
+        if (!packConfig(std::get<4>(gadget), gadget_config) || !packConfig(std::get<5>(gadget), code_config)) {
+          LOG_TOKEN(LOG_TYPE::ERR, "Dropping '%s': faulty config", std::get<3>(gadget).c_str());
+          continue;
+        }
+        std::get<4>(gadget) = gadget_config;
+        std::get<5>(gadget) = code_config;
+      }
+      auto &name = std::get<3>(gadget);
+      auto status = writeNewGadget(std::get<0>(gadget), std::get<1>(gadget), std::get<2>(gadget), name,
+                                   std::get<4>(gadget), std::get<5>(gadget));
+      if (status != WriteGadgetStatus::WritingOK) {
+        LOG_TOKEN(LOG_TYPE::ERR, "Dropping '%s': could not write it", name.c_str());
+      }
+    }
+    writeUInt8(GADGET_FORMAT_POS, GADGET_FORMAT_VERSION);
+    logger.decIndent();
+
+    if (!transaction.commit()) {
       return false;
     }
-    if (mem_end < GADGET_BLOCK_START) {
+    // Importing again after losing power before this only rewrites the same values
+    EEPROM.writeByte(GADGET_FORMAT_POS, GADGET_FORMAT_IMPORTED);
+    EEPROM.commit();
+    return true;
+  }
+
+  /**
+   * Parses the gadgets resolved by a previous boot
+   * @param data The snapshot, may be mapped flash
+   * @param len Length of the snapshot
+   * @param firmware identifier of the running firmware
+   * @param gadgets [out] the resolved gadgets
+   * @return whether the snapshot was valid and written by the same firmware
+   */
+  static bool decodeBootSnapshot(const uint8_t *data, size_t len, const std::string &firmware,
+                                 std::vector<boot_gadget_tuple> &gadgets) {
+    auto chars = (const char *) data;
+    auto firmware_id = firmware.substr(0, 0xFF);
+    if (len < 2 || data[0] != BOOT_SNAPSHOT_VERSION || len < 3 + (size_t) data[1] ||
+        firmware_id.compare(0, std::string::npos, chars + 2, data[1]) != 0) {
       return false;
     }
-    if (mem_end >= EEPROM_SIZE) {
+    size_t pos = 2 + data[1];
+    uint8_t gadget_count = data[pos++];
+
+    for (uint8_t gadget_i = 0; gadget_i < gadget_count; gadget_i++) {
+      if (pos + 2 + GADGET_PIN_BLOCK_LEN + 1 > len) {
+        break;
+      }
+      uint8_t gadget_type = data[pos++];
+      uint8_t remote_flags = data[pos++];
+      bitfield_set remote_bf = {false, false, false, false, false, false, false, false};
+      for (uint8_t i = 0; i < 8; i++) {
+        remote_bf[i] = getValueFromContentFlag(i, remote_flags);
+      }
+      pin_set pins = {0, 0, 0, 0, 0};
+      for (uint8_t i = 0; i < GADGET_PIN_BLOCK_LEN; i++) {
+        pins[i] = data[pos++];
+      }
+
+      uint8_t name_len = data[pos++];
+      if (pos + name_len + 2 > len) {
+        break;
+      }
+      std::string name(chars + pos, name_len);
+      pos += name_len;
+
+      uint16_t config_len = (data[pos] << 8) | data[pos + 1];
+      pos += 2;
+      if (pos + config_len + 2 > len) {
+        break;
+      }
+      std::string gadget_config(chars + pos, config_len);
+      pos += config_len;
+
+      uint16_t code_count = (data[pos] << 8) | data[pos + 1];
+      pos += 2;
+      if (pos + (size_t) code_count * 5 > len) {
+        break;
+      }
+      code_mapping codes;
+      for (uint16_t i = 0; i < code_count; i++) {
+        unsigned long code = ((unsigned long) data[pos + 1] << 24) | ((unsigned long) data[pos + 2] << 16) |
+                             ((unsigned long) data[pos + 3] << 8) | data[pos + 4];
+        codes.emplace_back(data[pos], code);
+        pos += 5;
+      }
+
+      gadgets.emplace_back(gadget_type, remote_bf, pins, name, gadget_config, codes);
+    }
+
+    if (gadgets.size() != gadget_count || pos != len) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Boot snapshot is corrupted");
+      gadgets.clear();
       return false;
     }
-    return writeUInt16(GADGET_POS_START + ((gadget_nr + 1) * 2), mem_end + 1);
+    return true;
   }
 
   /**
-   * Writes the data for a gadget to the eeprom
+   * Reads how many gadgets are currently stored
+   * @return the gadget count
+   */
+  static uint8_t getGadgetCount() {
+    return (uint8_t) getGadgetIndex().names.size();
+  }
+
+  /**
+   * Writes the data for a gadget
    * @param config_bf The configuration-bitfield
    * @param gadget_type The type of the gadget
    * @param name The name of the gadget
-   * @param gadget_json The general gadget config
-   * @param code_json The code-mapping config
+   * @param gadget_config The general gadget config as MessagePack
+   * @param code_config The code-mapping config as MessagePack
    * @return whether writing was successful
    */
-  static WriteGadgetStatus writeNewGadget(uint8_t gadget_type, bitfield_set config_bf, pin_set ports, const std::string& name, const std::string& gadget_json, const std::string& code_json) {
-
-    // Check if updating gadget is possible
-    uint8_t gadget_index = getGadgetCount();
+  static WriteGadgetStatus writeNewGadget(uint8_t gadget_type, bitfield_set config_bf, pin_set ports, const std::string& name, const std::string& gadget_config, const std::string& code_config) {
 
     // Check if maximum gadget count is reached
-    if (gadget_index >= GADGET_MAX_COUNT) {
-      logger.println(LOG_TYPE::ERR, "Cannot save gadget: maximum count of gadgets reached");
+    if (getGadgetCount() >= GADGET_MAX_COUNT) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: maximum count of gadgets reached");
       return WriteGadgetStatus::MaxGadgetCountReached;
     }
 
+    auto &index = getGadgetIndex();
+
     // Check if name exist and quit if name is already taken
-    auto existing_names = System_Storage::readAllGadgetNames();
-    for (const auto& list_name: existing_names) {
-      if (name == list_name) {
-        logger.printfln(LOG_TYPE::ERR, "Cannot save gadget: gadget name '%s' is already in use", name.c_str());
-        return WriteGadgetStatus::NameAlreadyInUse;
-      }
+    if (index.name_lookup.count(name) > 0) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: gadget name '%s' is already in use", name.c_str());
+      return WriteGadgetStatus::NameAlreadyInUse;
     }
 
-    auto existing_ports = System_Storage::readAllGadgetPorts();
-
     for (auto gadget_port: ports) {
       // Check if port is configured on the system
       auto buf_pin = getPinForPort(gadget_port);
       if (!buf_pin && gadget_port) {
-        logger.printfln(LOG_TYPE::ERR, "Cannot save gadget: port %d is not configured on this system", gadget_port);
+        LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: port %d is not configured on this system", gadget_port);
         return WriteGadgetStatus::PortNotConfigured;
       }
 
       // Check if port is already in use on the system
-      for (auto existing_port: existing_ports) {
-        if (gadget_port == existing_port) {
-          logger.printfln(LOG_TYPE::ERR, "Cannot save gadget: gadget tries to use port already occupied (%d)", gadget_port);
-          return WriteGadgetStatus::PortAlreadyInUse;
-        }
+      if (gadget_port != 0 && index.used_ports.test(gadget_port)) {
+        LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: gadget tries to use port already occupied (%d)", gadget_port);
+        return WriteGadgetStatus::PortAlreadyInUse;
       }
     }
 
-    // Addrees the gadget start at
-    uint16_t g_start_addr = getGadgetMemoryStart(gadget_index);
-
-    // Length of the gadget name
-    uint8_t g_name_len = name.length();
-    // Length of the gadget config json
-    uint16_t g_config_len = gadget_json.length();
-    // Length of the gadget code json
-    uint16_t g_code_len = code_json.length();
-
-    // Position the gadget name starts at
-    uint16_t name_start = g_start_addr + GADGET_NAME_POS;
-    // Position the gadget config json starts at
-    uint16_t config_start = name_start + g_name_len + 1;
-    // Position the gadget code json starts at
-    uint16_t code_start = config_start + g_config_len + 1;
-
-    // Complete length of the gadget config
-    uint16_t complete_len = (code_start + g_code_len + 1) - g_start_addr;
-    // Last storage index of the gadget
-    uint16_t end_index = g_start_addr + complete_len;
-
-    if (end_index > EEPROM_SIZE) {
-      logger.println(LOG_TYPE::ERR, "Cannot save gadget: missing space in eeprom");
-      return WriteGadgetStatus::MissingEEPROMSpace;
-    }
-
-    // Create the bitfield
-    uint8_t buf_bitfield = 0;
-    for (uint8_t i = 0; i < 8; i++) {
-      buf_bitfield = calculateNewContentFlag(i, config_bf[i], buf_bitfield);
-    }
-
-    // write the config bitfield
-    auto success = writeUInt8(g_start_addr + GADADGET_BF_POS, buf_bitfield);
-
-    // Write the gadget type
-    success = success && writeUInt8(g_start_addr + GADGET_TYPE_POS, gadget_type);
-
-    for (uint8_t i = 0; i < GADGET_PIN_BLOCK_LEN; i++) {
-      // Write the port config at position i
-      success = success && writeUInt8(g_start_addr + GADGET_PIN_BLOCK_POS + i, ports[i]);
-    }
-
-    // Write the length of the name
-    success = success && writeUInt8(g_start_addr + GADGET_NAME_LEN_POS, g_name_len);
-    // Write the length of the config length
-    success = success && writeUInt16(g_start_addr + GADGET_JSON_LEN_POS, g_config_len);
-    // Write the name
-    success = success && writeString(name_start, g_name_len, name);
-    // Write the config json
-    success = success && writeString(config_start, g_config_len, gadget_json);
-    // Write the code json
-    success = success && writeString(code_start, g_code_len, code_json);
-
-    if (!success) {
-      logger.println(LOG_TYPE::ERR, "Cannot save gadget: error writing content");
+    if (name.size() > 0xFF) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: name is too long");
       return WriteGadgetStatus::ErrorWritingContent;
     }
 
-    // set the starting point for the next gadget
-    if (!setGadgetMemoryEnd(gadget_index, end_index)) {
-      logger.println(LOG_TYPE::ERR, "Cannot save gadget: error saving gadget memory end");
-      return WriteGadgetStatus::ErrorSavingMemoryEnd;
+    auto record = encodeGadgetRecord(gadget_type, config_bf, ports, name, gadget_config, code_config);
+    if (!putRecord(getGadgetKey(name), record)) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: missing space in config log");
+      return WriteGadgetStatus::MissingEEPROMSpace;
     }
 
-    // increment gadget count to formally "save" the gadget
-    writeGadgetCount(gadget_index + 1);
+    appendToGadgetIndex(name, ports);
     return WriteGadgetStatus::WritingOK;
   }
 
 public:
 
   /**
-   * Prints the whole eeprom layout to the console
-   */
-  static void printEEPROMLayout() {
-    std::stringstream ss;
-    ss << "EEPROM config:";
-    ss << "\nvalid config bitfield: " << VALID_CONFIG_BITFIELD_BYTE;
-    ss << "\ngadget count: " << GADGET_COUNT_POS;
-    ss << "\nsystem settings bitfield: " << SYSTEM_SETTINGS_BITFIELD_BYTE;
-    ss << "\nir_recv pin: " << IR_RECV_PIN_POS;
-    ss << "\nir_send pin: " << IR_SEND_PIN_POS;
-    ss << "\nradio_recv pin: " << RADIO_RECV_POS;
-    ss << "\nradio_send pin: " << RADIO_SEND_POS;
-    ss << "\nnetwork mode: " << NETWORK_MODE_POS;
-    ss << "\ngadget remote: " << GADGET_REMOTE_POS;
-    ss << "\ncode remote: " << CODE_REMOTE_POS;
-    ss << "\nevent remote: " << EVENT_REMOTE_POS;
-    ss << "\nid: " << ID_POS << " - " << ID_POS + ID_MAX_LEN;
-    ss << "\nwifi_ssid: " << WIFI_SSID_POS << " - " << WIFI_SSID_POS + WIFI_SSID_MAX_LEN;
-    ss << "\nwifi_pw: " << WIFI_PW_POS << " - " << WIFI_PW_POS + WIFI_PW_MAX_LEN;
-    ss << "\nmqtt_ip: " << MQTT_IP_POS << " - " << MQTT_IP_POS + MQTT_IP_MAX_LEN;
-    ss << "\nmqtt_port: " << MQTT_PORT_POS << " - " << MQTT_PORT_POS + MQTT_PORT_MAX_LEN;
-    ss << "\nmqtt_user: " << MQTT_USER_POS << " - " << MQTT_USER_POS + MQTT_USER_MAX_LEN;
-    ss << "\nmqtt_pw: " << MQTT_PW_POS << " - " << MQTT_PW_POS + MQTT_PW_MAX_LEN;
-    Serial.println(ss.str().c_str());
+   * Begins a transaction. Writes are only staged in RAM until the outermost transaction is committed,
+   * which appends all of them to the config log as one batch. Transactions can be nested.
+   */
+  static void beginTransaction() {
+    config_log.beginBatch();
+  }
+
+  /**
+   * Ends a transaction. Ending the outermost one appends all staged writes, which are applied completely or not at
+   * all after losing power. The flash is not touched at all if nothing changed.
+   * If a nested transaction was aborted, ending the outermost one discards all staged writes instead.
+   * @return whether committing was successful
+   */
+  static bool commitTransaction() {
+    if (!config_log.commitBatch()) {
+      // The index may contain gadgets of the discarded writes
+      gadgetIndex().valid = false;
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Aborts a transaction. Aborting the outermost one discards the writes staged since it began, aborting a nested one
+   * makes the outermost one fail, which discards them when it ends.
+   */
+  static void abortTransaction() {
+    config_log.abortBatch();
+    // The index may contain gadgets of the discarded writes
+    gadgetIndex().valid = false;
+    LOG_TOKEN(LOG_TYPE::WARN, "Aborted storage transaction");
   }
 
   /**
    * Resets the valid content flag to 0
    */
   static void resetContentFlag() {
-    uint8_t content_flag = 0;
-    EEPROM.writeByte(VALID_CONFIG_BITFIELD_BYTE, content_flag);
-    EEPROM.commit();
+    writeUInt8(VALID_CONFIG_BITFIELD_BYTE, 0);
   }
 
   // init eeprom
   /**
-   * Initializes the system EEPROM
-   * @return whether the EEPROM was correctly initialized
+   * Initializes the config log, importing the EEPROM on the first start
+   * @return whether the storage was correctly initialized
    */
   static bool initEEPROM() {
-    logger.println("Initializing EEPROM...");
+    HeapScope heap_scope(HeapTag::Storage);
+    LOG_TOKEN(LOG_TYPE::INFO, "Initializing config log...");
 
-    if (!EEPROM.begin(EEPROM_SIZE)) {
-      logger.println(LOG_TYPE::ERR, "failed to initialize EEPROM");
+    if (!config_log.begin()) {
+      LOG_TOKEN(LOG_TYPE::ERR, "failed to initialize config log");
       return false;
     }
+    if (!config_log.contains(getFieldKey(GADGET_FORMAT_POS)) && !importEEPROM()) {
+      LOG_TOKEN(LOG_TYPE::ERR, "failed to import EEPROM");
+    }
+    buildGadgetIndex();
     return true;
   }
 
   // read and write gadgets
   /**
-   * Reads the data for a gadget from the eeprom
+   * Reads the data for a gadget
    * @param gadget_index the position of the gadget
-   * @return the data for the gadget
+   * @return the data for the gadget, gadget and code config are MessagePack
    */
   static gadget_tuple readGadget(uint8_t gadget_index) {
-    auto addr = getGadgetMemoryStart(gadget_index);
-    auto addr_end = getGadgetMemoryEnd(gadget_index);
-    auto stored_gadgets = readUInt8(GADGET_COUNT_POS);
-
-    pin_set pins = {0, 0, 0, 0, 0};
-    bitfield_set remote_bf = {false, false, false, false, false, false, false, false};
-
-    if (!addr || !addr_end || gadget_index >= stored_gadgets) {
-      return gadget_tuple(0, remote_bf, pins, "", "", "");
-    }
-
-    auto config_bf = readUInt8(addr + GADADGET_BF_POS);
-    auto gadget_type = readUInt8(addr + GADGET_TYPE_POS);
-    auto gadget_name_len = readUInt8(addr + GADGET_NAME_LEN_POS);
-    auto gadget_json_len = readUInt16(addr + GADGET_JSON_LEN_POS);
-
-    uint16_t name_start = addr + GADGET_NAME_POS;
-    uint16_t config_start = name_start + gadget_name_len + 1;
-    uint16_t code_start = config_start + gadget_json_len + 1;
-
-    auto gadget_name = readString(name_start, gadget_name_len);
-    auto gadget_json = readString(config_start, gadget_json_len);
-    auto code_json = readString(code_start, addr_end);
-
-    for (uint8_t i = 0; i < GADGET_PIN_BLOCK_LEN; i++) {
-      pins[i] = readUInt8(addr + GADGET_PIN_BLOCK_POS + i);
+    HeapScope heap_scope(HeapTag::Storage);
+    auto &index = getGadgetIndex();
+    auto gadget = decodeGadgetRecord("");
+    if (gadget_index < index.names.size()) {
+      config_log.view(getGadgetKey(index.names[gadget_index]), [&gadget](const uint8_t *data, size_t len) {
+        gadget = decodeGadgetRecord(data, len);
+      });
     }
-
-    for (uint8_t i = 0; i < 8; i++) {
-      remote_bf[i] = getValueFromContentFlag(i, config_bf);
-    }
-
-    return gadget_tuple(gadget_type, remote_bf, pins, gadget_name, gadget_json, code_json);
+    return gadget;
   }
 
   /**
-   * Reads all gadgets from the eeprom
+   * Reads all gadgets
    * @return a vector containing all gadget information
    */
   static std::vector<gadget_tuple> readAllGadgets() {
+    HeapScope heap_scope(HeapTag::Storage);
     auto gadget_count = getGadgetCount();
     std::vector<gadget_tuple> gadgets;
     for (uint8_t i = 0; i < gadget_count; i++) {
@@ -552,11 +965,9 @@ public:
    * @return the used ports
    */
   static std::vector<uint8_t> readAllGadgetPorts() {
-    auto gadgets = readAllGadgets();
     std::vector<uint8_t> ports;
-    for (auto gadget: gadgets) {
-      auto buf_ports = std::get<2>(gadget);
-      for (auto port: buf_ports) {
+    for (auto &gadget_ports: getGadgetIndex().ports) {
+      for (auto port: gadget_ports) {
         if (port != 0) {
           ports.push_back(port);
         }
@@ -570,13 +981,7 @@ public:
    * @return the gadget names
    */
   static std::vector<std::string> readAllGadgetNames() {
-    auto gadgets = readAllGadgets();
-    std::vector<std::string> names;
-    for (auto gadget: gadgets) {
-      auto buf_name = std::get<3>(gadget);
-      names.push_back(buf_name);
-    }
-    return names;
+    return getGadgetIndex().names;
   }
 
   /**
@@ -585,141 +990,185 @@ public:
    * @return The index of the gadget or -1 if the name wasnt found
    */
   static int getGadgetIndexForName(const std::string& name) {
-    auto gadget_count = getGadgetCount();
-    for (uint8_t i = 0; i < gadget_count; i++) {
-      gadget_tuple buf_g = readGadget(i);
-      auto gadget_name = std::get<3>(buf_g);
-      if (gadget_name == name) {
-        return int(i);
-      }
+    auto &index = getGadgetIndex();
+    auto it = index.name_lookup.find(name);
+    if (it == index.name_lookup.end()) {
+      return -1;
     }
-    return -1;
+    return int(it->second);
   }
 
   /**
-   * Writes the data for a gadget to the eeprom
+   * Writes the data for a gadget
    * @param config_bf the configuration-bitfield
    * @param gadget_type the gadget-type
    * @param name the name of the gadget
-   * @param gadget_json the general gadget config
-   * @param code_json the code-mapping config
+   * @param gadget_json the general gadget config as JSON, stored as MessagePack
+   * @param code_json the code-mapping config as JSON, stored as MessagePack
    * @return whether writing was successful
    */
   static WriteGadgetStatus writeGadget(uint8_t gadget_type, bitfield_set config_bf, pin_set ports, const std::string& name, const std::string& gadget_json, const std::string& code_json) {
+    HeapScope heap_scope(HeapTag::Storage);
 
     if (gadget_type >= GadgetIdentifierCount) {
-      logger.printfln(LOG_TYPE::ERR, "Unknown gadget identifier '%d'", gadget_type);
+      LOG_TOKEN(LOG_TYPE::ERR, "Unknown gadget identifier '%d'", gadget_type);
       return WriteGadgetStatus::GadgetTypeError0;
     }
 
     auto type = (GadgetIdentifier) gadget_type;
 
     if (type == GadgetIdentifier::err_type) {
-      logger.println(LOG_TYPE::ERR, "Cannot save gadget: gadget has err-type 0");
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: gadget has err-type 0");
       return WriteGadgetStatus::GadgetTypeErrorUnknown;
     } else {
-      logger.printfln("Saving gadget '%s' with type %d", name.c_str(), gadget_type);
+      LOG_TOKEN(LOG_TYPE::INFO, "Saving gadget '%s' with type %d", name.c_str(), gadget_type);
     }
 
-    DynamicJsonDocument buf_doc(2000);
+    std::string gadget_config;
+    std::string code_config;
 
-    // Check gadget config
-    if (!gadget_json.empty()) {
-      auto err = deserializeJson(buf_doc, gadget_json);
-      if (err != DeserializationError::Ok) {
-        logger.printfln(LOG_TYPE::ERR, "Cannot save gadget: received faulty gadget config");
-        return WriteGadgetStatus::FaultyConfigJSON;
-      }
+    // Check and pack gadget config
+    if (!packConfig(gadget_json, gadget_config)) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: received faulty gadget config");
+      return WriteGadgetStatus::FaultyConfigJSON;
     }
 
-    // Check code config
-    if (!code_json.empty()) {
-      auto err = deserializeJson(buf_doc, code_json);
-      if (err != DeserializationError::Ok) {
-        logger.printfln(LOG_TYPE::ERR, "Cannot save gadget: received faulty code config");
-        return WriteGadgetStatus::FaultyCodeConfig;
-      }
+    // Check and pack code config
+    if (!packConfig(code_json, code_config)) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot save gadget: received faulty code config");
+      return WriteGadgetStatus::FaultyCodeConfig;
     }
 
+    // Replacing a gadget deletes and writes it in a single commit
+    StorageTransaction transaction;
+
     // Check if updating gadget is possible
     int index = getGadgetIndexForName(name);
 
     if (index != -1) {
+      std::string stored;
+      config_log.get(getGadgetKey(name), stored);
+      if (stored == encodeGadgetRecord(gadget_type, config_bf, ports, name, gadget_config, code_config)) {
+        return transaction.commit() ? WriteGadgetStatus::WritingOK : WriteGadgetStatus::ErrorWritingContent;
+      }
       if (!(deleteGadget(index))) {
         return WriteGadgetStatus::DeletionFailed;
       }
     }
 
-    return writeNewGadget(gadget_type, config_bf, ports, name, gadget_json, code_json);
+    auto status = writeNewGadget(gadget_type, config_bf, ports, name, gadget_config, code_config);
+    if (status == WriteGadgetStatus::WritingOK && !transaction.commit()) {
+      return WriteGadgetStatus::ErrorWritingContent;
+    }
+    return status;
   }
 
   /**
-   * Deletes the gadget with the selected index and moves all other gadgets up
+   * Deletes the gadget with the selected index by writing a tombstone for it
    * @param gadget_index the index of the gadgets to be deleted
    * @return whether the process of deleting was successful
    */
   static bool deleteGadget(uint8_t gadget_index) {
+    HeapScope heap_scope(HeapTag::Storage);
     auto gadget_count = getGadgetCount();
 
     if (gadget_count == 0) {
-      logger.println(LOG_TYPE::ERR, "Cannot delete gadget: no gadget saved");
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot delete gadget: no gadget saved");
       return false;
     }
 
     if (gadget_index > gadget_count -1) {
-      logger.println(LOG_TYPE::ERR, "Cannot delete gadget: index does not exist");
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot delete gadget: index does not exist");
       return false;
     }
 
-    if (gadget_index == gadget_count -1) {
-      return writeGadgetCount(gadget_count - 1);
-    }
-
-    std::vector<gadget_tuple> gadgets;
-
-    for (uint8_t i = gadget_index + 1; i < gadget_count; i++) {
-      auto buf_gadget = readGadget(i);
-      gadgets.push_back(buf_gadget);
-    }
-
-    if (!writeGadgetCount(gadget_index)) {
-      logger.println(LOG_TYPE::ERR, "Error in deleting process while updating gadget count");
+    if (!removeRecord(getGadgetKey(getGadgetIndex().names[gadget_index]))) {
+      LOG_TOKEN(LOG_TYPE::ERR, "Cannot delete gadget: error writing tombstone");
       return false;
     }
+    removeFromGadgetIndex(gadget_index);
+    return true;
+  }
 
-    auto copy_gadget_count = (uint8_t) gadgets.size();
-
-    for (uint8_t i = 0; i < copy_gadget_count; i++) {
-      auto buf_gadget = gadgets[i];
-
-      auto e1 = std::get<0>(buf_gadget);
-      auto e2 = std::get<1>(buf_gadget);
-      auto e3 = std::get<2>(buf_gadget);
-      auto e4 = std::get<3>(buf_gadget);
-      auto e5 = std::get<4>(buf_gadget);
-      auto e6 = std::get<5>(buf_gadget);
-
-      auto status = writeGadget(e1, e2, e3, e4, e5, e6);
-
-      if (status != WriteGadgetStatus::WritingOK) {
-        logger.println(LOG_TYPE::ERR, "Error in in deletion process: moving gadgets failed");
-        return false;
+  /**
+   * Deletes all saved gadgets
+   * @return whether deleting the gadgets was successful
+   */
+  static bool resetGadgets() {
+    StorageTransaction transaction;
+    for (auto &name: getGadgetIndex().names) {
+      removeRecord(getGadgetKey(name));
+    }
+    buildGadgetIndex();
+    return transaction.commit();
+  }
+
+  /**
+   * Stores the gadgets resolved during boot, so following boots can skip resolving them until the config changes
+   * @param firmware identifier of the running firmware, the snapshot is only used by the same one
+   * @param gadgets the resolved gadgets
+   * @return whether storing the snapshot was successful
+   */
+  static bool writeBootSnapshot(const std::string &firmware, const std::vector<boot_gadget_tuple> &gadgets) {
+    HeapScope heap_scope(HeapTag::Storage);
+    std::string snapshot;
+    snapshot += (char) BOOT_SNAPSHOT_VERSION;
+    snapshot += (char) std::min(firmware.size(), (size_t) 0xFF);
+    snapshot += firmware.substr(0, 0xFF);
+    snapshot += (char) gadgets.size();
+    for (auto &gadget: gadgets) {
+      auto &name = std::get<3>(gadget);
+      auto &gadget_config = std::get<4>(gadget);
+      auto &codes = std::get<5>(gadget);
+      uint8_t remote_bf = 0;
+      for (uint8_t i = 0; i < 8; i++) {
+        remote_bf = calculateNewContentFlag(i, std::get<1>(gadget)[i], remote_bf);
+      }
+      snapshot += (char) std::get<0>(gadget);
+      snapshot += (char) remote_bf;
+      for (auto pin: std::get<2>(gadget)) {
+        snapshot += (char) pin;
+      }
+      snapshot += (char) name.size();
+      snapshot += name;
+      snapshot += (char) (gadget_config.size() >> 8);
+      snapshot += (char) (gadget_config.size() & 0xFF);
+      snapshot += gadget_config;
+      snapshot += (char) (codes.size() >> 8);
+      snapshot += (char) (codes.size() & 0xFF);
+      for (auto &mapping: codes) {
+        snapshot += (char) mapping.first;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+          snapshot += (char) ((mapping.second >> shift) & 0xFF);
+        }
       }
     }
-    return true;
+    if (snapshot.size() > RecordLog::getMaxValueSize(strlen(BOOT_SNAPSHOT_KEY))) {
+      LOG_TOKEN(LOG_TYPE::WARN, "Boot snapshot is too large (%d bytes)", (int) snapshot.size());
+      return false;
+    }
+    return config_log.put(BOOT_SNAPSHOT_KEY, snapshot);
   }
 
   /**
-   * Invalidates all saved gadgets
-   * @return whether invalidating the gadgets was successful
+   * Reads the gadgets resolved by a previous boot
+   * @param firmware identifier of the running firmware
+   * @param gadgets [out] the resolved gadgets
+   * @return whether there is a snapshot matching the stored config and the firmware
    */
-  static bool resetGadgets() {
-    return writeGadgetCount(0);
+  static bool readBootSnapshot(const std::string &firmware, std::vector<boot_gadget_tuple> &gadgets) {
+    HeapScope heap_scope(HeapTag::Storage);
+    gadgets.clear();
+    bool valid = false;
+    config_log.view(BOOT_SNAPSHOT_KEY, [&](const uint8_t *data, size_t len) {
+      valid = decodeBootSnapshot(data, len, firmware, gadgets);
+    });
+    return valid;
   }
 
   // read + write IR pins
   /**
-   * Writes the ir receive pin to the eeprom
+   * Writes the ir receive pin to the storage
    * @param pin the pin used for ir receiver
    * @return whether writing was successful
    */
@@ -728,7 +1177,7 @@ public:
   }
 
   /**
-   * Reads the ir receive pin from the eeprom
+   * Reads the ir receive pin from the storage
    * @return the ir recv pin
    */
   static uint8_t readIRrecvPin() {
@@ -736,7 +1185,7 @@ public:
   }
 
   /**
-   * Writes the ir send pin to the eeprom
+   * Writes the ir send pin to the storage
    * @param pin the pin used for ir sender
    * @return whether writing was successful
    */
@@ -745,7 +1194,7 @@ public:
   }
 
   /**
-   * Reads the ir send pin from the eeprom
+   * Reads the ir send pin from the storage
    * @return the ir send pin
    */
   static uint8_t readIRsendPin() {
@@ -754,7 +1203,7 @@ public:
 
   // read + write radio pins
   /**
-   * Writes the radio receiver pin to the eeprom
+   * Writes the radio receiver pin to the storage
    * @param pin the pin used for receiving radio
    * @return whether writing radio was successful
    */
@@ -763,7 +1212,7 @@ public:
   }
 
   /**
-   * Reads the radio receiver pin from the eeprom
+   * Reads the radio receiver pin from the storage
    * @return the radio receiver pin
    */
   static uint8_t readRadioRecvPin() {
@@ -771,7 +1220,7 @@ public:
   }
 
   /**
-  * Writes the radio send pin to the eeprom
+  * Writes the radio send pin to the storage
   * @param pin the pin used for radio sending
   * @return whether writing was successful
   */
@@ -780,7 +1229,7 @@ public:
   }
 
   /**
-   * Reads the radio send pin from the eeprom
+   * Reads the radio send pin from the storage
    * @return the radio send pin
    */
   static uint8_t readRadioSendPin() {
@@ -789,7 +1238,7 @@ public:
 
   // read + write network mode
   /**
-   * Writes the network mode to the eeprom
+   * Writes the network mode to the storage
    * @param mode the mode the network should use
    * @return whether writing was successful
    */
@@ -798,7 +1247,7 @@ public:
   }
 
   /**
-   * Reads the network mode from the eeprom
+   * Reads the network mode from the storage
    * @return the network mode
    */
   static NetworkMode readNetworkMode() {
@@ -811,7 +1260,7 @@ public:
 
   // read + write gadget remote
   /**
-   * Writes the gadget remote mode to the eeprom.
+   * Writes the gadget remote mode to the storage.
    * Writing a 0 is interpreted as 'no remote used'.
    * @param mode the mode used for the gadget remote
    * @return whether writing was successful
@@ -821,7 +1270,7 @@ public:
   }
 
   /**
-   * Reads the gadget remote mode from the eeprom
+   * Reads the gadget remote mode from the storage
    * @return the gadget remote mode
    */
   static GadgetRemoteMode readGadgetRemote() {
@@ -834,7 +1283,7 @@ public:
 
   // read + write code remote
   /**
-   * Writes the code remote mode to the eeprom.
+   * Writes the code remote mode to the storage.
    * Writing a 0 is interpreted as 'no remote used'.
    * @param mode the mode used for the code remote
    * @return whether writing was successful
@@ -844,7 +1293,7 @@ public:
   }
 
   /**
-   * Reads the code remote mode from the eeprom
+   * Reads the code remote mode from the storage
    * @return the code remote mode
    */
   static CodeRemoteMode readCodeRemote() {
@@ -857,7 +1306,7 @@ public:
 
   // read + write event remote
   /**
-   * Writes the event remote mode to the eeprom.
+   * Writes the event remote mode to the storage.
    * Writing a 0 is interpreted as 'no remote used'.
    * @param mode the mode used for the event remote
    * @return whether writing was successful
@@ -867,7 +1316,7 @@ public:
   }
 
   /**
-   * Reads the event remote mode from the eeprom
+   * Reads the event remote mode from the storage
    * @return the gadget remote mode
    */
   static EventRemoteMode readEventRemote() {
@@ -880,7 +1329,7 @@ public:
 
   // read + write ID
   /**
-   * Writes the chip identifier to the eeprom
+   * Writes the chip identifier to the storage
    * @param id the chip id to be written
    * @return whether writing was successful
    */
@@ -897,7 +1346,7 @@ public:
   }
 
   /**
-   * Reads the chip identifier from the eeprom
+   * Reads the chip identifier from the storage
    * @return the chip identifier
    */
   static std::string readID() {
@@ -910,7 +1359,7 @@ public:
   }
 
   /**
-   * Checks if the there is a valid ID stored in the EEPROM
+   * Checks if the there is a valid ID stored in the storage
    * @return whether there is a valid id
    */
   static bool hasValidID() {
@@ -918,7 +1367,7 @@ public:
   }
 
   /**
-   * Writes the WIFI SSID to the eeprom
+   * Writes the WIFI SSID to the storage
    * @param ssid the ssid to be written
    * @return whether writing was successful
    */
@@ -935,7 +1384,7 @@ public:
   }
 
   /**
-   * Reads the WIFI SSID from the eeprom
+   * Reads the WIFI SSID from the storage
    * @return the wifi ssid
    */
   static std::string readWifiSSID() {
@@ -943,7 +1392,7 @@ public:
   }
 
   /**
-   * Checks if the there is a valid WIFI SSID stored in the EEPROM
+   * Checks if the there is a valid WIFI SSID stored in the storage
    * @return whether there is a valid ssid
    */
   static bool hasValidWifiSSID() {
@@ -951,7 +1400,7 @@ public:
   }
 
   /**
-   * Writes the WIFI password to the eeprom
+   * Writes the WIFI password to the storage
    * @param pw the password to be written
    * @return whether writing was successful
    */
@@ -968,7 +1417,7 @@ public:
   }
 
   /**
-   * Reads the WIFI password from the eeprom
+   * Reads the WIFI password from the storage
    * @return the wifi password
    */
   static std::string readWifiPW() {
@@ -976,7 +1425,7 @@ public:
   }
 
   /**
-   * Checks if the there is a valid WIFI password stored in the EEPROM
+   * Checks if the there is a valid WIFI password stored in the storage
    * @return whether there is a valid password
    */
   static bool hasValidWifiPW() {
@@ -984,16 +1433,17 @@ public:
   }
 
   /**
-   * Writes the MQTT IP-Address to the eeprom.
+   * Writes the MQTT IP-Address to the storage.
    * Write 0.0.0.0 to set ip to 'no valid ip'
    * @param ip the ip to be written
    * @return whether writing was successful
    */
   static bool writeMQTTIP(const IPAddress& ip) {
-    bool success = true;
+    std::string content;
     for (int i = 0; i < 4; i++) {
-      success = success && writeUInt8(MQTT_IP_POS + i, ip[i]);
+      content += (char) ip[i];
     }
+    bool success = writeBytes(MQTT_IP_POS, content);
     if (ip == IPAddress(0, 0, 0, 0)) {
       setContentFlag(CONFIG_CHECK_INDEX_MQTT_IP, false);
       success = true;
@@ -1004,19 +1454,20 @@ public:
   }
 
   /**
-   * Reads the MQTT IP-Address from the eeprom
+   * Reads the MQTT IP-Address from the storage
    * @return the ip
    */
   static IPAddress readMQTTIP() {
     IPAddress ip;
-    for (int i = 0; i < 4; i++) {
-      ip[i] = readUInt8(MQTT_IP_POS + i);
+    auto content = readBytes(MQTT_IP_POS, MQTT_IP_MAX_LEN);
+    for (size_t i = 0; i < content.size(); i++) {
+      ip[i] = (uint8_t) content[i];
     }
     return ip;
   }
 
   /**
-   * Checks if the there is a valid MQTT IP-Address stored in the EEPROM
+   * Checks if the there is a valid MQTT IP-Address stored in the storage
    * @return whether there is a valid ip
    */
   static bool hasValidMQTTIP() {
@@ -1024,7 +1475,7 @@ public:
   }
 
   /**
-   * Writes the MQTT port to the eeprom.
+   * Writes the MQTT port to the storage.
    * Write 0 to set port to 'no valid port'
    * @param port the port to be written
    * @return whether writing was successful
@@ -1042,7 +1493,7 @@ public:
   }
 
   /**
-   * Reads the MQTT port from the eeprom
+   * Reads the MQTT port from the storage
    * @return the port
    */
   static uint16_t readMQTTPort() {
@@ -1050,7 +1501,7 @@ public:
   }
 
   /**
-   * Checks if the there is a valid MQTT port stored in the EEPROM
+   * Checks if the there is a valid MQTT port stored in the storage
    * @return whether there is a valid port
    */
   static bool hasValidMQTTPort() {
@@ -1058,7 +1509,7 @@ public:
   }
 
   /**
-   * Writes the MQTT username to the eeprom
+   * Writes the MQTT username to the storage
    * @param username the username to be written
    * @return whether writing was successful
    */
@@ -1075,7 +1526,7 @@ public:
   }
 
   /**
-   * Reads the MQTT username from the eeprom
+   * Reads the MQTT username from the storage
    * @return the username
    */
   static std::string readMQTTUsername() {
@@ -1083,7 +1534,7 @@ public:
   }
 
   /**
-   * Checks if the there is a valid MQTT username stored in the EEPROM
+   * Checks if the there is a valid MQTT username stored in the storage
    * @return whether there is a valid username
    */
   static bool hasValidMQTTUsername() {
@@ -1091,7 +1542,7 @@ public:
   }
 
   /**
-  * Writes the MQTT password to the eeprom
+  * Writes the MQTT password to the storage
   * @param pw the password to be written
   * @return whether writing was successful
   */
@@ -1108,7 +1559,7 @@ public:
   }
 
   /**
-   * Reads the MQTT password from the eeprom
+   * Reads the MQTT password from the storage
    * @return the password
    */
   static std::string readMQTTPassword() {
@@ -1116,7 +1567,7 @@ public:
   }
 
   /**
-   * Checks if the there is a valid MQTT password stored in the EEPROM
+   * Checks if the there is a valid MQTT password stored in the storage
    * @return whether there is a valid password
    */
   static bool hasValidMQTTPassword() {
@@ -1124,7 +1575,7 @@ public:
   }
 
   /**
-   * Checks the EEPROM for valid wifi ssid + password and mqtt ip + port
+   * Checks the storage for valid wifi ssid + password and mqtt ip + port
    * @return whether all of these four are valid
    */
   static bool hasValidNetworkConfig() {
@@ -1132,49 +1583,34 @@ public:
   }
 
   /**
-   * Reads the content of the EEPROM
-   * @return the content of the first 500 cells of the EEPROM
+   * Erases the whole config log
+   * @return whether erasing was successful
    */
-  static std::string readWholeEEPROM() {
-    std::stringstream ss;
-    for (int i = 0; i < 500; i++) {
-      char bufchar = EEPROM.readChar(i);
-      if (bufchar == 0) {
-        ss << "\\n";
-      } else {
-        ss << bufchar;
-      }
+  static bool eraseStorage() {
+    gadgetIndex().valid = false;
+    if (!config_log.clear()) {
+      return false;
     }
-    return ss.str();
+    // The EEPROM was imported already
+    return writeUInt8(GADGET_FORMAT_POS, GADGET_FORMAT_VERSION);
   }
+};
 
-  /**
-   * Fills EEPROM with repeating '-_-_-_'-sequences
-   */
-  static void writeTestEEPROM() {
-    for (int i = 0; i < 750; i++) {
-      if (i % 2) {
-        EEPROM.writeChar(i, '-');
-      } else {
-        EEPROM.writeChar(i, '_');
-      }
-//      char k = (char) (48 + (i % 10));
-//      EEPROM.writeChar(i, k);
-    }
-
-    writeUInt8(GADGET_COUNT_POS, 0);
-    writeUInt8(VALID_CONFIG_BITFIELD_BYTE, 0);
-    writeUInt8(SYSTEM_SETTINGS_BITFIELD_BYTE, 0);
+inline StorageTransaction::StorageTransaction() :
+    active_(true) {
+  System_Storage::beginTransaction();
+}
 
-    EEPROM.commit();
+inline StorageTransaction::~StorageTransaction() {
+  if (active_) {
+    System_Storage::abortTransaction();
   }
+}
 
-  /**
-   * Returns the address of the last used byte in the eeprom.
-   * The maximum eeprom is EEPROM_SIZE
-   * @return the address of the last used byte in the eeprom
-   */
-  static uint16_t getEEPROMUsage() {
-    return getGadgetMemoryEnd(getGadgetCount() - 1);
+inline bool StorageTransaction::commit() {
+  if (!active_) {
+    return false;
   }
-};
+  active_ = false;
+  return System_Storage::commitTransaction();
+}
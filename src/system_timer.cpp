@@ -1,27 +1,58 @@
 #include "system_timer.h"
-#include <limits>
 
-SystemTimer::SystemTimer() = default;
+SystemTimer::SystemTimer() :
+    sequence_(0),
+    base_local_us_(0),
+    base_offset_us_(0),
+    drift_ppb_(0),
+    samples_(),
+    sample_count_(0),
+    sample_index_(0) {}
 
-unsigned long long SystemTimer::getTime() {
-  mtx.lock();
-  auto buf_time = time_ + millis();
+int64_t SystemTimer::getLocalTimeMicros() {
+  return esp_timer_get_time();
+}
 
-  // Detect if overflow has happened, compensate it if that's the case.
-  if (last_time_ > buf_time) {
-    time_ += std::numeric_limits<unsigned long long>::max();
-    buf_time = time_ + millis();
-  }
+int64_t SystemTimer::getTimeMicros() {
+  int64_t local_us = getLocalTimeMicros();
+  int64_t base_local_us;
+  int64_t base_offset_us;
+  int32_t drift_ppb;
+  uint32_t seq;
+
+  // Retry if the parameters were changed while reading them
+  do {
+    seq = sequence_.load(std::memory_order_acquire);
+    base_local_us = base_local_us_;
+    base_offset_us = base_offset_us_;
+    drift_ppb = drift_ppb_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != sequence_.load(std::memory_order_relaxed));
+
+  int64_t elapsed_us = local_us - base_local_us;
+  return local_us + base_offset_us + elapsed_us * drift_ppb / 1000000000LL;
+}
+
+unsigned long long SystemTimer::getTime() {
+  return (unsigned long long) (getTimeMicros() / 1000);
+}
 
-  last_time_ = buf_time;
-  mtx.unlock();
-  return buf_time;
+void SystemTimer::setParameters(int64_t base_local_us, int64_t base_offset_us, int32_t drift_ppb) {
+  // Critical section keeps readers on this core from spinning on a preempted writer
+  portENTER_CRITICAL(&write_mux_);
+  uint32_t seq = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  base_local_us_ = base_local_us;
+  base_offset_us_ = base_offset_us;
+  drift_ppb_ = drift_ppb;
+  sequence_.store(seq + 2, std::memory_order_release);
+  portEXIT_CRITICAL(&write_mux_);
 }
 
 void SystemTimer::setTime(const unsigned long long new_time, const unsigned long time_offset = 0) {
-  mtx.lock();
-  time_ = new_time - millis() + time_offset;
-  mtx.unlock();
+  int64_t local_us = getLocalTimeMicros();
+  setParameters(local_us, (int64_t) (new_time + time_offset) * 1000 - local_us, getDrift());
   logger.print("Setting System Time: ");
   logger.print(new_time);
   logger.print(" (+");
@@ -29,10 +60,119 @@ void SystemTimer::setTime(const unsigned long long new_time, const unsigned long
   logger.println(")");
   logger.incIndent();
   logger.print(LOG_TYPE::DATA, "System Launch Time: ");
-  logger.println(time_);
+  logger.println(new_time + time_offset - local_us / 1000);
   logger.print(LOG_TYPE::DATA, "Momentary System Time: ");
   logger.println(getTime());
   logger.decIndent();
 }
 
+bool SystemTimer::addSyncSample(int64_t client_send_us,
+                                unsigned long long server_receive_ms,
+                                unsigned long long server_send_ms,
+                                int64_t client_receive_us) {
+  int64_t server_receive_us = (int64_t) server_receive_ms * 1000;
+  int64_t server_send_us = (int64_t) server_send_ms * 1000;
+
+  int64_t delay_us = (client_receive_us - client_send_us) - (server_send_us - server_receive_us);
+  if (client_receive_us < client_send_us || delay_us < 0 || delay_us > TIME_SYNC_MAX_DELAY_MS * 1000LL) {
+    LOG_TOKEN(LOG_TYPE::WARN, "Rejected time sync sample (delay: %lld us)", delay_us);
+    return false;
+  }
+
+  // Assumes the same delay in both directions
+  int64_t offset_us = ((server_receive_us - client_send_us) + (server_send_us - client_receive_us)) / 2;
+
+  {
+    std::lock_guard<std::mutex> guard(sample_mutex_);
+    samples_[sample_index_] = {client_receive_us, offset_us, delay_us};
+    sample_index_ = (sample_index_ + 1) % TIME_SYNC_SAMPLES;
+    if (sample_count_ < TIME_SYNC_SAMPLES) {
+      sample_count_++;
+    }
+    applySamples();
+  }
+  return true;
+}
+
+void SystemTimer::applySamples() {
+  // The sample with the lowest delay has the smallest error on its offset
+  const SyncSample *best = &samples_[0];
+  int64_t first_local_us = samples_[0].local_us;
+  int64_t last_local_us = samples_[0].local_us;
+  for (byte i = 1; i < sample_count_; i++) {
+    if (samples_[i].delay_us < best->delay_us) {
+      best = &samples_[i];
+    }
+    if (samples_[i].local_us < first_local_us) {
+      first_local_us = samples_[i].local_us;
+    }
+    if (samples_[i].local_us > last_local_us) {
+      last_local_us = samples_[i].local_us;
+    }
+  }
+
+  // Drift is the slope of the offset over time (least squares), only meaningful for a long enough span
+  int32_t drift_ppb = getDrift();
+  if (sample_count_ >= 3 && last_local_us - first_local_us >= TIME_SYNC_MIN_DRIFT_SPAN_MS * 1000LL) {
+    double mean_x = 0;
+    double mean_y = 0;
+    for (byte i = 0; i < sample_count_; i++) {
+      mean_x += (double) (samples_[i].local_us - first_local_us);
+      mean_y += (double) samples_[i].offset_us;
+    }
+    mean_x /= sample_count_;
+    mean_y /= sample_count_;
+
+    double cov = 0;
+    double var = 0;
+    for (byte i = 0; i < sample_count_; i++) {
+      double dx = (double) (samples_[i].local_us - first_local_us) - mean_x;
+      cov += dx * ((double) samples_[i].offset_us - mean_y);
+      var += dx * dx;
+    }
+    if (var > 0) {
+      double slope_ppb = cov / var * 1e9;
+      if (slope_ppb > TIME_SYNC_MAX_DRIFT_PPM * 1000.0) {
+        slope_ppb = TIME_SYNC_MAX_DRIFT_PPM * 1000.0;
+      } else if (slope_ppb < -TIME_SYNC_MAX_DRIFT_PPM * 1000.0) {
+        slope_ppb = -TIME_SYNC_MAX_DRIFT_PPM * 1000.0;
+      }
+      drift_ppb = (int32_t) slope_ppb;
+    }
+  }
+
+  setParameters(best->local_us, best->offset_us, drift_ppb);
+  LOG_PRINTFLN(LOG_TYPE::DATA,
+               "Time synced: offset %lld us, delay %lld us, drift %ld ppb (%d samples)",
+               best->offset_us,
+               best->delay_us,
+               (long) drift_ppb,
+               sample_count_);
+}
+
+bool SystemTimer::hasSyncSamples() {
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  return sample_count_ > 0;
+}
+
+bool SystemTimer::isSet() {
+  return sequence_.load(std::memory_order_acquire) != 0;
+}
+
+void SystemTimer::restoreTime(int64_t system_us, int32_t drift_ppb) {
+  int64_t local_us = getLocalTimeMicros();
+  setParameters(local_us, system_us - local_us, drift_ppb);
+}
+
+int32_t SystemTimer::getDrift() {
+  uint32_t seq;
+  int32_t drift_ppb;
+  do {
+    seq = sequence_.load(std::memory_order_acquire);
+    drift_ppb = drift_ppb_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != sequence_.load(std::memory_order_relaxed));
+  return drift_ppb;
+}
+
 SystemTimer system_timer;
@@ -2,36 +2,130 @@
 
 #include "Arduino.h"
 #include "console_logger.h"
+#include "system_settings.h"
+#include <atomic>
 #include <mutex>
 
+/**
+ * System clock based on the 64 bit hardware microsecond timer.
+ * Reading the time is lock-free, the correction parameters are protected by a sequence counter.
+ */
 class SystemTimer {
 private:
 
-  // Reference value.
-  // time_ + millis() is the 'real' current time
-  unsigned long long time_ = 0;
+  /**
+   * A single NTP-style measurement
+   */
+  struct SyncSample {
+    // Local time the response was received at
+    int64_t local_us;
+    // Estimated difference between system time and local time
+    int64_t offset_us;
+    // Round trip time minus processing time of the bridge
+    int64_t delay_us;
+  };
+
+  // Odd while the correction parameters are being written
+  std::atomic<uint32_t> sequence_;
+
+  // Local time the parameters are anchored at
+  int64_t base_local_us_;
+
+  // Difference between system time and local time at base_local_us_
+  int64_t base_offset_us_;
+
+  // Speed difference between the local clock and the system clock in parts per billion
+  int32_t drift_ppb_;
+
+  // Keeps writers on different cores apart
+  portMUX_TYPE write_mux_ = portMUX_INITIALIZER_UNLOCKED;
+
+  // Last measurements, oldest ones get overwritten
+  SyncSample samples_[TIME_SYNC_SAMPLES];
+
+  // Count of measurements stored in samples_
+  byte sample_count_;
 
-  // Last accessed time.
-  unsigned long long  last_time_ = 0;
+  // Index the next measurement is written to
+  byte sample_index_;
 
-  // Mutex to lock resources for multithreading
-  std::mutex mtx;
+  // Guards the measurements
+  std::mutex sample_mutex_;
+
+  /**
+   * Publishes new correction parameters
+   * @param base_local_us Local time the parameters are anchored at
+   * @param base_offset_us Difference between system time and local time at base_local_us
+   * @param drift_ppb Speed difference of the clocks in parts per billion
+   */
+  void setParameters(int64_t base_local_us, int64_t base_offset_us, int32_t drift_ppb);
+
+  /**
+   * Estimates offset and drift from the stored measurements and publishes them
+   */
+  void applySamples();
 
 public:
   SystemTimer();
 
+  /**
+   * @return The local time in microseconds since launch
+   */
+  static int64_t getLocalTimeMicros();
+
   /**
    * Returns the current system time
-   * @return The current system time
+   * @return The current system time in milliseconds
    */
   unsigned long long getTime();
 
+  /**
+   * Returns the current system time in microseconds
+   * @return The current system time in microseconds
+   */
+  int64_t getTimeMicros();
+
   /**
    * Sets the system time reference
    * @param new_time The new system time
    * @param offset Offset to compensate for network delays
    */
   void setTime(unsigned long long new_time, unsigned long offset);
+
+  /**
+   * Adds a NTP-style measurement and updates the clock.
+   * @param client_send_us Local time the request was sent at
+   * @param server_receive_ms System time the bridge received the request at
+   * @param server_send_ms System time the bridge sent the response at
+   * @param client_receive_us Local time the response was received at
+   * @return Whether the measurement was accepted
+   */
+  bool addSyncSample(int64_t client_send_us,
+                     unsigned long long server_receive_ms,
+                     unsigned long long server_send_ms,
+                     int64_t client_receive_us);
+
+  /**
+   * @return Whether the clock was synced using measurements
+   */
+  bool hasSyncSamples();
+
+  /**
+   * @return Whether the system time was set since launch
+   */
+  bool isSet();
+
+  /**
+   * Sets the system time without logging, used to restore it after a reset
+   * @param system_us The current system time in microseconds
+   * @param drift_ppb Speed difference of the clocks in parts per billion
+   */
+  void restoreTime(int64_t system_us, int32_t drift_ppb);
+
+  /**
+   * @return The current drift estimation in parts per billion
+   */
+  int32_t getDrift();
 };
 
 extern SystemTimer system_timer;
@@ -0,0 +1,188 @@
+#include "task_profiler.h"
+#include "timer_wheel.h"
+#include "console_logger.h"
+
+#include <algorithm>
+
+TaskProfiler::TaskProfiler() :
+    loop_count_(0),
+    core_load_permille_{-1, -1},
+    last_total_run_time_(0) {
+  for (auto &loop: loops_) {
+    loop.name = nullptr;
+    loop.count = 0;
+    loop.max_duration = 0;
+    for (auto &bucket: loop.buckets) {
+      bucket = 0;
+    }
+  }
+}
+
+void TaskProfiler::begin() {
+  sample();
+  timer_wheel.schedulePeriodic(PROFILER_SAMPLE_INTERVAL_MS, std::bind(&TaskProfiler::sample, this));
+}
+
+void TaskProfiler::registerTask(TaskHandle_t task) {
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  registered_tasks_.push_back(task);
+}
+
+int TaskProfiler::registerLoop(const char *name) {
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  uint8_t index = loop_count_.load();
+  if (index >= PROFILER_MAX_LOOPS) {
+    return -1;
+  }
+  loops_[index].name = name;
+  loop_count_.store(index + 1);
+  return index;
+}
+
+void TaskProfiler::recordLoop(int loop, uint32_t duration_us) {
+  if (loop < 0 || loop >= loop_count_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  auto &stats = loops_[loop];
+  uint8_t bucket = 0;
+  while (bucket < PROFILER_HISTOGRAM_BUCKETS - 1 && (duration_us >> (bucket + 1)) != 0) {
+    bucket++;
+  }
+  stats.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  stats.count.fetch_add(1, std::memory_order_relaxed);
+  if (duration_us > stats.max_duration.load(std::memory_order_relaxed)) {
+    stats.max_duration.store(duration_us, std::memory_order_relaxed);
+  }
+}
+
+const TaskProfiler::TaskSample *TaskProfiler::findSample(TaskHandle_t handle) const {
+  for (auto &task: tasks_) {
+    if (task.handle == handle) {
+      return &task;
+    }
+  }
+  return nullptr;
+}
+
+void TaskProfiler::sample() {
+  std::vector<TaskSample> samples;
+
+#if PROFILER_HAS_RUN_TIME_STATS
+  std::vector<TaskStatus_t> states(uxTaskGetNumberOfTasks() + 2);
+  uint32_t total_run_time = 0;
+  states.resize(uxTaskGetSystemState(states.data(), states.size(), &total_run_time));
+
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  uint32_t elapsed = total_run_time - last_total_run_time_;
+  bool has_last_sample = last_total_run_time_ != 0 && elapsed != 0;
+
+  for (auto &state: states) {
+    auto last = findSample(state.xHandle);
+    int cpu_permille = -1;
+    if (has_last_sample && last != nullptr) {
+      cpu_permille = (int) ((uint64_t) (state.ulRunTimeCounter - last->run_time) * 1000 / elapsed);
+    }
+    BaseType_t affinity = xTaskGetAffinity(state.xHandle);
+    samples.push_back({state.xHandle,
+                       state.pcTaskName,
+                       affinity == tskNO_AFFINITY ? -1 : (int) affinity,
+                       cpu_permille,
+                       (uint32_t) state.usStackHighWaterMark,
+                       state.ulRunTimeCounter});
+  }
+
+  // Everything a core did not spend idling is load
+  for (int core = 0; core < 2; core++) {
+    core_load_permille_[core] = -1;
+    TaskHandle_t idle_task = xTaskGetIdleTaskHandleForCPU(core);
+    for (auto &task: samples) {
+      if (task.handle == idle_task && task.cpu_permille >= 0) {
+        core_load_permille_[core] = std::max(0, 1000 - task.cpu_permille);
+      }
+    }
+  }
+  last_total_run_time_ = total_run_time;
+#else
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  for (auto task: registered_tasks_) {
+    samples.push_back({task, pcTaskGetTaskName(task), -1, -1, (uint32_t) uxTaskGetStackHighWaterMark(task), 0});
+  }
+#endif
+
+  tasks_ = std::move(samples);
+}
+
+int TaskProfiler::getCoreLoad(int core) {
+  if (core < 0 || core > 1) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  return core_load_permille_[core];
+}
+
+void TaskProfiler::printReport() {
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  LOG_TOKEN(LOG_TYPE::INFO, "Task Profile:");
+  logger.incIndent();
+  LOG_TOKEN(LOG_TYPE::INFO, "Core Load: %d / %d (0.1 %%)", core_load_permille_[0], core_load_permille_[1]);
+  for (auto &task: tasks_) {
+    logger.printfln("%-16s core: %2d, cpu: %4d (0.1 %%), stack free: %5u bytes",
+                    task.name.c_str(),
+                    task.core,
+                    task.cpu_permille,
+                    (unsigned) task.stack_free);
+  }
+  for (uint8_t i = 0; i < loop_count_.load(); i++) {
+    auto &loop = loops_[i];
+    logger.printfln("Loop '%s': %u runs, max %u us",
+                    loop.name,
+                    (unsigned) loop.count.load(),
+                    (unsigned) loop.max_duration.load());
+    logger.incIndent();
+    for (uint8_t bucket = 0; bucket < PROFILER_HISTOGRAM_BUCKETS; bucket++) {
+      uint32_t count = loop.buckets[bucket].load();
+      if (count > 0) {
+        LOG_TOKEN(LOG_TYPE::INFO, ">= %8lu us: %u", bucket == 0 ? 0UL : 1UL << bucket, (unsigned) count);
+      }
+    }
+    logger.decIndent();
+  }
+  logger.decIndent();
+}
+
+void TaskProfiler::serializeTasks(DynamicJsonDocument &doc, size_t offset) {
+  std::lock_guard<std::mutex> guard(sample_mutex_);
+  doc["task_count"] = tasks_.size();
+  doc["offset"] = offset;
+  JsonArray tasks = doc.createNestedArray("tasks");
+  for (size_t i = offset; i < tasks_.size() && i < offset + PROFILER_TASKS_PER_MESSAGE; i++) {
+    auto &task = tasks_[i];
+    JsonObject task_obj = tasks.createNestedObject();
+    task_obj["name"] = task.name;
+    task_obj["core"] = task.core;
+    task_obj["cpu"] = task.cpu_permille;
+    task_obj["stack"] = task.stack_free;
+  }
+}
+
+void TaskProfiler::serializeLoops(DynamicJsonDocument &doc) {
+  {
+    std::lock_guard<std::mutex> guard(sample_mutex_);
+    JsonArray core_load = doc.createNestedArray("core_load");
+    core_load.add(core_load_permille_[0]);
+    core_load.add(core_load_permille_[1]);
+  }
+  JsonObject loops = doc.createNestedObject("loops");
+  for (uint8_t i = 0; i < loop_count_.load(); i++) {
+    auto &loop = loops_[i];
+    JsonObject loop_obj = loops.createNestedObject(loop.name);
+    loop_obj["count"] = loop.count.load();
+    loop_obj["max"] = loop.max_duration.load();
+    JsonArray buckets = loop_obj.createNestedArray("hist");
+    for (auto &bucket: loop.buckets) {
+      buckets.add(bucket.load());
+    }
+  }
+}
+
+TaskProfiler task_profiler;
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Arduino.h"
+#include <ArduinoJson.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "system_settings.h"
+
+// Run time counters are only available if FreeRTOS collects them, otherwise only stacks are sampled
+#if configUSE_TRACE_FACILITY == 1 && configGENERATE_RUN_TIME_STATS == 1
+#define PROFILER_HAS_RUN_TIME_STATS 1
+#else
+#define PROFILER_HAS_RUN_TIME_STATS 0
+#endif
+
+/**
+ * Samples the CPU usage and stack high-water mark of the FreeRTOS tasks and collects loop duration histograms.
+ * Tasks are sampled periodically by the timer wheel, loops record their durations themselves.
+ */
+class TaskProfiler {
+private:
+
+  /**
+   * Sampled state of a task
+   */
+  struct TaskSample {
+    TaskHandle_t handle;
+    std::string name;
+    // Core the task is pinned to, -1 if it may run on both
+    int core;
+    // Share of one core the task used since the last sample in 0.1 %, -1 if unknown
+    int cpu_permille;
+    // Least free stack space since the task started in bytes
+    uint32_t stack_free;
+    // Run time counter of the last sample
+    uint32_t run_time;
+  };
+
+  /**
+   * Duration histogram of a loop, bucket i counts durations of [2^i, 2^(i + 1)) us.
+   * Written by the task running the loop only.
+   */
+  struct LoopStats {
+    const char *name;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> max_duration;
+    std::atomic<uint32_t> buckets[PROFILER_HISTOGRAM_BUCKETS];
+  };
+
+  LoopStats loops_[PROFILER_MAX_LOOPS];
+  std::atomic<uint8_t> loop_count_;
+
+  // Tasks sampled without run time stats
+  std::vector<TaskHandle_t> registered_tasks_;
+
+  std::vector<TaskSample> tasks_;
+
+  // Load of both cores since the last sample in 0.1 %, -1 if unknown
+  int core_load_permille_[2];
+
+  // Total run time counter of the last sample
+  uint32_t last_total_run_time_;
+
+  // Guards the samples and the registered tasks
+  std::mutex sample_mutex_;
+
+  /**
+   * Finds the sample of a task from the last run. sample_mutex_ has to be held by the caller.
+   * @param handle The handle of the task
+   * @return The sample or nullptr if the task was not sampled before
+   */
+  const TaskSample *findSample(TaskHandle_t handle) const;
+
+public:
+  TaskProfiler();
+
+  /**
+   * Takes a first sample and starts sampling periodically
+   */
+  void begin();
+
+  /**
+   * Adds a task to sample if run time stats are not available (all tasks are sampled otherwise)
+   * @param task The task
+   */
+  void registerTask(TaskHandle_t task);
+
+  /**
+   * Adds a loop to collect durations for
+   * @param name Name of the loop, has to stay valid
+   * @return Index of the loop or -1 if PROFILER_MAX_LOOPS are registered already
+   */
+  int registerLoop(const char *name);
+
+  /**
+   * Adds the duration of one run to the histogram of a loop. Must only be called by the task running the loop.
+   * @param loop Index of the loop
+   * @param duration_us Duration of the run
+   */
+  void recordLoop(int loop, uint32_t duration_us);
+
+  /**
+   * Samples CPU usage and stack of the tasks
+   */
+  void sample();
+
+  /**
+   * @param core The core
+   * @return Load of the core since the last sample in 0.1 %, -1 if unknown
+   */
+  int getCoreLoad(int core);
+
+  /**
+   * Prints all sampled tasks and loop histograms to the console
+   */
+  void printReport();
+
+  /**
+   * Writes a part of the sampled tasks, kept short to fit into a single message
+   * @param doc Document to write to
+   * @param offset Index of the first task to write
+   */
+  void serializeTasks(DynamicJsonDocument &doc, size_t offset);
+
+  /**
+   * Writes the core load and the loop histograms
+   * @param doc Document to write to
+   */
+  void serializeLoops(DynamicJsonDocument &doc);
+};
+
+extern TaskProfiler task_profiler;
@@ -0,0 +1,232 @@
+#include "timer_wheel.h"
+
+#include <utility>
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// Longest delay that fits into the wheel, longer timers are cascaded down again until they fit
+#define TIMER_WHEEL_MAX_DELTA ((1UL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+TimerWheel::TimerWheel() :
+    free_list_(0),
+    current_tick_(0),
+    running_node_(-1),
+    running_cancelled_(false),
+    timer_task_(nullptr) {
+  for (auto &slot: slots_) {
+    slot = -1;
+  }
+  for (int16_t i = 0; i < TIMER_WHEEL_MAX_TIMERS; i++) {
+    nodes_[i].generation = 1;
+    nodes_[i].prev = -1;
+    nodes_[i].next = i + 1 < TIMER_WHEEL_MAX_TIMERS ? i + 1 : -1;
+    nodes_[i].slot = -1;
+    nodes_[i].in_use = false;
+  }
+}
+
+bool TimerWheel::begin() {
+  auto status = xTaskCreatePinnedToCore(
+      timerTask,                        /* Task function. */
+      "Smarthome_Timer",        /* String with name of task. */
+      TIMER_WHEEL_TASK_STACK,   /* Stack size in words. */
+      this,                 /* Parameter passed as input of the task */
+      TIMER_WHEEL_TASK_PRIORITY, /* Priority of the task. */
+      &timer_task_,                     /* Task handle. */
+      TIMER_WHEEL_TASK_CORE);   /* Core to run on */
+  return status == pdPASS;
+}
+
+[[noreturn]] void TimerWheel::timerTask(void *args) {
+  auto wheel = (TimerWheel *) args;
+  TickType_t last_wake = xTaskGetTickCount();
+  while (true) {
+    vTaskDelayUntil(&last_wake, TIMER_WHEEL_TICK_MS / portTICK_PERIOD_MS);
+    wheel->advance();
+  }
+}
+
+uint32_t TimerWheel::msToTicks(unsigned long duration_ms) {
+  uint32_t ticks = (duration_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+  return ticks == 0 ? 1 : ticks;
+}
+
+TimerHandle TimerWheel::getHandle(int16_t index) const {
+  return ((uint32_t) nodes_[index].generation << 16) | (uint32_t) (index + 1);
+}
+
+int16_t TimerWheel::resolveHandle(TimerHandle handle) const {
+  auto index = (int32_t) (handle & 0xFFFF) - 1;
+  if (index < 0 || index >= TIMER_WHEEL_MAX_TIMERS) {
+    return -1;
+  }
+  auto &node = nodes_[index];
+  if (!node.in_use || node.generation != (handle >> 16)) {
+    return -1;
+  }
+  return (int16_t) index;
+}
+
+void TimerWheel::linkNode(int16_t index) {
+  auto &node = nodes_[index];
+  uint32_t delta = node.expires - current_tick_;
+  uint32_t slot;
+  if (delta < TIMER_WHEEL_SLOTS) {
+    slot = node.expires & TIMER_WHEEL_SLOT_MASK;
+  } else {
+    uint32_t target = node.expires;
+    if (delta > TIMER_WHEEL_MAX_DELTA) {
+      target = current_tick_ + TIMER_WHEEL_MAX_DELTA;
+      delta = TIMER_WHEEL_MAX_DELTA;
+    }
+    byte level = 1;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1UL << (TIMER_WHEEL_SLOT_BITS * (level + 1)))) {
+      level++;
+    }
+    slot = level * TIMER_WHEEL_SLOTS + ((target >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK);
+  }
+
+  node.slot = (int16_t) slot;
+  node.prev = -1;
+  node.next = slots_[slot];
+  if (node.next != -1) {
+    nodes_[node.next].prev = index;
+  }
+  slots_[slot] = index;
+}
+
+void TimerWheel::unlinkNode(int16_t index) {
+  auto &node = nodes_[index];
+  if (node.slot == -1) {
+    return;
+  }
+  if (node.prev != -1) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    slots_[node.slot] = node.next;
+  }
+  if (node.next != -1) {
+    nodes_[node.next].prev = node.prev;
+  }
+  node.prev = -1;
+  node.next = -1;
+  node.slot = -1;
+}
+
+void TimerWheel::releaseNode(int16_t index) {
+  auto &node = nodes_[index];
+  unlinkNode(index);
+  node.callback = nullptr;
+  node.in_use = false;
+  node.generation = node.generation == 0xFFFF ? 1 : node.generation + 1;
+  node.next = free_list_;
+  free_list_ = index;
+}
+
+void TimerWheel::cascade(byte level, uint32_t slot_index) {
+  auto slot = level * TIMER_WHEEL_SLOTS + slot_index;
+  int16_t index = slots_[slot];
+  slots_[slot] = -1;
+  while (index != -1) {
+    int16_t next = nodes_[index].next;
+    nodes_[index].slot = -1;
+    linkNode(index);
+    index = next;
+  }
+}
+
+void TimerWheel::advance() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  current_tick_++;
+
+  // Move the timers of the next higher slot down every time a level wraps around
+  uint32_t slot_index = current_tick_ & TIMER_WHEEL_SLOT_MASK;
+  for (byte level = 1; level < TIMER_WHEEL_LEVELS && slot_index == 0; level++) {
+    slot_index = (current_tick_ >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+    cascade(level, slot_index);
+  }
+
+  uint32_t expired_slot = current_tick_ & TIMER_WHEEL_SLOT_MASK;
+  while (slots_[expired_slot] != -1) {
+    int16_t index = slots_[expired_slot];
+    unlinkNode(index);
+    auto &node = nodes_[index];
+
+    // Run the callback without holding the lock, so it can schedule or cancel timers itself
+    running_node_ = index;
+    running_cancelled_ = false;
+    if (node.callback) {
+      lock.unlock();
+      node.callback();
+      lock.lock();
+    }
+    running_node_ = -1;
+
+    if (node.interval != 0 && !running_cancelled_) {
+      node.expires = current_tick_ + node.interval;
+      linkNode(index);
+    } else {
+      releaseNode(index);
+    }
+  }
+}
+
+TimerHandle TimerWheel::addTimer(unsigned long delay_ms, unsigned long interval_ms, std::function<void()> callback) {
+  std::lock_guard<std::mutex> guard(mtx_);
+  if (free_list_ == -1) {
+    return TIMER_HANDLE_INVALID;
+  }
+  int16_t index = free_list_;
+  auto &node = nodes_[index];
+  free_list_ = node.next;
+
+  node.callback = std::move(callback);
+  node.expires = current_tick_ + msToTicks(delay_ms);
+  node.interval = interval_ms == 0 ? 0 : msToTicks(interval_ms);
+  node.in_use = true;
+  linkNode(index);
+  return getHandle(index);
+}
+
+TimerHandle TimerWheel::schedule(unsigned long delay_ms, std::function<void()> callback) {
+  return addTimer(delay_ms, 0, std::move(callback));
+}
+
+TimerHandle TimerWheel::schedulePeriodic(unsigned long interval_ms, std::function<void()> callback) {
+  return addTimer(interval_ms, interval_ms, std::move(callback));
+}
+
+bool TimerWheel::reschedule(TimerHandle handle, unsigned long delay_ms) {
+  std::lock_guard<std::mutex> guard(mtx_);
+  int16_t index = resolveHandle(handle);
+  if (index == -1 || index == running_node_) {
+    return false;
+  }
+  unlinkNode(index);
+  nodes_[index].expires = current_tick_ + msToTicks(delay_ms);
+  linkNode(index);
+  return true;
+}
+
+bool TimerWheel::cancel(TimerHandle handle) {
+  std::lock_guard<std::mutex> guard(mtx_);
+  int16_t index = resolveHandle(handle);
+  if (index == -1) {
+    return false;
+  }
+  if (index == running_node_) {
+    // Released by advance() once the callback returns
+    running_cancelled_ = true;
+    return true;
+  }
+  releaseNode(index);
+  return true;
+}
+
+bool TimerWheel::isActive(TimerHandle handle) {
+  std::lock_guard<std::mutex> guard(mtx_);
+  int16_t index = resolveHandle(handle);
+  return index != -1 && !(index == running_node_ && running_cancelled_);
+}
+
+TimerWheel timer_wheel;
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "Arduino.h"
+#include <functional>
+#include <mutex>
+#include "system_settings.h"
+
+// Identifies a scheduled timer. Handles of expired or cancelled timers become invalid and are never reused right away.
+typedef uint32_t TimerHandle;
+
+#define TIMER_HANDLE_INVALID 0
+
+// Slots per wheel level, has to be a power of two
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * Hierarchical timer wheel running one-shot and periodic callbacks from a single task.
+ * Scheduling and cancelling take constant time, every tick only touches the timers expiring in it.
+ * Callbacks run on the timer task and have to be short, longer work should be handed to another task.
+ */
+class TimerWheel {
+private:
+
+  /**
+   * A scheduled timer, linked into the list of its slot
+   */
+  struct TimerNode {
+    std::function<void()> callback;
+    // Tick the timer expires at
+    uint32_t expires;
+    // Ticks between two runs, 0 for one-shot timers
+    uint32_t interval;
+    // Increased every time the node is released to invalidate old handles
+    uint16_t generation;
+    int16_t prev;
+    int16_t next;
+    // Index of the slot list the node is linked into, -1 if not linked
+    int16_t slot;
+    bool in_use;
+  };
+
+  TimerNode nodes_[TIMER_WHEEL_MAX_TIMERS];
+
+  // First node of every slot list, -1 if empty
+  int16_t slots_[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+
+  // First unused node
+  int16_t free_list_;
+
+  // Last tick that was processed
+  uint32_t current_tick_;
+
+  // Timer whose callback is currently running, its handle stays valid during the run
+  int16_t running_node_;
+
+  // Whether the running timer was cancelled by its own callback or another task
+  bool running_cancelled_;
+
+  std::mutex mtx_;
+
+  TaskHandle_t timer_task_;
+
+  /**
+   * Function for the timer task
+   * @param args Pointer to the timer wheel
+   */
+  [[noreturn]] static void timerTask(void *args);
+
+  /**
+   * Converts a duration to ticks, rounded up and at least one tick
+   * @param duration_ms The duration
+   * @return The ticks
+   */
+  static uint32_t msToTicks(unsigned long duration_ms);
+
+  /**
+   * Builds the handle for a node
+   * @param index Index of the node
+   * @return The handle
+   */
+  TimerHandle getHandle(int16_t index) const;
+
+  /**
+   * Gets the node a handle points to. mtx_ has to be held by the caller.
+   * @param handle The handle
+   * @return The index of the node or -1 if the handle is not valid anymore
+   */
+  int16_t resolveHandle(TimerHandle handle) const;
+
+  /**
+   * Links a node into the slot matching its expiry tick. mtx_ has to be held by the caller.
+   * @param index Index of the node
+   */
+  void linkNode(int16_t index);
+
+  /**
+   * Removes a node from its slot. mtx_ has to be held by the caller.
+   * @param index Index of the node
+   */
+  void unlinkNode(int16_t index);
+
+  /**
+   * Returns a node to the free list. mtx_ has to be held by the caller.
+   * @param index Index of the node
+   */
+  void releaseNode(int16_t index);
+
+  /**
+   * Moves all nodes of a higher level slot to the lower levels. mtx_ has to be held by the caller.
+   * @param level The level of the slot
+   * @param slot_index The index of the slot in its level
+   */
+  void cascade(byte level, uint32_t slot_index);
+
+  /**
+   * Processes the next tick and runs all timers expiring in it
+   */
+  void advance();
+
+  /**
+   * Adds a timer
+   * @param delay_ms Time until the first run
+   * @param interval_ms Time between two runs, 0 for one-shot timers
+   * @param callback Function to run
+   * @return Handle of the timer or TIMER_HANDLE_INVALID if all timers are in use
+   */
+  TimerHandle addTimer(unsigned long delay_ms, unsigned long interval_ms, std::function<void()> callback);
+
+public:
+  TimerWheel();
+
+  /**
+   * Starts the timer task
+   * @return Whether the task could be started
+   */
+  bool begin();
+
+  /**
+   * Runs a callback once after a delay
+   * @param delay_ms Time until the callback runs
+   * @param callback Function to run, may be empty for timers that are only checked using isActive()
+   * @return Handle of the timer or TIMER_HANDLE_INVALID if all timers are in use
+   */
+  TimerHandle schedule(unsigned long delay_ms, std::function<void()> callback);
+
+  /**
+   * Runs a callback periodically
+   * @param interval_ms Time between two runs
+   * @param callback Function to run
+   * @return Handle of the timer or TIMER_HANDLE_INVALID if all timers are in use
+   */
+  TimerHandle schedulePeriodic(unsigned long interval_ms, std::function<void()> callback);
+
+  /**
+   * Moves the expiry of a pending timer
+   * @param handle Handle of the timer
+   * @param delay_ms New time until the timer runs
+   * @return Whether the timer was still pending
+   */
+  bool reschedule(TimerHandle handle, unsigned long delay_ms);
+
+  /**
+   * Cancels a timer. Cancelling a periodic timer from its own callback stops it after the current run.
+   * @param handle Handle of the timer
+   * @return Whether the timer was still active
+   */
+  bool cancel(TimerHandle handle);
+
+  /**
+   * @param handle Handle of the timer
+   * @return Whether the timer is still pending or running
+   */
+  bool isActive(TimerHandle handle);
+};
+
+extern TimerWheel timer_wheel;
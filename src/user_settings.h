@@ -1,3 +1,31 @@
 #define DEBUG_MESSAGES
 
-#define LOGGING_ACTIVE 1
\ No newline at end of file
+#define LOGGING_ACTIVE 1
+// Lowest level that is compiled into the firmware (see LOG_LEVEL_* in console_logger.h). Can be overridden by a build flag.
+#ifndef LOGGER_MIN_LEVEL
+#ifdef DEBUG_MESSAGES
+#define LOGGER_MIN_LEVEL LOG_LEVEL_DATA
+#else
+#define LOGGER_MIN_LEVEL LOG_LEVEL_WARN
+#endif
+#endif
+
+// Sends LOG_TOKEN() lines as ids and raw arguments instead of formatted text. Decode them with decode_log.py.
+#ifndef LOGGER_TOKENIZED
+#define LOGGER_TOKENIZED 0
+#endif
+
+// Counts the allocations of every subsystem by replacing operator new and delete, costs 8 bytes per allocation.
+// Only active in debug builds. Can be overridden by a build flag.
+#ifndef HEAP_TRACER_ACTIVE
+#ifdef DEBUG_MESSAGES
+#define HEAP_TRACER_ACTIVE 1
+#else
+#define HEAP_TRACER_ACTIVE 0
+#endif
+#endif
+
+// Minimum time between two writes of the gadget state journal, changes in between are written together
+#ifndef STATE_JOURNAL_INTERVAL_MS
+#define STATE_JOURNAL_INTERVAL_MS 5000
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core and FreeRTOS used by the modules built in the native env.
+// There is only a single task, nothing is scheduled and the serial output goes to stdout.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+typedef uint8_t byte;
+
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define MALLOC_CAP_8BIT 4
+
+/**
+ * @return Time since the process started in us
+ */
+inline unsigned long micros() {
+  static auto start = std::chrono::steady_clock::now();
+  return (unsigned long) std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline TickType_t xTaskGetTickCount() {
+  return (TickType_t) millis();
+}
+
+inline BaseType_t xPortGetCoreID() {
+  return 0;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  static int task;
+  return &task;
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void *), const char *, uint32_t, void *, UBaseType_t,
+                                          TaskHandle_t *, BaseType_t) {
+  return pdFAIL;
+}
+
+inline void vTaskDelayUntil(TickType_t *, TickType_t) {}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) {
+  return 0;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t) {
+  return pdPASS;
+}
+
+inline size_t heap_caps_get_largest_free_block(uint32_t) {
+  return 0;
+}
+
+class HostSerial {
+public:
+  size_t write(const uint8_t *data, size_t len) {
+    return fwrite(data, 1, len, stdout);
+  }
+
+  template<typename... Args>
+  int printf(const char *format, Args... args) {
+    return ::printf(format, args...);
+  }
+};
+
+class HostEsp {
+public:
+  uint32_t getFreeHeap() {
+    return 0;
+  }
+
+  uint32_t getMinFreeHeap() {
+    return 0;
+  }
+};
+
+static HostSerial Serial;
+static HostEsp ESP;
@@ -0,0 +1,25 @@
+#pragma once
+
+// The ring is never created on the host, so the serial output is written directly
+
+#include "Arduino.h"
+
+typedef void *RingbufHandle_t;
+
+typedef enum {
+  RINGBUF_TYPE_NOSPLIT, RINGBUF_TYPE_ALLOWSPLIT, RINGBUF_TYPE_BYTEBUF
+} RingbufferType_t;
+
+inline RingbufHandle_t xRingbufferCreate(size_t, RingbufferType_t) {
+  return nullptr;
+}
+
+inline BaseType_t xRingbufferSend(RingbufHandle_t, const void *, size_t, TickType_t) {
+  return pdFALSE;
+}
+
+inline void *xRingbufferReceiveUpTo(RingbufHandle_t, size_t *, TickType_t, size_t) {
+  return nullptr;
+}
+
+inline void vRingbufferReturnItem(RingbufHandle_t, void *) {}
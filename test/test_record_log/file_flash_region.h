@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include "flash_region.h"
+
+/**
+ * Flash region backed by a memory mapped file, the host stand-in for a partition mapped to the data cache.
+ * The file keeps the content after the region is destroyed, so reopening it is like rebooting.
+ */
+class FileFlashRegion : public FlashRegion {
+private:
+  std::string path_;
+
+  size_t size_;
+
+  int file_;
+
+  uint8_t *mapping_;
+
+public:
+  /**
+   * @param path Path of the file, created if it does not exist
+   * @param sectors Number of sectors
+   */
+  FileFlashRegion(std::string path, size_t sectors) :
+      path_(std::move(path)),
+      size_(sectors * FLASH_SECTOR_SIZE),
+      file_(-1),
+      mapping_(nullptr) {}
+
+  ~FileFlashRegion() override {
+    if (mapping_ != nullptr) {
+      munmap(mapping_, size_);
+    }
+    if (file_ >= 0) {
+      close(file_);
+    }
+  }
+
+  FileFlashRegion(const FileFlashRegion &) = delete;
+
+  FileFlashRegion &operator=(const FileFlashRegion &) = delete;
+
+  bool begin() override {
+    file_ = open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat file_stat;
+    if (file_ < 0 || fstat(file_, &file_stat) != 0) {
+      return false;
+    }
+    bool created = (size_t) file_stat.st_size != size_;
+    if (created && ftruncate(file_, (off_t) size_) != 0) {
+      return false;
+    }
+    void *mapping = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, file_, 0);
+    if (mapping == MAP_FAILED) {
+      return false;
+    }
+    mapping_ = (uint8_t *) mapping;
+    if (created) {
+      memset(mapping_, 0xFF, size_);
+    }
+    return true;
+  }
+
+  size_t getSize() const override {
+    return size_;
+  }
+
+  bool read(size_t offset, void *data, size_t len) override {
+    if (mapping_ == nullptr || offset + len > size_) {
+      return false;
+    }
+    memcpy(data, mapping_ + offset, len);
+    return true;
+  }
+
+  bool write(size_t offset, const void *data, size_t len) override {
+    if (mapping_ == nullptr || offset + len > size_) {
+      return false;
+    }
+    auto bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < len; i++) {
+      mapping_[offset + i] &= bytes[i];
+    }
+    return true;
+  }
+
+  bool eraseSector(size_t sector) override {
+    if (mapping_ == nullptr || (sector + 1) * FLASH_SECTOR_SIZE > size_) {
+      return false;
+    }
+    memset(mapping_ + sector * FLASH_SECTOR_SIZE, 0xFF, FLASH_SECTOR_SIZE);
+    return true;
+  }
+
+  const uint8_t *getMapping() const override {
+    return mapping_;
+  }
+};
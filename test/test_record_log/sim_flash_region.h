@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include "flash_region.h"
+
+/**
+ * Thrown out of a write or erase of a SimFlashRegion when its power is cut
+ */
+struct PowerCut {};
+
+/**
+ * NOR flash simulated in RAM. Counts the erases of every sector and cuts the power after a number of written bytes,
+ * leaving a partially written record or a half erased sector behind.
+ */
+class SimFlashRegion : public FlashRegion {
+private:
+  std::vector<uint8_t> data_;
+
+  std::vector<uint32_t> erase_counts_;
+
+  // Bytes and erases left until the power is cut, negative if it is never cut
+  long budget_;
+
+  bool mapped_;
+
+  void consumeBudget() {
+    if (budget_ == 0) {
+      throw PowerCut();
+    }
+    if (budget_ > 0) {
+      budget_--;
+    }
+  }
+
+public:
+  /**
+   * @param sectors Number of sectors
+   * @param mapped Whether the region can be mapped
+   */
+  explicit SimFlashRegion(size_t sectors, bool mapped = false) :
+      data_(sectors * FLASH_SECTOR_SIZE, 0xFF),
+      erase_counts_(sectors, 0),
+      budget_(-1),
+      mapped_(mapped) {}
+
+  bool begin() override {
+    return true;
+  }
+
+  size_t getSize() const override {
+    return data_.size();
+  }
+
+  bool read(size_t offset, void *data, size_t len) override {
+    if (offset + len > data_.size()) {
+      return false;
+    }
+    memcpy(data, &data_[offset], len);
+    return true;
+  }
+
+  bool write(size_t offset, const void *data, size_t len) override {
+    if (offset + len > data_.size()) {
+      return false;
+    }
+    auto bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < len; i++) {
+      consumeBudget();
+      // Writing can only clear bits
+      data_[offset + i] &= bytes[i];
+    }
+    return true;
+  }
+
+  bool eraseSector(size_t sector) override {
+    if (sector >= erase_counts_.size()) {
+      return false;
+    }
+    if (budget_ == 1) {
+      budget_ = 0;
+      memset(&data_[sector * FLASH_SECTOR_SIZE], 0xFF, FLASH_SECTOR_SIZE / 2);
+      throw PowerCut();
+    }
+    consumeBudget();
+    memset(&data_[sector * FLASH_SECTOR_SIZE], 0xFF, FLASH_SECTOR_SIZE);
+    erase_counts_[sector]++;
+    return true;
+  }
+
+  const uint8_t *getMapping() const override {
+    return mapped_ ? data_.data() : nullptr;
+  }
+
+  /**
+   * Cuts the power during a later write or erase
+   * @param budget Bytes to write and sectors to erase before, an erase using up the last one is interrupted halfway
+   */
+  void cutPowerAfter(long budget) {
+    budget_ = budget;
+  }
+
+  /**
+   * Lets writes and erases succeed again
+   */
+  void restorePower() {
+    budget_ = -1;
+  }
+
+  /**
+   * @param sector Index of the sector
+   * @return Times the sector was erased
+   */
+  uint32_t getEraseCount(size_t sector) const {
+    return erase_counts_[sector];
+  }
+
+  /**
+   * @return Number of sectors
+   */
+  size_t getSectorCount() const {
+    return erase_counts_.size();
+  }
+};
@@ -0,0 +1,279 @@
+#include <unity.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "file_flash_region.h"
+#include "record_log.h"
+#include "sim_flash_region.h"
+
+#define TEST_SECTORS 8
+
+typedef std::map<std::string, std::string> Contents;
+
+void setUp() {}
+
+void tearDown() {}
+
+/**
+ * Reads a value through view()
+ * @param log The log to read
+ * @param key The key
+ * @param region Region the value has to be mapped from, nullptr if it may be copied
+ * @return The value, empty if the key has none
+ */
+static std::string viewValue(RecordLog &log, const std::string &key, const FlashRegion *region) {
+  std::string value;
+  bool found = log.view(key, [&value, region](const uint8_t *data, size_t len) {
+    if (region != nullptr) {
+      const uint8_t *mapping = region->getMapping();
+      TEST_ASSERT_TRUE(data >= mapping && data + len <= mapping + region->getSize());
+    }
+    value.assign((const char *) data, len);
+  });
+  TEST_ASSERT_EQUAL(found, !value.empty());
+  return value;
+}
+
+/**
+ * Reads the values of all keys ever written
+ * @param log The log to read
+ * @param keys The keys ever written
+ * @return The keys that have a value and their values
+ */
+static Contents readContents(RecordLog &log, const Contents &keys) {
+  Contents contents;
+  for (auto &key: keys) {
+    std::string value;
+    if (log.get(key.first, value)) {
+      contents[key.first] = value;
+    }
+  }
+  return contents;
+}
+
+void test_values_survive_reboot() {
+  SimFlashRegion flash(TEST_SECTORS);
+  {
+    RecordLog log(flash, "test");
+    TEST_ASSERT_TRUE(log.begin());
+    TEST_ASSERT_TRUE(log.put("kept", "1"));
+    TEST_ASSERT_TRUE(log.put("changed", "1"));
+    TEST_ASSERT_TRUE(log.put("changed", "2"));
+    TEST_ASSERT_TRUE(log.put("removed", "1"));
+    TEST_ASSERT_TRUE(log.remove("removed"));
+  }
+  RecordLog log(flash, "test");
+  TEST_ASSERT_TRUE(log.begin());
+  std::string value;
+  TEST_ASSERT_TRUE(log.get("kept", value));
+  TEST_ASSERT_EQUAL_STRING("1", value.c_str());
+  TEST_ASSERT_TRUE(log.get("changed", value));
+  TEST_ASSERT_EQUAL_STRING("2", value.c_str());
+  TEST_ASSERT_FALSE(log.contains("removed"));
+}
+
+void test_aborted_nested_batch_fails_outer_batch() {
+  SimFlashRegion flash(TEST_SECTORS);
+  RecordLog log(flash, "test");
+  TEST_ASSERT_TRUE(log.begin());
+  TEST_ASSERT_TRUE(log.put("a", "0"));
+
+  log.beginBatch();
+  log.put("a", "1");
+  log.beginBatch();
+  log.put("b", "1");
+  log.abortBatch();
+  // Still staged, the outer batch is running
+  log.put("c", "1");
+  {
+    RecordLog rebooted(flash, "test");
+    TEST_ASSERT_TRUE(rebooted.begin());
+    TEST_ASSERT_FALSE(rebooted.contains("c"));
+  }
+  TEST_ASSERT_FALSE(log.commitBatch());
+
+  std::string value;
+  TEST_ASSERT_TRUE(log.get("a", value));
+  TEST_ASSERT_EQUAL_STRING("0", value.c_str());
+  TEST_ASSERT_FALSE(log.contains("b"));
+  TEST_ASSERT_FALSE(log.contains("c"));
+
+  // The next batch is not affected
+  log.beginBatch();
+  log.put("d", "1");
+  TEST_ASSERT_TRUE(log.commitBatch());
+  TEST_ASSERT_TRUE(log.contains("d"));
+}
+
+void test_power_cuts_keep_old_or_new_state() {
+  std::mt19937 random(42);
+  SimFlashRegion flash(TEST_SECTORS);
+  // State before and after the operation running when the power is cut
+  Contents before;
+  Contents after;
+  Contents keys;
+  int cuts = 0;
+
+  for (int boot = 0; boot < 500; boot++) {
+    flash.restorePower();
+    RecordLog log(flash, "test");
+    TEST_ASSERT_TRUE(log.begin());
+    auto contents = readContents(log, keys);
+    if (contents == after) {
+      before = after;
+    } else {
+      TEST_ASSERT_TRUE_MESSAGE(contents == before, "Power cut left a state that was never written");
+      after = before;
+    }
+
+    flash.cutPowerAfter(random() % 20000);
+    try {
+      for (int op = 0; op < 200; op++) {
+        int kind = random() % 10;
+        if (kind < 6) {
+          std::string key = "k" + std::to_string(random() % 20);
+          std::string value(random() % 200, (char) ('a' + random() % 26));
+          keys[key];
+          after[key] = value;
+          log.put(key, value);
+        } else if (kind < 8) {
+          std::string key = "k" + std::to_string(random() % 20);
+          after.erase(key);
+          log.remove(key);
+        } else {
+          log.beginBatch();
+          int count = 1 + random() % 5;
+          for (int i = 0; i < count; i++) {
+            std::string key = "b" + std::to_string(random() % 10);
+            keys[key];
+            if (random() % 4) {
+              std::string value(random() % 100, (char) ('A' + random() % 26));
+              after[key] = value;
+              log.put(key, value);
+            } else {
+              after.erase(key);
+              log.remove(key);
+            }
+          }
+          TEST_ASSERT_TRUE(log.commitBatch());
+        }
+        while (log.needsCompaction()) {
+          log.compact();
+        }
+        TEST_ASSERT_TRUE(readContents(log, keys) == after);
+        before = after;
+      }
+    } catch (PowerCut &) {
+      cuts++;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(100, cuts);
+}
+
+void test_wear_is_spread_over_all_sectors() {
+  SimFlashRegion flash(TEST_SECTORS);
+  RecordLog log(flash, "test");
+  TEST_ASSERT_TRUE(log.begin());
+
+  // Values never written again fill sectors that are only erased to level the wear
+  for (int i = 0; i < 10; i++) {
+    TEST_ASSERT_TRUE(log.put("static" + std::to_string(i), std::string(300, (char) ('a' + i))));
+  }
+  for (int i = 0; i < 20000; i++) {
+    TEST_ASSERT_TRUE(log.put("hot", std::string(1000, (char) ('a' + i % 26))));
+    while (log.needsCompaction()) {
+      log.compact();
+    }
+  }
+
+  uint32_t min_erases = UINT32_MAX;
+  uint32_t max_erases = 0;
+  for (size_t i = 0; i < flash.getSectorCount(); i++) {
+    min_erases = std::min(min_erases, flash.getEraseCount(i));
+    max_erases = std::max(max_erases, flash.getEraseCount(i));
+  }
+  TEST_ASSERT_GREATER_THAN(RECORD_LOG_WEAR_SPREAD, max_erases);
+  TEST_ASSERT_LESS_OR_EQUAL(RECORD_LOG_WEAR_SPREAD + 1, max_erases - min_erases);
+
+  RecordLog rebooted(flash, "test");
+  TEST_ASSERT_TRUE(rebooted.begin());
+  for (int i = 0; i < 10; i++) {
+    std::string value;
+    TEST_ASSERT_TRUE(rebooted.get("static" + std::to_string(i), value));
+    TEST_ASSERT_TRUE(value == std::string(300, (char) ('a' + i)));
+  }
+}
+
+void test_view_reads_from_the_mapped_file() {
+  char path[] = "/tmp/record_log_XXXXXX";
+  int file = mkstemp(path);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, file);
+  close(file);
+
+  SimFlashRegion copied(TEST_SECTORS);
+  RecordLog copied_log(copied, "copied");
+  TEST_ASSERT_TRUE(copied_log.begin());
+  Contents keys;
+  {
+    FileFlashRegion mapped(path, TEST_SECTORS);
+    TEST_ASSERT_TRUE(mapped.begin());
+    TEST_ASSERT_NOT_NULL(mapped.getMapping());
+    RecordLog log(mapped, "mapped");
+    TEST_ASSERT_TRUE(log.begin());
+
+    // Enough writes to compact every sector a few times
+    std::mt19937 random(7);
+    for (int i = 0; i < 3000; i++) {
+      std::string key = "k" + std::to_string(random() % 30);
+      keys[key];
+      if (random() % 5) {
+        std::string value(1 + random() % 300, (char) ('a' + random() % 26));
+        log.put(key, value);
+        copied_log.put(key, value);
+      } else {
+        log.remove(key);
+        copied_log.remove(key);
+      }
+      while (log.needsCompaction()) {
+        log.compact();
+      }
+      while (copied_log.needsCompaction()) {
+        copied_log.compact();
+      }
+    }
+    for (auto &key: keys) {
+      TEST_ASSERT_TRUE(viewValue(log, key.first, &mapped) == viewValue(copied_log, key.first, nullptr));
+    }
+
+    // Staged values are passed from RAM
+    log.beginBatch();
+    log.put("staged", "value");
+    TEST_ASSERT_TRUE(viewValue(log, "staged", nullptr) == "value");
+    TEST_ASSERT_TRUE(log.commitBatch());
+    copied_log.put("staged", "value");
+    keys["staged"];
+  }
+
+  // Reopening the file reads the log through the new mapping
+  FileFlashRegion mapped(path, TEST_SECTORS);
+  TEST_ASSERT_TRUE(mapped.begin());
+  RecordLog log(mapped, "mapped");
+  TEST_ASSERT_TRUE(log.begin());
+  for (auto &key: keys) {
+    TEST_ASSERT_TRUE(viewValue(log, key.first, &mapped) == viewValue(copied_log, key.first, nullptr));
+  }
+  unlink(path);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_values_survive_reboot);
+  RUN_TEST(test_aborted_nested_batch_fails_outer_batch);
+  RUN_TEST(test_power_cuts_keep_old_or_new_state);
+  RUN_TEST(test_wear_is_spread_over_all_sectors);
+  RUN_TEST(test_view_reads_from_the_mapped_file);
+  return UNITY_END();
+}
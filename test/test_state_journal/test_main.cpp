@@ -0,0 +1,140 @@
+#include <unity.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "record_log.h"
+#include "state_journal.h"
+
+#define TEST_SECTORS 4
+
+/**
+ * Flash region in RAM whose writes can be made to fail
+ */
+class FailingFlashRegion : public FlashRegion {
+private:
+  std::vector<uint8_t> data_;
+
+public:
+  bool failing;
+
+  FailingFlashRegion() :
+      data_(TEST_SECTORS * FLASH_SECTOR_SIZE, 0xFF),
+      failing(false) {}
+
+  bool begin() override {
+    return true;
+  }
+
+  size_t getSize() const override {
+    return data_.size();
+  }
+
+  bool read(size_t offset, void *data, size_t len) override {
+    memcpy(data, &data_[offset], len);
+    return true;
+  }
+
+  bool write(size_t offset, const void *data, size_t len) override {
+    if (failing) {
+      return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+      data_[offset + i] &= ((const uint8_t *) data)[i];
+    }
+    return true;
+  }
+
+  bool eraseSector(size_t sector) override {
+    if (failing) {
+      return false;
+    }
+    memset(&data_[sector * FLASH_SECTOR_SIZE], 0xFF, FLASH_SECTOR_SIZE);
+    return true;
+  }
+};
+
+/**
+ * A value passed to the callback of StateJournal::restore()
+ */
+struct RestoredValue {
+  std::string gadget;
+  CharacteristicIdentifier characteristic;
+  int value;
+};
+
+/**
+ * Reads the journal of a region like after rebooting
+ * @param flash The region
+ * @return The stored values in the order they were changed in
+ */
+static std::vector<RestoredValue> restore(FailingFlashRegion &flash) {
+  RecordLog log(flash, "state");
+  StateJournal journal(log, 0);
+  TEST_ASSERT_TRUE(journal.begin());
+  std::vector<RestoredValue> values;
+  journal.restore([&values](const std::string &gadget, CharacteristicIdentifier characteristic, int value) {
+    values.push_back({gadget, characteristic, value});
+    return true;
+  });
+  return values;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_only_newest_values_are_written() {
+  FailingFlashRegion flash;
+  RecordLog log(flash, "state");
+  StateJournal journal(log, 0);
+  TEST_ASSERT_TRUE(journal.begin());
+  TEST_ASSERT_EQUAL(portMAX_DELAY, journal.getTicksUntilFlush());
+
+  for (int i = 0; i <= 100; i++) {
+    journal.record("lamp", CharacteristicIdentifier::brightness, i);
+  }
+  journal.record("fan", CharacteristicIdentifier::fanSpeed, -5);
+  TEST_ASSERT_TRUE(journal.flushIfDue());
+  TEST_ASSERT_EQUAL(portMAX_DELAY, journal.getTicksUntilFlush());
+
+  auto values = restore(flash);
+  TEST_ASSERT_EQUAL(2, values.size());
+  TEST_ASSERT_EQUAL_STRING("lamp", values[0].gadget.c_str());
+  TEST_ASSERT_EQUAL(100, values[0].value);
+  TEST_ASSERT_EQUAL_STRING("fan", values[1].gadget.c_str());
+  TEST_ASSERT_EQUAL(CharacteristicIdentifier::fanSpeed, values[1].characteristic);
+  TEST_ASSERT_EQUAL(-5, values[1].value);
+}
+
+void test_failed_flush_is_retried() {
+  FailingFlashRegion flash;
+  RecordLog log(flash, "state");
+  StateJournal journal(log, 0);
+  TEST_ASSERT_TRUE(journal.begin());
+
+  journal.record("lamp", CharacteristicIdentifier::status, 1);
+  journal.record("fan", CharacteristicIdentifier::fanSpeed, 2);
+  flash.failing = true;
+  TEST_ASSERT_FALSE(journal.flush());
+  TEST_ASSERT_EQUAL(0, journal.getTicksUntilFlush());
+
+  // Recorded after the failed write, so it wins over the value to retry
+  journal.record("lamp", CharacteristicIdentifier::status, 0);
+  flash.failing = false;
+  TEST_ASSERT_TRUE(journal.flush());
+
+  auto values = restore(flash);
+  TEST_ASSERT_EQUAL(2, values.size());
+  TEST_ASSERT_EQUAL_STRING("fan", values[0].gadget.c_str());
+  TEST_ASSERT_EQUAL(2, values[0].value);
+  TEST_ASSERT_EQUAL_STRING("lamp", values[1].gadget.c_str());
+  TEST_ASSERT_EQUAL(0, values[1].value);
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_only_newest_values_are_written);
+  RUN_TEST(test_failed_flush_is_retried);
+  return UNITY_END();
+}
@@ -0,0 +1,227 @@
+#include <unity.h>
+
+#include <climits>
+#include <string>
+#include "step_sequence.h"
+
+// Virtual clock passed to the sequences in ms
+static unsigned long now;
+
+static int runs;
+
+void setUp() {
+  now = 1000;
+  runs = 0;
+}
+
+void tearDown() {}
+
+static void countRun() {
+  runs++;
+}
+
+void test_actions_run_on_start() {
+  StepSequence sequence;
+  sequence.then(countRun).then(countRun);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+  sequence.start(now);
+  TEST_ASSERT_EQUAL(2, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+  TEST_ASSERT_EQUAL(ULONG_MAX, sequence.getTimeUntilNextStep(now));
+}
+
+void test_delay() {
+  StepSequence sequence;
+  sequence.then(countRun).delay(100).then(countRun);
+  sequence.start(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  TEST_ASSERT_EQUAL(100, sequence.getTimeUntilNextStep(now));
+
+  now += 99;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  TEST_ASSERT_EQUAL(1, sequence.getTimeUntilNextStep(now));
+
+  now += 1;
+  TEST_ASSERT_EQUAL(0, sequence.getTimeUntilNextStep(now));
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(2, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+}
+
+void test_delays_start_after_the_previous_step() {
+  StepSequence sequence;
+  sequence.delay(100).then(countRun).delay(100).then(countRun);
+  sequence.start(now);
+
+  // Advanced late, the second delay starts when the first one was noticed to be over
+  now += 150;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  now += 99;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  now += 1;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(2, runs);
+}
+
+void test_delay_over_clock_overflow() {
+  StepSequence sequence;
+  sequence.delay(100).then(countRun);
+  now = ULONG_MAX - 49;
+  sequence.start(now);
+
+  now += 99;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(0, runs);
+  TEST_ASSERT_EQUAL(1, sequence.getTimeUntilNextStep(now));
+  now += 1;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+}
+
+void test_wait_for_condition() {
+  bool ready = false;
+  StepSequence sequence;
+  sequence.waitFor([&ready]() { return ready; }, 500).then(countRun);
+  sequence.start(now);
+  TEST_ASSERT_TRUE(sequence.isRunning());
+  TEST_ASSERT_EQUAL(STEP_SEQUENCE_POLL_INTERVAL_MS, sequence.getTimeUntilNextStep(now));
+
+  now += STEP_SEQUENCE_POLL_INTERVAL_MS;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(0, runs);
+
+  ready = true;
+  now += STEP_SEQUENCE_POLL_INTERVAL_MS;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+  TEST_ASSERT_FALSE(sequence.hasTimedOut());
+}
+
+void test_wait_for_timeout() {
+  StepSequence sequence;
+  sequence.waitFor([]() { return false; }, 200).then(countRun);
+  sequence.start(now);
+
+  now += 190;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(0, runs);
+  TEST_ASSERT_EQUAL(10, sequence.getTimeUntilNextStep(now));
+
+  now += 10;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  TEST_ASSERT_TRUE(sequence.hasTimedOut());
+  TEST_ASSERT_FALSE(sequence.isRunning());
+}
+
+void test_timeout_is_reset_on_start() {
+  StepSequence sequence;
+  sequence.waitFor([]() { return false; }, 0);
+  sequence.start(now);
+  TEST_ASSERT_TRUE(sequence.hasTimedOut());
+
+  sequence.delay(10);
+  sequence.start(now);
+  TEST_ASSERT_FALSE(sequence.hasTimedOut());
+}
+
+void test_cancel() {
+  StepSequence sequence;
+  sequence.delay(100).then(countRun);
+  sequence.start(now);
+  sequence.cancel();
+  TEST_ASSERT_FALSE(sequence.isRunning());
+  TEST_ASSERT_EQUAL(ULONG_MAX, sequence.getTimeUntilNextStep(now));
+
+  now += 100;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(0, runs);
+
+  // Steps appended after cancelling start from scratch
+  sequence.then(countRun);
+  sequence.start(now);
+  TEST_ASSERT_EQUAL(1, runs);
+}
+
+void test_cancel_from_action() {
+  StepSequence sequence;
+  // Longer than the small string buffer, so reading it after the action was destroyed is caught by ASan
+  std::string label = "cancelled from inside the action";
+  std::string read_after_cancel;
+  sequence.then([&sequence, &read_after_cancel, label]() {
+    sequence.cancel();
+    read_after_cancel = label;
+  }).then(countRun);
+  sequence.start(now);
+  TEST_ASSERT_EQUAL_STRING("cancelled from inside the action", read_after_cancel.c_str());
+  TEST_ASSERT_EQUAL(0, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+}
+
+void test_cancel_from_condition() {
+  StepSequence sequence;
+  std::string label = "cancelled from inside the condition";
+  std::string read_after_cancel;
+  sequence.waitFor([&sequence, &read_after_cancel, label]() {
+    sequence.cancel();
+    read_after_cancel = label;
+    return true;
+  }, 100).then(countRun);
+  sequence.start(now);
+  TEST_ASSERT_EQUAL_STRING("cancelled from inside the condition", read_after_cancel.c_str());
+  TEST_ASSERT_EQUAL(0, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+}
+
+void test_append_from_action() {
+  StepSequence sequence;
+  int *counter = &runs;
+  // Small enough to be stored inside the std::function, so it moves when the steps grow
+  sequence.then([&sequence, counter]() {
+    for (int i = 0; i < 32; i++) {
+      sequence.then(countRun);
+    }
+    (*counter) += 100;
+  });
+  sequence.start(now);
+  TEST_ASSERT_EQUAL(132, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+}
+
+void test_restart_from_action() {
+  StepSequence sequence;
+  sequence.then([&sequence]() {
+    sequence.cancel();
+    sequence.delay(100).then(countRun);
+    sequence.start(now);
+  }).then(countRun);
+  sequence.start(now);
+  TEST_ASSERT_EQUAL(0, runs);
+  TEST_ASSERT_TRUE(sequence.isRunning());
+
+  now += 100;
+  sequence.advance(now);
+  TEST_ASSERT_EQUAL(1, runs);
+  TEST_ASSERT_FALSE(sequence.isRunning());
+}
+
+int main(int, char **) {
+  UNITY_BEGIN();
+  RUN_TEST(test_actions_run_on_start);
+  RUN_TEST(test_delay);
+  RUN_TEST(test_delays_start_after_the_previous_step);
+  RUN_TEST(test_delay_over_clock_overflow);
+  RUN_TEST(test_wait_for_condition);
+  RUN_TEST(test_wait_for_timeout);
+  RUN_TEST(test_timeout_is_reset_on_start);
+  RUN_TEST(test_cancel);
+  RUN_TEST(test_cancel_from_action);
+  RUN_TEST(test_cancel_from_condition);
+  RUN_TEST(test_append_from_action);
+  RUN_TEST(test_restart_from_action);
+  return UNITY_END();
+}